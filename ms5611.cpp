@@ -1,107 +1,232 @@
 #include <linux/spi/spidev.h>
-#include <sys/ioctl.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <fcntl.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 #include <cassert>
-#include <cmath>
+#include <cerrno>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <chrono>
 #include <iostream>
 #include <iomanip>
 #include <string>
+#include <thread>
 #include "ms5611.h"
+#include "ms5611_calcache.h"
+#include "ms5611_clock.h"
+#include "ms5611_spidev.h"
 
 using namespace std;
 
 // correct for gcc and a few other (but not all) compilers
 #define FUNC_NAME __PRETTY_FUNCTION__
 
+// instrumentation statements, compiled out without MS5611_STATS
+#ifdef MS5611_STATS
+#define STATS(stmt)                                                            \
+    do {                                                                       \
+        stmt;                                                                  \
+    } while (0)
+#else
+#define STATS(stmt)                                                            \
+    do {                                                                       \
+    } while (0)
+#endif
+
+// histogram index for a convert command's OSR
+static int osr_index(uint8_t cmd)
+{
+    return (cmd & 0x0e) >> 1;
+}
+
 // create device
 //
-// open the SPI device
-// configure SPI
-// reset the chip
+// open and configure the SPI device
+// reset the chip (unless attaching warm)
 // read cal data
-MS5611::MS5611(const string &dev_name, unsigned spi_clk, int verbosity)
-    : _dev_name(dev_name), _fd(-1), _verbosity(verbosity)
+MS5611::MS5611(const string &dev_name, unsigned spi_clk, int verbosity,
+               MS5611CalCache *cache)
+    : _dev_name(dev_name), _xport(NULL), _verbosity(verbosity),
+      _has_cal(false), _warm(false), _cache(NULL), _conv_pending(false),
+      _streaming(false), _stream_osr(OSR4096), _stream_pair_osr(OSR4096),
+      _stream_temp_every(1), _stream_drift_x100(0), _stream_temps(0),
+      _stream_times(), _async_fd(-1), _async_busy(false)
 {
     if (_verbosity > 1)
         cout << FUNC_NAME << ": " << dev_name << ", " << spi_clk << ", "
              << verbosity << endl;
 
-    if (spi_clk == 0 || spi_clk > 20000000) {
-        if (_verbosity > 0)
-            cerr << FUNC_NAME << " ERROR: spi_clk=" << spi_clk << " invalid"
-                 << endl;
+    MS5611Spidev *spidev = new MS5611Spidev(dev_name, spi_clk, verbosity);
+    _xport_owned.reset(spidev);
+    if (!spidev->is_open()) {
+        // error message already printed
+        _xport_owned.reset();
         return;
     }
 
-    // open spi device
-    _fd = open(_dev_name.c_str(), O_RDWR);
-    if (_fd < 0) {
+    _xport = spidev;
+    STATS(_stats.set_spi_clk(spi_clk));
+    _init(cache);
+}
+
+// create device on an existing transport
+MS5611::MS5611(Transport &xport, int verbosity, MS5611CalCache *cache,
+               const string &cache_key)
+    : _dev_name(cache_key), _xport(&xport), _verbosity(verbosity),
+      _has_cal(false), _warm(false), _cache(NULL), _conv_pending(false),
+      _streaming(false), _stream_osr(OSR4096), _stream_pair_osr(OSR4096),
+      _stream_temp_every(1), _stream_drift_x100(0), _stream_temps(0),
+      _stream_times(), _async_fd(-1), _async_busy(false)
+{
+    if (_verbosity > 1)
+        cout << FUNC_NAME << ": " << verbosity << endl;
+
+    _init(cache);
+}
+
+// calibration only (e.g. from a log or MS5611CalCache), no device
+MS5611::MS5611(const uint16_t prom[8], int verbosity)
+    : _xport(NULL), _verbosity(verbosity), _has_cal(false), _warm(false),
+      _cache(NULL), _conv_pending(false), _streaming(false),
+      _stream_osr(OSR4096), _stream_pair_osr(OSR4096), _stream_temp_every(1),
+      _stream_drift_x100(0), _stream_temps(0), _stream_times(),
+      _async_fd(-1), _async_busy(false)
+{
+    if (_verbosity > 1)
+        cout << FUNC_NAME << ": " << verbosity << endl;
+
+    memcpy(_c, prom, sizeof(_c));
+    if ((_c[7] & 0x000f) != _crc4()) {
         if (_verbosity > 0)
-            cerr << FUNC_NAME << " ERROR: opening " << _dev_name << endl;
+            cerr << FUNC_NAME << " ERROR: calibration data CRC" << endl;
+        STATS(_stats.count_crc_error());
         return;
     }
 
-    // Configure spi bus. The chip should work in either mode 0 or mode 3;
-    // most of the waveforms in the data sheet look like mode 0 so use that.
-    uint8_t mode = SPI_MODE_0;
-    uint8_t bits = 8;
-    uint32_t clk = spi_clk;
-    if (ioctl(_fd, SPI_IOC_WR_MODE, &mode) < 0 ||
-        ioctl(_fd, SPI_IOC_RD_MODE, &mode) < 0 ||
-        ioctl(_fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0 ||
-        ioctl(_fd, SPI_IOC_RD_BITS_PER_WORD, &bits) < 0 ||
-        ioctl(_fd, SPI_IOC_WR_MAX_SPEED_HZ, &clk) < 0 ||
-        ioctl(_fd, SPI_IOC_RD_MAX_SPEED_HZ, &clk) < 0) {
-        if (_verbosity > 0)
-            cerr << FUNC_NAME << " ERROR: initializing " << _dev_name << endl;
-        close(_fd);
-        _fd = -1;
+    _comp.set_prom(_c);
+    _has_cal = true;
+}
+
+MS5611::~MS5611()
+{
+    if (_verbosity > 1)
+        cout << FUNC_NAME << endl;
+
+    detach();
+    if (_async_fd >= 0)
+        close(_async_fd);
+}
+
+void MS5611::detach()
+{
+    if (_xport == NULL)
         return;
+
+    _idle();
+    if (_cache != NULL)
+        _cache->set_idle(_dev_name, true);
+    _cache = NULL;
+    _xport = NULL;
+    _xport_owned.reset();
+}
+
+// wait out and read the conversion in progress, if any, so the chip is
+// idle with nothing left to read
+void MS5611::_idle()
+{
+    _streaming = false;
+    _async_busy = false;
+    if (_async_fd >= 0)
+        _async_arm(Clock::time_point());
+
+    if (!_conv_pending)
+        return;
+    this_thread::sleep_until(_conv_done);
+    uint32_t data;
+    read_adc(data);
+}
+
+// reset the chip, read and check cal data
+//
+// With a cache entry, first try a warm attach: if the whole PROM (read in
+// one message) matches the entry and the entry says the previous user left
+// the chip idle (see detach()), the chip is not reset. A matching PROM
+// alone proves nothing: a process killed mid-conversion leaves the chip
+// converting, and it ignores commands until done.
+//
+// on any error the device is left not ready
+void MS5611::_init(MS5611CalCache *cache)
+{
+#ifdef MS5611_STATS
+    Clock::time_point start = Clock::now();
+#endif
+
+    uint16_t cached[8];
+    if (cache != NULL && cache->get(_dev_name, cached)) {
+        uint16_t c[8];
+        if (!cache->idle(_dev_name)) {
+            if (_verbosity > 1)
+                cout << FUNC_NAME << ": " << _dev_name
+                     << " was not left idle" << endl;
+        } else if (_read_prom_all(c) && memcmp(c, cached, sizeof(c)) == 0 &&
+                   (c[7] & 0x000f) == crc4(c)) {
+            memcpy(_c, c, sizeof(_c));
+            _warm = true;
+        } else if (_verbosity > 1) {
+            cout << FUNC_NAME << ": " << _dev_name
+                 << " does not match calibration cache" << endl;
+        }
     }
 
+    if (!_warm && !_init_cold())
+        return;
+
+    _comp.set_prom(_c);
+    _has_cal = true;
+
+    // busy until detach()
+    if (cache != NULL) {
+        cache->put(_dev_name, _c);
+        _cache = cache;
+    }
+
+    STATS(_stats.set_startup(chrono::duration_cast<chrono::nanoseconds>(
+                                 Clock::now() - start)
+                                 .count(),
+                             _warm));
+}
+
+// reset chip and read cal data
+bool MS5611::_init_cold()
+{
     // reset chip
     if (!_reset()) {
         // error message already printed
-        close(_fd);
-        _fd = -1;
-        return;
+        _xport = NULL;
+        _xport_owned.reset();
+        return false;
     }
 
     // read calibration data
     if (!_read_cal()) {
         if (_verbosity > 0)
             cerr << FUNC_NAME << " ERROR: reading calibration data" << endl;
-        close(_fd);
-        _fd = -1;
-        return;
+        _xport = NULL;
+        _xport_owned.reset();
+        return false;
     }
 
     // check crc of cal data
     if ((_c[7] & 0x000f) != _crc4()) {
         if (_verbosity > 0)
             cerr << FUNC_NAME << " ERROR: calibration data CRC" << endl;
-        close(_fd);
-        _fd = -1;
-        return;
+        STATS(_stats.count_crc_error());
+        _xport = NULL;
+        _xport_owned.reset();
+        return false;
     }
-}
-
-MS5611::~MS5611()
-{
-    if (_verbosity > 1)
-        cout << FUNC_NAME << endl;
 
-    if (_fd < 0)
-        return;
-
-    close(_fd);
-    _fd = -1;
+    return true;
 }
 
 // reset chip
@@ -116,7 +241,7 @@ MS5611::~MS5611()
 // one when the reset is complete to see that it is high.
 bool MS5611::_reset()
 {
-    if (_fd < 0) {
+    if (_xport == NULL) {
         if (_verbosity > 0)
             cerr << FUNC_NAME << " ERROR: device not ready" << endl;
         return false;
@@ -140,7 +265,7 @@ bool MS5611::_reset()
     spi_cmd[2].rx_buf = uint64_t(&rx_data_1[0]);
     spi_cmd[2].len = 1;
 
-    if (ioctl(_fd, SPI_IOC_MESSAGE(3), spi_cmd) < 0) {
+    if (!_transfer(spi_cmd, 3, OP_RESET, OSR_NONE)) {
         if (_verbosity > 0)
             cerr << FUNC_NAME << " ERROR: issuing command" << endl;
         return false;
@@ -159,69 +284,69 @@ bool MS5611::_reset()
     return true;
 }
 
-// read one calibration word
-bool MS5611::_read_cal_word(int n, uint16_t &data)
+// read all calibration words into _c[]
+bool MS5611::_read_cal()
 {
-    if (_fd < 0) {
-        if (_verbosity > 0)
-            cerr << FUNC_NAME << " ERROR: device not ready" << endl;
+    if (!_read_prom_all(_c))
+        // error message already printed
         return false;
-    }
 
-    if (n >= 8) {
+    // crc is expected to be checked elsewhere
+
+    return true;
+}
+
+// read all calibration words in one message
+//
+// Each word is its own chip select frame (command, then two bytes in);
+// cs_change ends each frame but the last.
+bool MS5611::_read_prom_all(uint16_t c[8])
+{
+    if (_xport == NULL) {
         if (_verbosity > 0)
-            cerr << FUNC_NAME << " ERROR: n=" << n << " invalid" << endl;
+            cerr << FUNC_NAME << " ERROR: device not ready" << endl;
         return false;
     }
 
-    struct spi_ioc_transfer spi_cmd[2];
+    struct spi_ioc_transfer spi_cmd[16];
     memset(spi_cmd, 0, sizeof(spi_cmd));
 
-    uint8_t cmd = 0xa0 + n * 2;
-    uint8_t tx_data[1] = {cmd};
-    spi_cmd[0].tx_buf = uint64_t(&tx_data[0]);
-    spi_cmd[0].len = 1;
-
-    uint8_t rx_data[2] = {0, 0};
-    spi_cmd[1].rx_buf = uint64_t(&rx_data[0]);
-    spi_cmd[1].len = 2;
+    static const uint8_t tx_data[8] = {0xa0, 0xa2, 0xa4, 0xa6,
+                                       0xa8, 0xaa, 0xac, 0xae};
+    uint8_t rx_data[8][2];
+    for (int n = 0; n < 8; n++) {
+        spi_cmd[2 * n].tx_buf = uint64_t(&tx_data[n]);
+        spi_cmd[2 * n].len = 1;
+        spi_cmd[2 * n + 1].rx_buf = uint64_t(&rx_data[n][0]);
+        spi_cmd[2 * n + 1].len = 2;
+        spi_cmd[2 * n + 1].cs_change = n < 7;
+    }
 
-    if (ioctl(_fd, SPI_IOC_MESSAGE(2), spi_cmd) < 0) {
+    if (!_transfer(spi_cmd, 16, OP_PROM, OSR_NONE)) {
         if (_verbosity > 0)
             cerr << FUNC_NAME << " ERROR: issuing command" << endl;
         return false;
     }
 
-    data = (uint16_t(rx_data[0]) << 8) | uint16_t(rx_data[1]);
-
-    return true;
-}
-
-// read all calibration words into _c[]
-bool MS5611::_read_cal()
-{
     for (int n = 0; n < 8; n++)
-        if (!_read_cal_word(n, _c[n]))
-            // error message already printed
-            return false;
-
-    // crc is expected to be checked elsewhere
+        c[n] = (uint16_t(rx_data[n][0]) << 8) | uint16_t(rx_data[n][1]);
 
     return true;
 }
 
 // calculate crc4 over calibration words
 // based on http://www.amsys.info/sheets/amsys.en.an520_e.pdf
-uint8_t MS5611::_crc4()
+uint8_t MS5611::crc4(const uint16_t c[8])
 {
     uint16_t rem = 0;
-    uint16_t c7_save = _c[7];
-    _c[7] &= 0xff00;
     for (int byte = 0; byte < 16; byte++) {
+        uint16_t word = c[byte >> 1];
+        if (byte == 15)
+            word &= 0xff00; // crc itself is not included
         if (byte % 2 == 1)
-            rem ^= _c[byte >> 1] & 0x00ff;
+            rem ^= word & 0x00ff;
         else
-            rem ^= _c[byte >> 1] >> 8;
+            rem ^= word >> 8;
         for (int bit = 0; bit < 8; bit++) {
             if (rem & 0x8000)
                 rem = (rem << 1) ^ 0x3000;
@@ -229,16 +354,20 @@ uint8_t MS5611::_crc4()
                 rem = (rem << 1);
         }
     }
-    _c[7] = c7_save;
     return rem >> 12;
 }
 
+uint8_t MS5611::_crc4()
+{
+    return crc4(_c);
+}
+
 // start a conversion
 //
 // cmd is one of the "convert" commands from the datasheet
 bool MS5611::_start_convert(uint8_t cmd)
 {
-    if (_fd < 0) {
+    if (_xport == NULL) {
         if (_verbosity > 0)
             cerr << FUNC_NAME << " ERROR: device not ready" << endl;
         return false;
@@ -261,7 +390,7 @@ bool MS5611::_start_convert(uint8_t cmd)
     spi_cmd[0].tx_buf = uint64_t(&tx_data[0]);
     spi_cmd[0].len = 1;
 
-    if (ioctl(_fd, SPI_IOC_MESSAGE(1), spi_cmd) < 0) {
+    if (!_transfer(spi_cmd, 1, OP_START_CONVERT, osr_index(cmd))) {
         if (_verbosity > 0)
             cerr << FUNC_NAME << " ERROR: issuing command" << endl;
         return false;
@@ -273,7 +402,7 @@ bool MS5611::_start_convert(uint8_t cmd)
 // read adc result
 bool MS5611::read_adc(uint32_t &data)
 {
-    if (_fd < 0) {
+    if (_xport == NULL) {
         if (_verbosity > 0)
             cerr << FUNC_NAME << " ERROR: device not ready" << endl;
         return false;
@@ -290,7 +419,7 @@ bool MS5611::read_adc(uint32_t &data)
     spi_cmd[1].rx_buf = uint64_t(&rx_data[0]);
     spi_cmd[1].len = 3;
 
-    if (ioctl(_fd, SPI_IOC_MESSAGE(2), spi_cmd) < 0) {
+    if (!_transfer(spi_cmd, 2, OP_READ_ADC, OSR_NONE)) {
         if (_verbosity > 0)
             cerr << FUNC_NAME << " ERROR: issuing command" << endl;
         return false;
@@ -298,6 +427,8 @@ bool MS5611::read_adc(uint32_t &data)
 
     data = (uint32_t(rx_data[0]) << 16) | (uint32_t(rx_data[1]) << 8) |
            uint32_t(rx_data[2]);
+    if (data == 0)
+        STATS(_stats.count_zero_adc());
 
     return true;
 }
@@ -306,7 +437,7 @@ bool MS5611::read_adc(uint32_t &data)
 // this function blocks for the duration of the conversion
 bool MS5611::_do_convert(uint8_t cmd, uint32_t &data)
 {
-    if (_fd < 0) {
+    if (_xport == NULL) {
         if (_verbosity > 0)
             cerr << FUNC_NAME << " ERROR: device not ready" << endl;
         return false;
@@ -322,9 +453,8 @@ bool MS5611::_do_convert(uint8_t cmd, uint32_t &data)
         return false;
     }
 
-    unsigned osr_code = (cmd >> 1) & 0x07; // 0, 1, 2, 3, 4
-    unsigned usec_delay = 600 << osr_code; // 600, 1200, 2400, 4800, 9600
-    // cout << "osr_code=" << osr_code << " usec_delay=" << usec_delay << endl;
+    unsigned usec_delay = conv_usec(Osr(cmd & 0x0e));
+    // cout << "usec_delay=" << usec_delay << endl;
 
     struct spi_ioc_transfer spi_cmd[3];
     memset(spi_cmd, 0, sizeof(spi_cmd));
@@ -343,94 +473,568 @@ bool MS5611::_do_convert(uint8_t cmd, uint32_t &data)
     spi_cmd[2].rx_buf = uint64_t(&rx_data[0]);
     spi_cmd[2].len = 3;
 
-    // auto t1 = chrono::system_clock::now();
+    if (!_transfer(spi_cmd, 3, OP_DO_CONVERT, osr_index(cmd))) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: issuing command" << endl;
+        return false;
+    }
 
-    if (ioctl(_fd, SPI_IOC_MESSAGE(3), spi_cmd) < 0) {
+    data = (uint32_t(rx_data[0]) << 16) | (uint32_t(rx_data[1]) << 8) |
+           uint32_t(rx_data[2]);
+    if (data == 0)
+        STATS(_stats.count_zero_adc());
+
+    return true;
+}
+
+bool MS5611::_check_osr(Osr oversamp)
+{
+    if ((oversamp & ~0x0e) != 0 || oversamp > OSR4096) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: oversamp=" << int(oversamp)
+                 << " invalid" << endl;
+        return false;
+    }
+    return true;
+}
+
+// one conversion in a chain: convert command, wait, then read adc
+//
+// fills three transfers; the last ends the chip select frame if cs_change
+static void chain_convert(struct spi_ioc_transfer *spi_cmd,
+                          const uint8_t *tx_convert, const uint8_t *tx_read,
+                          uint8_t *rx_data, bool cs_change)
+{
+    spi_cmd[0].tx_buf = uint64_t(tx_convert);
+    spi_cmd[0].len = 1;
+    spi_cmd[0].delay_usecs = MS5611::conv_usec(MS5611::Osr(*tx_convert & 0x0e));
+    spi_cmd[0].cs_change = true;
+
+    spi_cmd[1].tx_buf = uint64_t(tx_read);
+    spi_cmd[1].len = 1;
+
+    spi_cmd[2].rx_buf = uint64_t(rx_data);
+    spi_cmd[2].len = 3;
+    spi_cmd[2].cs_change = cs_change;
+}
+
+static uint32_t adc_value(const uint8_t rx_data[3])
+{
+    return (uint32_t(rx_data[0]) << 16) | (uint32_t(rx_data[1]) << 8) |
+           uint32_t(rx_data[2]);
+}
+
+// temperature and pressure conversions in one message
+//
+// convert T, wait, read, convert P, wait, read; each command and each read
+// is its own chip select frame, as in _do_convert
+bool MS5611::do_convert_pair(uint32_t &temp_adc, uint32_t &pres_adc,
+                             Osr temp_osr, Osr pres_osr)
+{
+    if (_xport == NULL) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: device not ready" << endl;
+        return false;
+    }
+
+    if (!_check_osr(temp_osr) || !_check_osr(pres_osr))
+        // error message already printed
+        return false;
+
+    struct spi_ioc_transfer spi_cmd[6];
+    memset(spi_cmd, 0, sizeof(spi_cmd));
+
+    uint8_t tx_data[3] = {uint8_t(TEMP | temp_osr), uint8_t(PRES | pres_osr),
+                          0x00};
+    uint8_t rx_data[2][3];
+    chain_convert(&spi_cmd[0], &tx_data[0], &tx_data[2], rx_data[0], true);
+    chain_convert(&spi_cmd[3], &tx_data[1], &tx_data[2], rx_data[1], false);
+
+    if (!_transfer(spi_cmd, 6, OP_DO_CONVERT_PAIR, pres_osr >> 1)) {
         if (_verbosity > 0)
             cerr << FUNC_NAME << " ERROR: issuing command" << endl;
         return false;
     }
 
-    // auto t2 = chrono::system_clock::now();
-    // cout << "ioctl took "
-    //     << chrono::duration_cast<chrono::microseconds>(t2 - t1).count()
-    //     << " usec" << endl;
+    temp_adc = adc_value(rx_data[0]);
+    pres_adc = adc_value(rx_data[1]);
+    if (temp_adc == 0 || pres_adc == 0)
+        STATS(_stats.count_zero_adc());
+
+    return true;
+}
+
+// pressure conversions back to back, BURST_MAX per message
+bool MS5611::do_convert_burst(uint32_t *pres_adc, size_t n, Osr oversamp)
+{
+    if (_xport == NULL) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: device not ready" << endl;
+        return false;
+    }
+
+    if (!_check_osr(oversamp))
+        // error message already printed
+        return false;
+
+    struct spi_ioc_transfer spi_cmd[3 * BURST_MAX];
+    uint8_t tx_data[2] = {uint8_t(PRES | oversamp), 0x00};
+    uint8_t rx_data[BURST_MAX][3];
+
+    while (n > 0) {
+        unsigned count = n < BURST_MAX ? n : BURST_MAX;
+
+        memset(spi_cmd, 0, 3 * count * sizeof(spi_cmd[0]));
+        for (unsigned i = 0; i < count; i++)
+            chain_convert(&spi_cmd[3 * i], &tx_data[0], &tx_data[1],
+                          rx_data[i], i + 1 < count);
+
+        if (!_transfer(spi_cmd, 3 * count, OP_DO_CONVERT_BURST,
+                       oversamp >> 1)) {
+            if (_verbosity > 0)
+                cerr << FUNC_NAME << " ERROR: issuing command" << endl;
+            return false;
+        }
+
+        for (unsigned i = 0; i < count; i++) {
+            pres_adc[i] = adc_value(rx_data[i]);
+            if (pres_adc[i] == 0)
+                STATS(_stats.count_zero_adc());
+        }
+
+        pres_adc += count;
+        n -= count;
+    }
+
+    return true;
+}
+
+// read adc result and start another conversion, in one message
+//
+// cmd is one of the "convert" commands from the datasheet (not checked)
+bool MS5611::_read_adc_convert(uint8_t cmd, uint32_t &data)
+{
+    if (_xport == NULL) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: device not ready" << endl;
+        return false;
+    }
+
+    struct spi_ioc_transfer spi_cmd[3];
+    memset(spi_cmd, 0, sizeof(spi_cmd));
+
+    uint8_t tx_read[1] = {0x00};
+    spi_cmd[0].tx_buf = uint64_t(&tx_read[0]);
+    spi_cmd[0].len = 1;
+
+    uint8_t rx_data[3] = {0, 0, 0};
+    spi_cmd[1].rx_buf = uint64_t(&rx_data[0]);
+    spi_cmd[1].len = 3;
+    spi_cmd[1].cs_change = true;
+
+    uint8_t tx_convert[1] = {cmd};
+    spi_cmd[2].tx_buf = uint64_t(&tx_convert[0]);
+    spi_cmd[2].len = 1;
+
+    if (!_transfer(spi_cmd, 3, OP_READ_ADC_CONVERT, osr_index(cmd))) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: issuing command" << endl;
+        return false;
+    }
 
     data = (uint32_t(rx_data[0]) << 16) | (uint32_t(rx_data[1]) << 8) |
            uint32_t(rx_data[2]);
+    if (data == 0)
+        STATS(_stats.count_zero_adc());
 
     return true;
 }
 
-// get pressure and temperature
-bool MS5611::get_pressure(uint32_t temp_adc, uint32_t pres_adc,
-                          int32_t &temp_x100, int32_t &pres_x100) const
+// run the message built by start_convert<>() or convert<>()
+//
+// if rx is not NULL, the ADC result in it goes to *data
+bool MS5611::_transfer_fixed(struct spi_ioc_transfer *xfer, unsigned n,
+                             Op op, int osr, const uint8_t *rx,
+                             uint32_t *data)
 {
-    uint32_t d1 = pres_adc;
-    uint32_t d2 = temp_adc;
+    if (_xport == NULL) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: device not ready" << endl;
+        return false;
+    }
 
-    // asserts are based on numerical ranges (not sanity)
+    if (!_transfer(xfer, n, op, osr)) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: issuing command" << endl;
+        return false;
+    }
 
-    assert(_c[1] < (1 << 16));
-    assert(_c[2] < (1 << 16));
-    assert(_c[3] < (1 << 16));
-    assert(_c[4] < (1 << 16));
-    assert(_c[5] < (1 << 16));
-    assert(_c[6] < (1 << 16));
+    if (rx != NULL) {
+        *data = (uint32_t(rx[0]) << 16) | (uint32_t(rx[1]) << 8) |
+                uint32_t(rx[2]);
+        if (*data == 0)
+            STATS(_stats.count_zero_adc());
+    }
 
-    assert(d1 < (1 << 24));
-    assert(d2 < (1 << 24));
+    return true;
+}
 
-    // do most calculations with 64 bits to prevent overflow
+// run one SPI message, timing it if instrumentation is built in
+//
+// Also tracks whether it left a conversion running, for _idle(); a start
+// that failed may have started anyway.
+bool MS5611::_transfer(struct spi_ioc_transfer *xfer, unsigned n, Op op,
+                       int osr)
+{
+#ifdef MS5611_STATS
+    static_assert(int(OP_READ_ADC_CONVERT) ==
+                          int(MS5611Stats::READ_ADC_CONVERT) &&
+                      OSR_NONE == MS5611Stats::OSR_NONE,
+                  "MS5611::Op does not match MS5611Stats::Op");
+    Clock::time_point start = Clock::now();
+    bool ok = _xport->transfer(xfer, n);
+    uint64_t ns =
+        chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start)
+            .count();
+    _stats.record(MS5611Stats::Op(op), osr, ns, ok);
+#else
+    bool ok = _xport->transfer(xfer, n);
+#endif
+
+    if (op == OP_START_CONVERT || op == OP_READ_ADC_CONVERT) {
+        _conv_pending = true;
+        _conv_done = Clock::now() + chrono::microseconds(600 << osr);
+    } else if (ok && op != OP_PROM) {
+        _conv_pending = false;
+    }
 
-    int64_t c1 = _c[1];
-    int64_t c2 = _c[2];
-    int64_t c3 = _c[3];
-    int64_t c4 = _c[4];
-    int64_t c5 = _c[5];
-    int64_t c6 = _c[6];
+    return ok;
+}
 
-    // calculate temperature
+// start a conversion without waiting for it
+//
+// returns when it will be done, or Clock::time_point() on error
+MS5611::Clock::time_point MS5611::begin(Convert what, Osr oversamp)
+{
+    if (_streaming || _async_busy) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: "
+                 << (_streaming ? "streaming" : "conversion in progress")
+                 << endl;
+        return Clock::time_point();
+    }
+
+    if (!_check_osr(oversamp) || !_start_convert(what | oversamp))
+        // error message already printed
+        return Clock::time_point();
 
-    int32_t dT = d2 - c5 * 256;
-    int32_t temp = 2000 + dT * c6 / (1 << 23);
-    // validate range according to part's spec
-    if (temp < -4000 || temp > 8500) {
+    // the conversion started during the transfer, so this is conservative
+    _async_busy = true;
+    _async_osr = oversamp;
+    _async_deadline = Clock::now() + chrono::microseconds(conv_usec(oversamp));
+    if (_async_fd >= 0)
+        _async_arm(_async_deadline);
+
+    return _async_deadline;
+}
+
+// read the conversion begun if it is done
+//
+// does not wait: done is false (and the result true) while it is still in
+// progress
+bool MS5611::try_complete(bool &done, uint32_t &data)
+{
+    done = false;
+
+    if (!_async_busy) {
         if (_verbosity > 0)
-            cerr << FUNC_NAME << " ERROR: temperature " << temp
-                 << " out of range" << endl;
+            cerr << FUNC_NAME << " ERROR: no conversion in progress" << endl;
         return false;
     }
 
-    // second-order temperature adjustments
-    int64_t t2 = 0;
-    int64_t off2 = 0;
-    int64_t sens2 = 0;
-    int32_t t_lo = temp - 2000;
-    if (t_lo < 0) {
-        t2 = dT * dT / (1 << 31);
-        off2 = 5 * t_lo * t_lo / 2;
-        sens2 = off2 / 2;
-        t_lo = temp - -1500;
-        if (t_lo < 0) {
-            off2 += (7 * t_lo * t_lo);
-            sens2 += (11 * t_lo * t_lo / 2);
-        }
+    Clock::time_point now = Clock::now();
+    if (now < _async_deadline)
+        return true;
+
+#ifdef MS5611_STATS
+    {
+        chrono::nanoseconds late = now - _async_deadline;
+        _stats.record(MS5611Stats::WAKEUP, _async_osr >> 1, late.count(),
+                      true);
+    }
+#endif
+
+    _async_busy = false;
+    if (_async_fd >= 0)
+        _async_arm(Clock::time_point());
+
+    if (!read_adc(data))
+        // error message already printed
+        return false;
+
+    done = true;
+    return true;
+}
+
+int MS5611::async_fd()
+{
+    if (_async_fd >= 0)
+        return _async_fd;
+
+    _async_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (_async_fd < 0) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: timerfd_create: " << strerror(errno)
+                 << endl;
+        return -1;
+    }
+    if (_async_busy)
+        _async_arm(_async_deadline);
+
+    return _async_fd;
+}
+
+// arm the timerfd for a CLOCK_MONOTONIC time (steady_clock), or disarm it
+// with Clock::time_point(); either way it is not readable until then
+void MS5611::_async_arm(Clock::time_point when)
+{
+    int64_t ns =
+        chrono::duration_cast<chrono::nanoseconds>(when.time_since_epoch())
+            .count();
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = ns / 1000000000;
+    its.it_value.tv_nsec = ns % 1000000000;
+    if (timerfd_settime(_async_fd, TFD_TIMER_ABSTIME, &its, NULL) != 0 &&
+        _verbosity > 0)
+        cerr << FUNC_NAME << " ERROR: timerfd_settime: " << strerror(errno)
+             << endl;
+}
+
+// start continuous acquisition
+bool MS5611::stream_start(Osr temp_osr, Osr pres_osr)
+{
+    if (!_check_osr(temp_osr) || !_check_osr(pres_osr))
+        // error message already printed
+        return false;
+
+    if (_streaming)
+        stream_stop();
+
+    if (_async_busy) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: conversion in progress" << endl;
+        return false;
     }
 
-    temp_x100 = temp - t2;
+    _stream_start_ns = MS5611Clock::raw_ns();
+    if (!_start_convert(TEMP | temp_osr))
+        // error message already printed
+        return false;
+
+    _streaming = true;
+    _stream_temp_osr = temp_osr;
+    _stream_pres_osr = pres_osr;
+    _stream_pres = false;
+    _stream_osr = temp_osr;
+    _stream_pair_osr = pres_osr;
+    _stream_terms.ok = false;
+    _stream_pres_left = 0;
+    _stream_deadline =
+        Clock::now() + chrono::microseconds(conv_usec(temp_osr));
+
+    return true;
+}
+
+// read the conversion in progress and start the next one
+//
+// does not wait; call after stream_deadline()
+bool MS5611::stream_next(bool &pair, uint32_t &temp_adc, uint32_t &pres_adc)
+{
+    pair = false;
+
+    if (!_streaming) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: not streaming" << endl;
+        return false;
+    }
 
-    // calculate pressure
-    int64_t off = c2 * (1 << 16) + (c4 * dT) / (1 << 7) - off2;
-    int64_t sens = c1 * (1 << 15) + (c3 * dT) / (1 << 8) - sens2;
-    pres_x100 = (d1 * sens / (1 << 21) - off) / (1 << 15);
+#ifdef MS5611_STATS
+    {
+        chrono::nanoseconds late = Clock::now() - _stream_deadline;
+        _stats.record(MS5611Stats::WAKEUP, _stream_osr >> 1,
+                      late.count() > 0 ? late.count() : 0, true);
+    }
+#endif
+
+    // after a pressure conversion, temperature if it's due
+    bool next_pres = !_stream_pres || _stream_pres_left > 1;
+    Osr next_osr = next_pres ? _stream_pres_osr : _stream_temp_osr;
+    uint8_t next_cmd = (next_pres ? PRES : TEMP) | next_osr;
+    uint32_t data;
+    int64_t read_ns = MS5611Clock::raw_ns();
+    if (!_read_adc_convert(next_cmd, data)) {
+        // error message already printed
+        _streaming = false;
+        return false;
+    }
+    int64_t start_ns = MS5611Clock::raw_ns();
+
+    // the conversion started during the transfer, so this is conservative
+    _stream_deadline = Clock::now() + chrono::microseconds(conv_usec(next_osr));
+
+    if (_stream_pres) {
+        temp_adc = _stream_temp_adc;
+        pres_adc = data;
+        pair = true;
+        _stream_times.pres_start_ns = _stream_start_ns;
+        _stream_times.pres_read_ns = read_ns;
+        _stream_times.mid_ns = mid_ns(_stream_start_ns, read_ns, _stream_osr);
+        _stream_pair_osr = _stream_osr;
+        _stream_pres_left--;
+    } else {
+        // a drifting temperature is converted again right away
+        MS5611Comp::Terms terms;
+        _comp.terms(data, terms);
+        bool drift = _stream_drift_x100 > 0 && _stream_terms.ok &&
+                     terms.ok &&
+                     abs(terms.temp_x100 - _stream_terms.temp_x100) >=
+                         _stream_drift_x100;
+        _stream_pres_left = drift ? 1 : _stream_temp_every;
+        _stream_terms = terms;
+        _stream_temp_adc = data;
+        _stream_temps++;
+        _stream_times.temp_start_ns = _stream_start_ns;
+        _stream_times.temp_read_ns = read_ns;
+    }
+    _stream_pres = next_pres;
+    _stream_osr = next_osr;
+    _stream_start_ns = start_ns;
 
     return true;
 }
 
+// the conversion in progress keeps its OSR
+bool MS5611::stream_set_osr(Osr temp_osr, Osr pres_osr)
+{
+    if (!_check_osr(temp_osr) || !_check_osr(pres_osr))
+        // error message already printed
+        return false;
+
+    _stream_temp_osr = temp_osr;
+    _stream_pres_osr = pres_osr;
+
+    return true;
+}
+
+// read the next temperature/pressure pair
+//
+// blocks until both conversions are done (about two conversion times)
+bool MS5611::stream_read(uint32_t &temp_adc, uint32_t &pres_adc)
+{
+    bool pair = false;
+    while (!pair) {
+        if (_streaming)
+            this_thread::sleep_until(_stream_deadline);
+        if (!stream_next(pair, temp_adc, pres_adc))
+            // error message already printed
+            return false;
+    }
+
+    return true;
+}
+
+// stop continuous acquisition
+//
+// waits for the conversion in progress and discards it
+void MS5611::stream_stop()
+{
+    if (!_streaming)
+        return;
+
+    _idle();
+}
+
+// compensate with the stream's temperature terms
+bool MS5611::stream_get_pressure(uint32_t pres_adc, int32_t &temp_x100,
+                                 int32_t &pres_x100) const
+{
+    assert(pres_adc < (1 << 24));
+
+    if (!_stream_terms.ok) {
+        STATS(_stats.count_range_errors());
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: temperature "
+                 << _stream_terms.temp_x100 << " out of range" << endl;
+        return false;
+    }
+
+    temp_x100 = _stream_terms.temp_x100;
+    pres_x100 = MS5611Comp::pressure(_stream_terms, pres_adc);
+
+    return true;
+}
+
+// get pressure and temperature
+bool MS5611::get_pressure(uint32_t temp_adc, uint32_t pres_adc,
+                          int32_t &temp_x100, int32_t &pres_x100) const
+{
+    // asserts are based on numerical ranges (not sanity)
+
+    assert(pres_adc < (1 << 24));
+    assert(temp_adc < (1 << 24));
+
+    int32_t temp;
+    int32_t pres;
+    if (!_comp.compensate(temp_adc, pres_adc, temp, pres)) {
+        STATS(_stats.count_range_errors());
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: temperature " << temp
+                 << " out of range" << endl;
+        return false;
+    }
+
+    temp_x100 = temp;
+    pres_x100 = pres;
+
+    return true;
+}
+
+// compensate n samples
+size_t MS5611::get_pressure(const uint32_t *temp_adc, const uint32_t *pres_adc,
+                            size_t n, int32_t *temp_x100,
+                            int32_t *pres_x100) const
+{
+    size_t good =
+        _comp.compensate(temp_adc, pres_adc, n, temp_x100, pres_x100);
+    STATS(_stats.count_range_errors(n - good));
+    return good;
+}
+
 void MS5611::dump_prom()
 {
     if (_verbosity > 0)
         for (int i = 0; i < 8; i++)
             cout << "prom[" << i << "] = " << _c[i] << endl;
 }
+
+void MS5611::get_prom(uint16_t c[8]) const
+{
+    memcpy(c, _c, sizeof(_c));
+}
+
+bool MS5611::get_stats(MS5611Stats &stats) const
+{
+#ifdef MS5611_STATS
+    _stats.snapshot(stats);
+    return true;
+#else
+    (void)stats;
+    return false;
+#endif
+}
+
+void MS5611::reset_stats()
+{
+    STATS(_stats.reset());
+}
@@ -1,6 +1,19 @@
 #pragma once
 
+#include <linux/spi/spidev.h>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
 #include <string>
+#include "ms5611_comp.h"
+#include "ms5611_sample.h"
+#ifdef MS5611_STATS
+#include "ms5611_stats.h"
+#endif
+
+class MS5611CalCache;
+struct MS5611Stats;
 
 class MS5611
 {
@@ -14,14 +27,75 @@ public:
         OSR4096 = 8,
     };
 
+    enum Convert { TEMP = 0x40, PRES = 0x50 };
+
+    // SPI transport
+    //
+    // transfer() runs a chain of transfers as one SPI message, with the same
+    // semantics as ioctl(fd, SPI_IOC_MESSAGE(n), xfer) on a spidev device:
+    // chip select stays asserted for the whole chain unless cs_change is set
+    // on a transfer, and delay_usecs is honored after each transfer.
+    class Transport
+    {
+    public:
+        virtual ~Transport()
+        {
+        }
+
+        virtual bool transfer(struct spi_ioc_transfer *xfer, unsigned n) = 0;
+    };
+
     // verbosity: 0 - nothing, not even error messages
     //            1 - error messages (default)
     //            2 - extra debug messages
+    //
+    // With a calibration cache, the device is attached warm if its PROM
+    // matches the cache entry for dev_name and the entry says the chip was
+    // left idle (see MS5611CalCache); the entry is added or updated
+    // otherwise. The cache must outlive the MS5611, as detach() marks the
+    // entry idle again.
     MS5611(const std::string &dev_name, unsigned spi_clk = 1000000,
-           int verbosity = 1);
+           int verbosity = 1, MS5611CalCache *cache = NULL);
+
+    // use an existing transport (e.g. MS5611Sim); xport must outlive this
+    //
+    // cache_key names the device in the calibration cache
+    MS5611(Transport &xport, int verbosity = 1, MS5611CalCache *cache = NULL,
+           const std::string &cache_key = "");
+
+    // no device, calibration only: get_pressure() on recorded raw values
+    //
+    // is_ready() is false, and so is has_cal() if the PROM's CRC is bad.
+    explicit MS5611(const uint16_t prom[8], int verbosity = 1);
 
     virtual ~MS5611();
 
+    typedef std::chrono::steady_clock Clock;
+
+    bool is_ready() const
+    {
+        return _xport != NULL;
+    }
+
+    // calibration loaded, so get_pressure() works
+    bool has_cal() const
+    {
+        return _has_cal;
+    }
+
+    // the chip was not reset because its PROM matched the cache
+    bool warm_attached() const
+    {
+        return _warm;
+    }
+
+    // leave the chip idle and let it go: wait out and read any conversion
+    // in progress (a stream's or begin()'s too), and mark the device idle
+    // in the calibration cache, so the next attach can be warm once the
+    // cache is saved. is_ready() is false afterwards. The destructor does
+    // this.
+    void detach();
+
     bool start_convert_temp(Osr oversamp = OSR4096)
     {
         return _start_convert(TEMP | oversamp);
@@ -44,25 +118,287 @@ public:
 
     bool read_adc(uint32_t &data);
 
+    // temperature and pressure conversions in one SPI message, with the
+    // conversion waits timed by the kernel (delay_usecs); blocks for both
+    // conversion times
+    bool do_convert_pair(uint32_t &temp_adc, uint32_t &pres_adc,
+                         Osr temp_osr = OSR4096, Osr pres_osr = OSR4096);
+
+    // n pressure conversions back to back, BURST_MAX per SPI message;
+    // blocks for n conversion times
+    static const unsigned BURST_MAX = 64;
+    bool do_convert_burst(uint32_t *pres_adc, size_t n,
+                          Osr oversamp = OSR4096);
+
+    // conversion with the command fixed at compile time
+    //
+    // ConvertCmd<TEMP, OSR4096>::cmd is the command byte and ::usec its
+    // conversion time; invalid combinations fail to compile. start_convert
+    // and convert are the same as the runtime start_convert_* and
+    // do_convert_*, minus the command checks and setup: the command, the
+    // delay and all but the receive buffer of the SPI transfers are
+    // constants.
+    template <Convert what, Osr oversamp> struct ConvertCmd {
+        static_assert(what == TEMP || what == PRES,
+                      "conversion must be TEMP or PRES");
+        static_assert(oversamp == OSR256 || oversamp == OSR512 ||
+                          oversamp == OSR1024 || oversamp == OSR2048 ||
+                          oversamp == OSR4096,
+                      "invalid OSR");
+
+        static constexpr uint8_t cmd = uint8_t(what | oversamp);
+        static constexpr unsigned usec = 600u << (oversamp >> 1);
+        static const uint8_t tx[2]; // command, then "read adc"
+    };
+
+    template <Convert what, Osr oversamp> bool start_convert()
+    {
+        typedef ConvertCmd<what, oversamp> C;
+        struct spi_ioc_transfer xfer[1];
+        memset(xfer, 0, sizeof(xfer));
+        xfer[0].tx_buf = uint64_t(&C::tx[0]);
+        xfer[0].len = 1;
+        return _transfer_fixed(xfer, 1, OP_START_CONVERT, oversamp >> 1,
+                               NULL, NULL);
+    }
+
+    // blocks for the conversion time
+    template <Convert what, Osr oversamp> bool convert(uint32_t &data)
+    {
+        typedef ConvertCmd<what, oversamp> C;
+        uint8_t rx[3] = {0, 0, 0};
+        struct spi_ioc_transfer xfer[3];
+        memset(xfer, 0, sizeof(xfer));
+        xfer[0].tx_buf = uint64_t(&C::tx[0]);
+        xfer[0].len = 1;
+        xfer[0].delay_usecs = C::usec;
+        xfer[0].cs_change = 1;
+        xfer[1].tx_buf = uint64_t(&C::tx[1]);
+        xfer[1].len = 1;
+        xfer[2].rx_buf = uint64_t(&rx[0]);
+        xfer[2].len = 3;
+        return _transfer_fixed(xfer, 3, OP_DO_CONVERT, oversamp >> 1, rx,
+                               &data);
+    }
+
+    // time allowed for a conversion, usec (600, 1200, 2400, 4800, 9600)
+    static unsigned conv_usec(Osr oversamp)
+    {
+        return 600 << (oversamp >> 1);
+    }
+
+    // non-blocking conversions
+    //
+    // begin() starts a conversion and returns the time it will be done
+    // (Clock::time_point() on error); nothing waits for it. Once that time
+    // has passed, try_complete() reads the result; before then it returns
+    // right away with done false. poll() only checks the time.
+    //
+    // async_fd() is a timerfd (CLOCK_MONOTONIC) armed for the deadline, so
+    // one thread can drive the device from an epoll loop (or asio, as a
+    // stream_descriptor) along with other I/O: begin(), wait for async_fd()
+    // to be readable, try_complete(). It is disarmed when the conversion
+    // is read, so it need not be read itself.
+    //
+    // One conversion at a time, and not while streaming.
+    Clock::time_point begin(Convert what, Osr oversamp = OSR4096);
+
+    bool try_complete(bool &done, uint32_t &data);
+
+    // a conversion is in progress
+    bool busy() const
+    {
+        return _async_busy;
+    }
+
+    // the conversion in progress is done; try_complete() won't wait
+    bool poll() const
+    {
+        return _async_busy && Clock::now() >= _async_deadline;
+    }
+
+    // created on first use; -1 on error
+    int async_fd();
+
+    // continuous acquisition
+    //
+    // stream_start() starts a temperature conversion. Each stream_read()
+    // then waits for the conversion in progress to finish and reads the
+    // result in the same SPI message that starts the next conversion, so
+    // the chip is never idle and each pair costs two conversion times.
+    //
+    // With stream_set_temp_every(n), temperature is only converted before
+    // every nth pressure conversion, and each pressure conversion makes a
+    // pair with the latest temperature; nearly one pressure sample per
+    // conversion time for large n.
+    bool stream_start(Osr temp_osr = OSR4096, Osr pres_osr = OSR4096);
+    bool stream_read(uint32_t &temp_adc, uint32_t &pres_adc);
+    void stream_stop();
+
+    // Non-blocking steps, for callers that do their own waiting (e.g.
+    // MS5611Sched). Once stream_deadline() has passed, stream_next() reads
+    // the finished conversion and starts the next one; pair is set when
+    // that completes a temperature/pressure pair.
+    Clock::time_point stream_deadline() const
+    {
+        return _stream_deadline;
+    }
+
+    bool stream_next(bool &pair, uint32_t &temp_adc, uint32_t &pres_adc);
+
+    // change the OSRs of a running stream (e.g. MS5611OsrCtl); applies to
+    // conversions started from the next stream_next() on
+    bool stream_set_osr(Osr temp_osr, Osr pres_osr);
+
+    // OSR of the pressure conversion in the last pair completed
+    Osr stream_osr() const
+    {
+        return _stream_pair_osr;
+    }
+
+    // temperature every n pressure conversions (n >= 1, 1 by default),
+    // and after the next pressure conversion whenever the temperature
+    // changed by drift_x100 (C x 100) or more since the previous one
+    // (0 for never); applies from the next temperature conversion on
+    void stream_set_temp_every(unsigned n, int32_t drift_x100 = 0)
+    {
+        _stream_temp_every = n > 0 ? n : 1;
+        _stream_drift_x100 = drift_x100;
+    }
+
+    // get_pressure() for pres_adc from the stream, with the compensation
+    // terms of the latest temperature conversion, computed when it was read
+    bool stream_get_pressure(uint32_t pres_adc, int32_t &temp_x100,
+                             int32_t &pres_x100) const;
+
+    // temperature conversions in the stream so far
+    uint64_t stream_temps() const
+    {
+        return _stream_temps;
+    }
+
+    // timestamps of the last pair completed by stream_read() or
+    // stream_next() (see MS5611Times)
+    //
+    // The read of one conversion and the start of the next are in the same
+    // SPI message; the read is stamped before it and the start after it.
+    const MS5611Times &stream_times() const
+    {
+        return _stream_times;
+    }
+
+    // middle of a conversion started at start_ns and read at read_ns
+    // (CLOCK_MONOTONIC_RAW); a late read does not move it
+    static int64_t mid_ns(int64_t start_ns, int64_t read_ns, Osr oversamp)
+    {
+        int64_t conv_ns = int64_t(conv_usec(oversamp)) * 1000;
+        if (read_ns - start_ns < conv_ns)
+            conv_ns = read_ns - start_ns;
+        return start_ns + conv_ns / 2;
+    }
+
     bool get_pressure(uint32_t temp_adc, uint32_t pres_adc, int32_t &temp_x100,
                       int32_t &pres_x100) const;
 
+    // compensate n samples (see MS5611Comp)
+    size_t get_pressure(const uint32_t *temp_adc, const uint32_t *pres_adc,
+                        size_t n, int32_t *temp_x100, int32_t *pres_x100) const;
+
     void dump_prom();
 
+    void get_prom(uint16_t c[8]) const;
+
+    // crc4 over calibration words (low nibble of c[7] is ignored)
+    static uint8_t crc4(const uint16_t c[8]);
+
+    // snapshot of the instrumentation (see MS5611Stats); false if built
+    // without MS5611_STATS
+    bool get_stats(MS5611Stats &stats) const;
+    void reset_stats();
+
 private:
-    enum Convert { TEMP = 0x40, PRES = 0x50 };
+    // SPI messages, in the order of MS5611Stats::Op
+    enum Op {
+        OP_RESET,
+        OP_PROM,
+        OP_START_CONVERT,
+        OP_READ_ADC,
+        OP_DO_CONVERT,
+        OP_DO_CONVERT_PAIR,
+        OP_DO_CONVERT_BURST,
+        OP_READ_ADC_CONVERT,
+    };
+
+    // osr index for messages without a conversion
+    static const int OSR_NONE = 5;
 
     std::string _dev_name;
-    int _fd;
+    std::unique_ptr<Transport> _xport_owned;
+    Transport *_xport; // NULL if device is not ready
     uint16_t _c[8];
+    MS5611Comp _comp;
     int _verbosity;
+    bool _has_cal;
+    bool _warm;
+    MS5611CalCache *_cache; // attached with, for detach()
+
+    // a conversion was started and not read (whoever started it)
+    bool _conv_pending;
+    Clock::time_point _conv_done;
+
+    // continuous acquisition
+    bool _streaming;
+    Osr _stream_temp_osr;
+    Osr _stream_pres_osr;
+    Clock::time_point _stream_deadline; // current conversion is done
+    bool _stream_pres; // current conversion is pressure
+    Osr _stream_osr;   // current conversion's OSR
+    Osr _stream_pair_osr;
+    uint32_t _stream_temp_adc;
+    MS5611Comp::Terms _stream_terms; // for _stream_temp_adc
+    unsigned _stream_temp_every;
+    int32_t _stream_drift_x100;
+    unsigned _stream_pres_left; // before the next temperature
+    uint64_t _stream_temps;
+    int64_t _stream_start_ns; // current conversion started
+    MS5611Times _stream_times;
+
+    // non-blocking conversions
+    int _async_fd; // timerfd, -1 until async_fd()
+    bool _async_busy;
+    Osr _async_osr;
+    Clock::time_point _async_deadline;
 
+#ifdef MS5611_STATS
+    mutable MS5611StatsCounters _stats;
+#endif
+
+    void _init(MS5611CalCache *cache);
+    bool _init_cold();
     bool _reset();
-    bool _read_cal_word(int n, uint16_t &data);
     bool _read_cal();
+    bool _read_prom_all(uint16_t c[8]);
     uint8_t _crc4();
     bool _start_convert(uint8_t cmd);
     bool _do_convert(uint8_t cmd, uint32_t &data);
+    bool _read_adc_convert(uint8_t cmd, uint32_t &data);
+    bool _check_osr(Osr oversamp);
+    void _async_arm(Clock::time_point when);
+    void _idle();
+    bool _transfer(struct spi_ioc_transfer *xfer, unsigned n,
+                   Op op, int osr);
+    bool _transfer_fixed(struct spi_ioc_transfer *xfer, unsigned n, Op op,
+                         int osr, const uint8_t *rx,
+                         uint32_t *data);
 
     friend class MS5611Test;
 };
+
+template <MS5611::Convert what, MS5611::Osr oversamp>
+constexpr uint8_t MS5611::ConvertCmd<what, oversamp>::cmd;
+
+template <MS5611::Convert what, MS5611::Osr oversamp>
+constexpr unsigned MS5611::ConvertCmd<what, oversamp>::usec;
+
+template <MS5611::Convert what, MS5611::Osr oversamp>
+const uint8_t MS5611::ConvertCmd<what, oversamp>::tx[2] = {cmd, 0x00};
@@ -0,0 +1,244 @@
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <thread>
+#include "ms5611_acq.h"
+#include "ms5611_clock.h"
+
+using namespace std;
+
+// correct for gcc and a few other (but not all) compilers
+#define FUNC_NAME __PRETTY_FUNCTION__
+
+MS5611Acq::MS5611Acq(MS5611 &ms5611, MS5611::Osr osr, int verbosity)
+    : _ms5611(ms5611), _osr(osr), _verbosity(verbosity), _stop(false),
+      _samples(0), _errors(0), _late(0), _osr_ctl(false), _osr_now(osr),
+      _osr_up(0), _osr_down(0), _moving(false)
+{
+    _event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_event_fd < 0 && _verbosity > 0)
+        cerr << FUNC_NAME << " ERROR: creating eventfd" << endl;
+}
+
+MS5611Acq::~MS5611Acq()
+{
+    stop();
+
+    if (_event_fd >= 0)
+        close(_event_fd);
+    _event_fd = -1;
+}
+
+// the thread sets itself up and starts the stream before the first
+// deadline, and says whether that worked
+bool MS5611Acq::start()
+{
+    if (running())
+        return true;
+
+    if (_event_fd < 0) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: no eventfd" << endl;
+        return false;
+    }
+
+    _stop = false;
+    promise<bool> started;
+    future<bool> ok = started.get_future();
+    _thread = thread(&MS5611Acq::_run, this, &started);
+
+    if (!ok.get()) {
+        // error message already printed
+        _thread.join();
+        return false;
+    }
+
+    return true;
+}
+
+// pin and raise the priority of the calling (acquisition) thread, lock
+// memory
+bool MS5611Acq::_realtime_setup()
+{
+    pthread_t t = pthread_self();
+
+    if (_rt.cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(_rt.cpu, &cpus);
+        int err = _rt.cpu < CPU_SETSIZE
+                      ? pthread_setaffinity_np(t, sizeof(cpus), &cpus)
+                      : EINVAL;
+        if (err != 0) {
+            if (_verbosity > 0)
+                cerr << FUNC_NAME << " ERROR: pinning to cpu " << _rt.cpu
+                     << ": " << strerror(err) << endl;
+            return false;
+        }
+    }
+
+    if (_rt.priority > 0) {
+        struct sched_param sp;
+        memset(&sp, 0, sizeof(sp));
+        sp.sched_priority = _rt.priority;
+        int err = pthread_setschedparam(t, SCHED_FIFO, &sp);
+        if (err != 0) {
+            if (_verbosity > 0)
+                cerr << FUNC_NAME << " ERROR: SCHED_FIFO priority "
+                     << _rt.priority << ": " << strerror(err) << endl;
+            return false;
+        }
+    }
+
+    if (_rt.lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: mlockall: " << strerror(errno)
+                 << endl;
+        return false;
+    }
+
+    return true;
+}
+
+void MS5611Acq::stop()
+{
+    if (!running())
+        return;
+
+    _stop = true;
+    _thread.join();
+    _ms5611.stream_stop();
+}
+
+size_t MS5611Acq::read(MS5611Sample *samples, size_t n)
+{
+    uint64_t count;
+    if (::read(_event_fd, &count, sizeof(count)) < 0) {
+        // nothing signaled (EAGAIN); there may still be samples
+    }
+
+    return _ring.pop(samples, n);
+}
+
+// touch stack pages so they are resident (and, after mlockall, locked)
+// before the first deadline
+static void prefault_stack()
+{
+    volatile uint8_t buf[64 * 1024];
+    for (size_t i = 0; i < sizeof(buf); i += 4096)
+        buf[i] = 0;
+}
+
+// sleep until deadline, or until spin_usec before it and then spin
+void MS5611Acq::_wait(MS5611::Clock::time_point deadline)
+{
+    if (_rt.spin_usec == 0) {
+        this_thread::sleep_until(deadline);
+        return;
+    }
+
+    this_thread::sleep_until(deadline - chrono::microseconds(_rt.spin_usec));
+    while (MS5611::Clock::now() < deadline)
+        ;
+}
+
+// acquisition thread
+void MS5611Acq::_run(promise<bool> *started)
+{
+    if (!_realtime_setup()) {
+        // error message already printed
+        started->set_value(false);
+        return;
+    }
+
+    MS5611::Osr osr = _osr;
+    chrono::microseconds conv_time(MS5611::conv_usec(osr));
+    const int64_t offset_period_ns = 1000000000;
+    MS5611OsrCtl osr_ctl(_osr_cfg, osr);
+    _osr_now.store(osr, memory_order_relaxed);
+
+    if (_rt.lock_memory)
+        prefault_stack();
+
+    if (!_ms5611.stream_start(osr, osr)) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: starting stream" << endl;
+        started->set_value(false);
+        return;
+    }
+    started->set_value(true);
+
+    int64_t real_offset_ns = MS5611Clock::real_offset_ns();
+    int64_t offset_time_ns = MS5611Clock::raw_ns();
+
+    while (!_stop) {
+        MS5611::Clock::time_point deadline = _ms5611.stream_deadline();
+        _wait(deadline);
+        MS5611::Clock::time_point now = MS5611::Clock::now();
+        chrono::nanoseconds late = now - deadline;
+        _lateness.record(late.count() > 0 ? late.count() : 0);
+        if (late > conv_time)
+            _late.fetch_add(1, memory_order_relaxed);
+
+        bool pair;
+        MS5611Sample s;
+        if (!_ms5611.stream_next(pair, s.temp_adc, s.pres_adc)) {
+            // error message already printed
+            _errors.fetch_add(1, memory_order_relaxed);
+            if (!_ms5611.stream_start(osr, osr)) {
+                // keep trying, but not in a tight loop
+                this_thread::sleep_for(conv_time);
+            }
+            continue;
+        }
+
+        if (!pair)
+            continue;
+
+        s.time_ns = chrono::duration_cast<chrono::nanoseconds>(
+                        MS5611::Clock::now().time_since_epoch())
+                        .count();
+        if (!_ms5611.stream_get_pressure(s.pres_adc, s.temp_x100,
+                                         s.pres_x100)) {
+            s.temp_x100 = INT32_MIN;
+            s.pres_x100 = INT32_MIN;
+        }
+        s.times = _ms5611.stream_times();
+        if (s.times.pres_read_ns - offset_time_ns >= offset_period_ns) {
+            real_offset_ns = MS5611Clock::real_offset_ns();
+            offset_time_ns = s.times.pres_read_ns;
+        }
+        s.real_offset_ns = real_offset_ns;
+        s.osr = _ms5611.stream_osr();
+        s.reserved = 0;
+
+        _osr_now.store(_ms5611.stream_osr(), memory_order_relaxed);
+        if (_osr_ctl) {
+            MS5611::Osr next = osr_ctl.update(s.times.mid_ns, s.pres_x100,
+                                              _ms5611.stream_osr());
+            if (next != osr && _ms5611.stream_set_osr(next, next)) {
+                osr = next;
+                conv_time = chrono::microseconds(MS5611::conv_usec(osr));
+            }
+            _osr_up.store(osr_ctl.switches_up(), memory_order_relaxed);
+            _osr_down.store(osr_ctl.switches_down(), memory_order_relaxed);
+            _moving.store(osr_ctl.moving(), memory_order_relaxed);
+        }
+
+        _samples.fetch_add(1, memory_order_relaxed);
+        if (_ring.push(s)) {
+            uint64_t one = 1;
+            if (write(_event_fd, &one, sizeof(one)) < 0) {
+                // counter saturated; fd is readable anyway
+            }
+        }
+    }
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <thread>
+#include "ms5611.h"
+#include "ms5611_osrctl.h"
+#include "ms5611_ring.h"
+#include "ms5611_sample.h"
+#include "ms5611_stats.h"
+
+// streaming acquisition on a dedicated thread
+//
+// The thread runs an MS5611 stream and pushes each compensated sample into
+// a lock-free ring. It never waits for the consumer; if the ring is full,
+// the sample is dropped and counted as an overrun. Samples carry the
+// stream's conversion timestamps and a realtime offset refreshed every
+// second (see MS5611Times).
+//
+// fd() is an eventfd that is readable when samples may be available, for
+// use with poll/epoll; read() clears it and dequeues samples in bulk.
+//
+// set_realtime() makes the thread deterministic under load: pinned to a
+// core, SCHED_FIFO, memory locked and prefaulted, and optionally sleeping
+// only until shortly before each deadline and spinning the rest of the way.
+// Wakeup lateness is always recorded in a histogram.
+//
+// set_osr_ctl() lets an MS5611OsrCtl pick the OSR as the pressure changes,
+// with the OSR given to the constructor as the starting point.
+class MS5611Acq
+{
+public:
+    static const size_t RING_SIZE = 4096;
+
+    // ms5611 must outlive this and must not be used by anything else while
+    // acquisition is running; verbosity is as for MS5611
+    MS5611Acq(MS5611 &ms5611, MS5611::Osr osr = MS5611::OSR4096,
+              int verbosity = 1);
+
+    virtual ~MS5611Acq();
+
+    struct Realtime {
+        int cpu;            // core to pin to, -1 for any
+        int priority;       // SCHED_FIFO priority 1..99, 0 for normal
+        bool lock_memory;   // mlockall and prefault the thread's stack
+        unsigned spin_usec; // spin this long before each deadline
+
+        Realtime() : cpu(-1), priority(0), lock_memory(false), spin_usec(0)
+        {
+        }
+    };
+
+    // applies at the next start(), which fails if any of it can't be
+    // done (SCHED_FIFO and mlockall need privileges)
+    void set_realtime(const Realtime &rt)
+    {
+        _rt = rt;
+    }
+
+    // applies at the next start()
+    void set_osr_ctl(const MS5611OsrCtl::Config &cfg)
+    {
+        _osr_cfg = cfg;
+        _osr_ctl = true;
+    }
+
+    bool start();
+
+    void stop();
+
+    bool running() const
+    {
+        return _thread.joinable();
+    }
+
+    // dequeue up to n samples; returns number dequeued
+    size_t read(MS5611Sample *samples, size_t n);
+
+    int fd() const
+    {
+        return _event_fd;
+    }
+
+    // samples acquired (including those dropped)
+    uint64_t samples() const
+    {
+        return _samples.load(std::memory_order_relaxed);
+    }
+
+    // samples dropped because the consumer fell behind
+    uint64_t overruns() const
+    {
+        return _ring.overruns();
+    }
+
+    // stream errors (each followed by a restart)
+    uint64_t errors() const
+    {
+        return _errors.load(std::memory_order_relaxed);
+    }
+
+    // wakeups more than a conversion time after the conversion deadline
+    uint64_t late() const
+    {
+        return _late.load(std::memory_order_relaxed);
+    }
+
+    // OSR of the latest conversions
+    MS5611::Osr osr() const
+    {
+        return MS5611::Osr(_osr_now.load(std::memory_order_relaxed));
+    }
+
+    // with set_osr_ctl(): switches to a higher or lower OSR, and whether
+    // the pressure is changing fast
+    uint64_t osr_switches_up() const
+    {
+        return _osr_up.load(std::memory_order_relaxed);
+    }
+
+    uint64_t osr_switches_down() const
+    {
+        return _osr_down.load(std::memory_order_relaxed);
+    }
+
+    bool moving() const
+    {
+        return _moving.load(std::memory_order_relaxed);
+    }
+
+    // how long after each conversion deadline the thread woke up
+    void lateness(MS5611Stats::Hist &hist) const
+    {
+        _lateness.snapshot(hist);
+    }
+
+private:
+    MS5611 &_ms5611;
+    MS5611::Osr _osr;
+    int _verbosity;
+    int _event_fd;
+    std::thread _thread;
+    std::atomic<bool> _stop;
+    std::atomic<uint64_t> _samples;
+    std::atomic<uint64_t> _errors;
+    std::atomic<uint64_t> _late;
+    MS5611HistCounter _lateness;
+    Realtime _rt;
+    bool _osr_ctl;
+    MS5611OsrCtl::Config _osr_cfg;
+    std::atomic<int> _osr_now;
+    std::atomic<uint64_t> _osr_up;
+    std::atomic<uint64_t> _osr_down;
+    std::atomic<bool> _moving;
+    MS5611Ring<MS5611Sample, RING_SIZE> _ring;
+
+    bool _realtime_setup();
+    void _run(std::promise<bool> *started);
+    void _wait(MS5611::Clock::time_point deadline);
+};
@@ -0,0 +1,83 @@
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include "ms5611_alt.h"
+
+using namespace std;
+
+static const double exponent = 1 / 5.257;
+
+// 1 / 0.0065, Q24
+static const int64_t inv_lapse_q24 = llround((1 << 24) / 0.0065);
+
+// built on first use; the local static makes that thread-safe
+const int32_t *MS5611Alt::_shared_table()
+{
+    struct Table {
+        int32_t y[(1 << TABLE_BITS) + 1];
+
+        Table()
+        {
+            for (int i = 0; i <= (1 << TABLE_BITS); i++) {
+                double m = 1 + double(i) / (1 << TABLE_BITS);
+                y[i] = llround(pow(m, -exponent) * (1 << 30));
+            }
+        }
+    };
+    static const Table table;
+
+    return table.y;
+}
+
+MS5611Alt::MS5611Alt(int32_t qnh_x100) : _table(_shared_table())
+{
+    set_qnh(qnh_x100);
+}
+
+void MS5611Alt::set_qnh(int32_t qnh_x100)
+{
+    _qnh_x100 = qnh_x100;
+    for (int e = 0; e < 32; e++)
+        _scale[e] = llround(pow(ldexp(qnh_x100, -e), exponent) * (1 << 30));
+}
+
+int32_t MS5611Alt::altitude_cm(int32_t pres_x100, int32_t temp_x100) const
+{
+    if (pres_x100 < 100)
+        return INT32_MIN;
+
+    // p = m * 2^e, m in [1, 2)
+    uint32_t p = pres_x100;
+    int e = 31 - __builtin_clz(p);
+    uint32_t m = p << (31 - e); // Q31
+    uint32_t idx = (m >> (31 - TABLE_BITS)) & ((1 << TABLE_BITS) - 1);
+    int64_t w = (m >> (15 - TABLE_BITS)) & 0xffff; // Q16
+
+    // (qnh / p)^(1 / 5.257), Q30
+    int64_t y0 = _table[idx];
+    int64_t y1 = _table[idx + 1];
+    int64_t mk = y0 + (((y1 - y0) * w) >> 16);
+    int64_t ratio = (mk * _scale[e]) >> 30;
+
+    // (t + 273.15) / 0.0065, Q8
+    int64_t t_q8 = ((int64_t(temp_x100) + 27315) * inv_lapse_q24) >> 16;
+
+    // Q30 * Q8 -> Q0, rounded
+    int64_t alt = (ratio - (1 << 30)) * t_q8;
+    return int32_t((alt + (int64_t(1) << 37)) >> 38);
+}
+
+void MS5611Alt::altitude_cm(const int32_t *pres_x100,
+                            const int32_t *temp_x100, size_t n,
+                            int32_t *alt_cm) const
+{
+    for (size_t i = 0; i < n; i++)
+        alt_cm[i] = altitude_cm(pres_x100[i], temp_x100[i]);
+}
+
+double MS5611Alt::altitude_m(double pres_mbar, double temp_c,
+                             double qnh_mbar)
+{
+    return ((pow(qnh_mbar / pres_mbar, exponent) - 1) * (temp_c + 273.15)) /
+           0.0065;
+}
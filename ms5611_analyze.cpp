@@ -0,0 +1,379 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "ms5611.h"
+#include "ms5611_blog.h"
+#include "ms5611_calcache.h"
+#include "ms5611_csv.h"
+#include "ms5611_pool.h"
+#include "ms5611_rollup.h"
+#include "ms5611_sample.h"
+
+using namespace std;
+
+// log analysis
+//
+// Summarizes csv or binary logs per period (per minute by default): sample
+// count, temperature min/mean/max and drift, pressure min/mean/max and
+// noise; and the noise per OSR, for binary logs, which record it with each
+// block (csv logs don't, so their OSR is "?"). Each log is split into
+// chunks at record boundaries (lines of a mapped csv file, blocks of a
+// binary log); the chunks are compensated and summarized on an
+// MS5611Pool, and their MS5611Rollups are merged in file order. Output is
+// csv, with a summary per log, and per OSR, on stderr.
+
+static const size_t batch = 1024;
+
+static unsigned period_s = 60;
+static size_t chunk_bytes = 16 << 20;
+
+struct Chunk {
+    MS5611Rollup rollup;
+    uint64_t skipped; // csv lines that did not parse
+
+    Chunk() : rollup(period_s), skipped(0)
+    {
+    }
+};
+
+// compensate a batch and add it to the rollup
+static void add_batch(const MS5611 &ms5611, const MS5611Sample *s,
+                      const time_t *t, size_t n, MS5611Rollup &rollup)
+{
+    if (n == 0)
+        return;
+
+    // zeroed for -Wmaybe-uninitialized, which can't see n <= batch
+    uint32_t temp_adc[batch] = {};
+    uint32_t pres_adc[batch] = {};
+    int32_t temp_x100[batch];
+    int32_t pres_x100[batch];
+
+    for (size_t i = 0; i < n; i++) {
+        temp_adc[i] = s[i].temp_adc;
+        pres_adc[i] = s[i].pres_adc;
+    }
+    ms5611.get_pressure(temp_adc, pres_adc, n, temp_x100, pres_x100);
+    for (size_t i = 0; i < n; i++)
+        rollup.add(t[i], temp_x100[i], pres_x100[i], s[i].osr);
+}
+
+static void csv_chunk(const MS5611 &ms5611, const char *data, size_t size,
+                      Chunk &chunk)
+{
+    MS5611CsvReader reader(0);
+    reader.open(data, size);
+
+    MS5611Sample s[batch];
+    time_t t[batch];
+    size_t n;
+    while ((n = reader.read(s, t, batch)) > 0) {
+        for (size_t i = 0; i < n; i++)
+            s[i].osr = -1;
+        add_batch(ms5611, s, t, n, chunk.rollup);
+    }
+    chunk.skipped = reader.skipped();
+}
+
+static void blog_chunk(const MS5611 &ms5611, const MS5611BlogReader &reader,
+                       size_t first, size_t last, Chunk &chunk)
+{
+    const MS5611BlogHeader &hdr = reader.header();
+    int64_t real_offset_ns = hdr.real_ns - hdr.mono_ns;
+    vector<MS5611BlogRecord> buf(hdr.block_samples);
+
+    MS5611Sample s[batch];
+    time_t t[batch];
+    size_t n = 0;
+    for (size_t b = first; b < last; b++) {
+        const MS5611BlogRecord *recs = reader.block_records(b, buf.data());
+        if (recs == NULL) {
+            chunk.skipped++;
+            continue;
+        }
+        size_t count = reader.block_count(b);
+        MS5611::Osr osr = reader.block_osr(b);
+        for (size_t r = 0; r < count; r++) {
+            s[n].temp_adc = recs[r].temp_adc;
+            s[n].pres_adc = recs[r].pres_adc;
+            s[n].osr = osr;
+            t[n] = (recs[r].time_ns + real_offset_ns) / 1000000000;
+            if (++n == batch) {
+                add_batch(ms5611, s, t, n, chunk.rollup);
+                n = 0;
+            }
+        }
+    }
+    if (n > 0)
+        add_batch(ms5611, s, t, n, chunk.rollup);
+}
+
+// number of chunks for size bytes: chunk_bytes each, but at least four
+// per thread so stealing can even out the load
+static size_t chunk_count(size_t size, unsigned threads)
+{
+    size_t n = (size + chunk_bytes - 1) / chunk_bytes;
+    return max(n, size_t(threads) * 4);
+}
+
+// split a mapped csv file into chunks that start at line boundaries
+static bool analyze_csv(const char *path, const MS5611 *ms5611,
+                        MS5611Pool &pool, vector<Chunk> &chunks)
+{
+    if (ms5611 == NULL || !ms5611->has_cal()) {
+        cerr << path << ": csv logs need calibration (-C)" << endl;
+        return false;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        cerr << path << ": can't open" << endl;
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    if (size == 0) {
+        close(fd);
+        return true;
+    }
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        cerr << path << ": can't map" << endl;
+        return false;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    const char *data = (const char *)map;
+
+    size_t n = min(chunk_count(size, pool.threads()), size);
+    chunks.resize(n);
+    size_t begin = 0;
+    for (size_t i = 0; i < n && begin < size; i++) {
+        size_t end = size * (i + 1) / n;
+        const char *nl = (const char *)memchr(data + end, '\n', size - end);
+        end = nl != NULL ? nl - data + 1 : size;
+        if (end <= begin)
+            continue;
+        Chunk *chunk = &chunks[i];
+        const char *p = data + begin;
+        size_t len = end - begin;
+        pool.submit([=] { csv_chunk(*ms5611, p, len, *chunk); });
+        begin = end;
+    }
+    pool.wait();
+
+    munmap(map, size);
+    return true;
+}
+
+static bool analyze_blog(const char *path, MS5611Pool &pool,
+                         vector<Chunk> &chunks)
+{
+    MS5611BlogReader reader;
+    if (!reader.open(path))
+        return false;
+
+    const MS5611BlogHeader &hdr = reader.header();
+    MS5611 ms5611(hdr.prom);
+    if (!ms5611.has_cal())
+        return false;
+
+    // a block is at most block_samples records
+    size_t blocks = reader.blocks();
+    size_t size = blocks * hdr.block_samples * sizeof(MS5611BlogRecord);
+    size_t n = min(chunk_count(size, pool.threads()), blocks);
+    chunks.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        size_t first = blocks * i / n;
+        size_t last = blocks * (i + 1) / n;
+        Chunk *chunk = &chunks[i];
+        const MS5611 *m = &ms5611;
+        const MS5611BlogReader *r = &reader;
+        pool.submit([=] { blog_chunk(*m, *r, first, last, *chunk); });
+    }
+    pool.wait();
+
+    return true;
+}
+
+static bool is_blog(const char *path)
+{
+    char magic[8];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    bool blog = read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+                memcmp(magic, "MS5611B", sizeof(magic)) == 0;
+    close(fd);
+    return blog;
+}
+
+static void print_periods(const MS5611Rollup &rollup)
+{
+    printf("date, time, samples, range_errors, temp_min, temp_mean, "
+           "temp_max, temp_drift, pres_min, pres_mean, pres_max, "
+           "pres_noise\n");
+    for (auto &p : rollup.periods()) {
+        const MS5611Agg &a = p.second;
+        struct tm t_tm;
+        localtime_r(&p.first, &t_tm);
+        char t_str[32];
+        strftime(t_str, sizeof(t_str), "%F, %T", &t_tm);
+        if (a.count == 0) {
+            printf("%s, 0, %llu, , , , , , , , \n", t_str,
+                   (unsigned long long)a.range_errors);
+            continue;
+        }
+        printf("%s, %llu, %llu, %.2f, %.2f, %.2f, %.2f, %.2f, %.2f, %.2f, "
+               "%.4f\n",
+               t_str, (unsigned long long)a.count,
+               (unsigned long long)a.range_errors, a.temp_min / 100.0,
+               a.temp_mean() / 100.0, a.temp_max / 100.0,
+               a.temp_drift() / 100.0, a.pres_min / 100.0,
+               a.pres_mean() / 100.0, a.pres_max / 100.0,
+               a.pres_noise() / 100.0);
+    }
+}
+
+static const char *osr_name(int osr)
+{
+    switch (osr) {
+    case MS5611::OSR256:
+        return "256";
+    case MS5611::OSR512:
+        return "512";
+    case MS5611::OSR1024:
+        return "1024";
+    case MS5611::OSR2048:
+        return "2048";
+    case MS5611::OSR4096:
+        return "4096";
+    }
+    return "?";
+}
+
+static void usage(const char *prog_name)
+{
+    printf("usage: %s [-C FILE [-k KEY]] [-j N] [-p SEC] [-s MB] LOG...\n",
+           prog_name);
+    printf("       -C FILE  calibration cache, for csv logs (no)\n");
+    printf("       -k KEY   calibration cache entry (/dev/spidev0.0)\n");
+    printf("       -j N     threads (one per core)\n");
+    printf("       -p SEC   summary period, seconds (60)\n");
+    printf("       -s MB    chunk size (16)\n");
+    printf("       LOG      csv or binary logs, in time order\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *cache_name = NULL;
+    const char *cache_key = "/dev/spidev0.0";
+    unsigned threads = 0;
+
+    int c;
+    while ((c = getopt(argc, argv, "C:j:k:p:s:?")) != -1) {
+        switch (c) {
+        case 'C':
+            cache_name = optarg;
+            break;
+        case 'j':
+            threads = strtoul(optarg, NULL, 0);
+            break;
+        case 'k':
+            cache_key = optarg;
+            break;
+        case 'p':
+            period_s = strtoul(optarg, NULL, 0);
+            if (period_s == 0)
+                usage(argv[0]);
+            break;
+        case 's':
+            chunk_bytes = strtoul(optarg, NULL, 0) << 20;
+            if (chunk_bytes == 0)
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+            break;
+        }
+    }
+    if (optind >= argc)
+        usage(argv[0]);
+
+    tzset();
+
+    // calibration for csv logs
+    uint16_t prom[8];
+    memset(prom, 0, sizeof(prom));
+    if (cache_name != NULL) {
+        MS5611CalCache cache(cache_name);
+        if (!cache.load() || !cache.get(cache_key, prom)) {
+            cerr << cache_name << ": no calibration for " << cache_key
+                 << endl;
+            return 1;
+        }
+    }
+    MS5611 ms5611(prom);
+
+    MS5611Pool pool(threads);
+    MS5611Rollup rollup(period_s);
+    uint64_t samples = 0;
+    bool ok = true;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = optind; i < argc; i++) {
+        vector<Chunk> chunks;
+        bool file_ok;
+        if (is_blog(argv[i])) {
+            file_ok = analyze_blog(argv[i], pool, chunks);
+        } else {
+            file_ok = analyze_csv(
+                argv[i], cache_name != NULL ? &ms5611 : NULL, pool, chunks);
+        }
+        if (!file_ok) {
+            ok = false;
+            continue;
+        }
+
+        MS5611Rollup file(period_s);
+        uint64_t skipped = 0;
+        for (auto &chunk : chunks) {
+            file.merge(chunk.rollup);
+            skipped += chunk.skipped;
+        }
+        rollup.merge(file);
+
+        const MS5611Agg &a = file.total();
+        samples += a.count + a.range_errors;
+        cerr << argv[i] << ": " << a.count << " samples, " << a.range_errors
+             << " out of range, " << skipped << " skipped, pres_noise "
+             << a.pres_noise() / 100.0 << endl;
+        for (auto &o : file.osrs())
+            cerr << "    osr " << osr_name(o.first) << ": " << o.second.count
+                 << " samples, pres_noise " << o.second.pres_noise() / 100.0
+                 << endl;
+    }
+    chrono::duration<double> secs = chrono::steady_clock::now() - start;
+
+    print_periods(rollup);
+
+    cerr << samples << " samples in " << secs.count() << " s, "
+         << samples / secs.count() / 1e6 << " Msamples/s, " << pool.threads()
+         << " threads, " << pool.steals() << " steals" << endl;
+
+    return ok ? 0 : 1;
+}
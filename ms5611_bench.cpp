@@ -0,0 +1,331 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "ms5611.h"
+#include "ms5611_alt.h"
+#include "ms5611_comp.h"
+#include "ms5611_csv.h"
+#include "ms5611_filter.h"
+#include "ms5611_kalman.h"
+#include "ms5611_sample.h"
+#include "ms5611_shm.h"
+#include "ms5611_sim.h"
+
+using namespace std;
+
+// microbenchmarks
+//
+// Each benchmark calls its function iters times per run, for warmup runs
+// (discarded) and then runs timed runs. Output is csv, one line per
+// benchmark, with the mean and percentiles over runs of ns per operation
+// (ops operations per call).
+
+typedef chrono::steady_clock Clock;
+
+static unsigned warmup = 3;
+static unsigned runs = 25;
+static double scale = 1.0; // iteration count multiplier (-s)
+static FILE *out = stdout;
+
+// keeps results live so the compiler can't drop the work
+static volatile uint64_t sink;
+
+template <typename F>
+static void bench(const char *name, unsigned iters, F f, unsigned ops = 1)
+{
+    iters = unsigned(iters * scale);
+    if (iters < 1)
+        iters = 1;
+
+    vector<double> ns(runs);
+    for (unsigned r = 0; r < warmup + runs; r++) {
+        Clock::time_point start = Clock::now();
+        for (unsigned i = 0; i < iters; i++)
+            f(i);
+        chrono::duration<double, nano> t = Clock::now() - start;
+        if (r >= warmup)
+            ns[r - warmup] = t.count() / iters / ops;
+    }
+
+    double sum = 0;
+    for (double v : ns)
+        sum += v;
+    sort(ns.begin(), ns.end());
+    auto pct = [&ns](double p) {
+        return ns[min(ns.size() - 1, size_t(p / 100 * ns.size()))];
+    };
+    fprintf(out, "%s,%u,%u,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n", name, iters, runs,
+            sum / ns.size(), ns.front(), pct(50), pct(90), pct(99), ns.back());
+    fflush(out);
+}
+
+// wait out and read the conversion a benchmark left running, so the next
+// one starts with the chip idle
+static void finish_convert(MS5611 &ms5611, MS5611::Osr osr)
+{
+    this_thread::sleep_for(chrono::microseconds(MS5611::conv_usec(osr)));
+    uint32_t data;
+    ms5611.read_adc(data);
+}
+
+static void usage(const char *prog_name)
+{
+    printf("usage: %s [-d DEV] [-c HZ] [-o FILE] [-r N] [-s X] [-w N]\n",
+           prog_name);
+    printf("       -d DEV   spidev device (simulated chip)\n");
+    printf("       -c HZ    spi clock with -d (20000000)\n");
+    printf("       -o FILE  write results to FILE (stdout)\n");
+    printf("       -r N     timed runs per benchmark (25)\n");
+    printf("       -s X     scale iterations per run by X (1)\n");
+    printf("       -w N     warmup runs per benchmark (3)\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dev_name = NULL;
+    unsigned spi_clk = 20000000;
+    const char *out_name = NULL;
+
+    int c;
+    while ((c = getopt(argc, argv, "c:d:o:r:s:w:?")) != -1) {
+        switch (c) {
+        case 'c':
+            spi_clk = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            dev_name = optarg;
+            break;
+        case 'o':
+            out_name = optarg;
+            break;
+        case 'r':
+            runs = strtoul(optarg, NULL, 0);
+            if (runs < 1)
+                usage(argv[0]);
+            break;
+        case 's':
+            scale = strtod(optarg, NULL);
+            if (!(scale > 0))
+                usage(argv[0]);
+            break;
+        case 'w':
+            warmup = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            break;
+        }
+    }
+
+    if (out_name != NULL) {
+        out = fopen(out_name, "w");
+        if (out == NULL) {
+            cerr << "can't open " << out_name << ": " << strerror(errno)
+                 << endl;
+            return 1;
+        }
+    }
+
+    MS5611Sim sim;
+    unique_ptr<MS5611> ms5611;
+    if (dev_name == NULL)
+        ms5611.reset(new MS5611(sim));
+    else
+        ms5611.reset(new MS5611(dev_name, spi_clk));
+    if (!ms5611->is_ready()) {
+        cerr << "device not ready" << endl;
+        return 1;
+    }
+    uint16_t prom[8];
+    ms5611->get_prom(prom);
+
+    // inputs around the datasheet example values
+    const size_t n = 4096;
+    vector<uint32_t> temp_adc(n), pres_adc(n);
+    vector<int32_t> temp_x100(n), pres_x100(n), alt_cm(n);
+    srand(1);
+    for (size_t i = 0; i < n; i++) {
+        temp_adc[i] = 8569150 + rand() % 200000 - 100000;
+        pres_adc[i] = 9085466 + rand() % 200000 - 100000;
+    }
+    ms5611->get_pressure(temp_adc.data(), pres_adc.data(), n,
+                         temp_x100.data(), pres_x100.data());
+
+    fprintf(out, "name,iters,runs,mean_ns,min_ns,p50_ns,p90_ns,p99_ns,"
+                 "max_ns\n");
+
+    bench("crc4", 100000, [&](unsigned i) {
+        prom[1] += i;
+        sink += MS5611::crc4(prom);
+    });
+
+    bench("get_pressure", 100000, [&](unsigned i) {
+        int32_t t, p;
+        size_t j = i % n;
+        if (ms5611->get_pressure(temp_adc[j], pres_adc[j], t, p))
+            sink += p;
+    });
+
+    // pressure only, with the terms of one temperature (temperature
+    // decimation)
+    MS5611Comp comp(prom);
+    MS5611Comp::Terms terms;
+    comp.terms(temp_adc[0], terms);
+    bench("get_pressure_terms", 100000, [&](unsigned i) {
+        sink += MS5611Comp::pressure(terms, pres_adc[i % n]);
+    });
+
+    bench("get_pressure_batch", 100,
+          [&](unsigned) {
+              sink += ms5611->get_pressure(temp_adc.data(), pres_adc.data(),
+                                           n, temp_x100.data(),
+                                           pres_x100.data());
+          },
+          n);
+
+    MS5611Alt alt;
+    alt.altitude_cm(pres_x100.data(), temp_x100.data(), n, alt_cm.data());
+    bench("altitude_cm", 100000, [&](unsigned i) {
+        size_t j = i % n;
+        sink += alt.altitude_cm(pres_x100[j], temp_x100[j]);
+    });
+
+    MS5611Kalman kf;
+    int64_t kf_time_ns = 0;
+    bench("kalman_update", 100000, [&](unsigned i) {
+        kf_time_ns += 20000000;
+        kf.update(kf_time_ns, alt_cm[i % n] / 100.0);
+        sink += uint64_t(kf.velocity());
+    });
+
+    MS5611Fir fir(MS5611Fir::lowpass(31, 0.05));
+    bench("fir31", 100000, [&](unsigned i) {
+        int32_t y;
+        if (fir.put(pres_x100[i % n], y))
+            sink += y;
+    });
+
+    // formatting only; output goes to /dev/null
+    int null_fd = open("/dev/null", O_WRONLY);
+    {
+        MS5611Csv csv(null_fd, 0);
+        time_t t = time(NULL);
+        bench("csv_line", 100000, [&](unsigned i) {
+            size_t j = i % n;
+            MS5611Sample s = MS5611Sample();
+            s.temp_adc = temp_adc[j];
+            s.pres_adc = pres_adc[j];
+            s.temp_x100 = temp_x100[j];
+            s.pres_x100 = pres_x100[j];
+            csv.line(t + i / 1000, s, pres_x100[j] / 1000.0);
+        });
+    }
+    close(null_fd);
+
+    // shared memory: seqlock publish, and a reader's newest sample
+    {
+        MS5611ShmWriter w(0);
+        MS5611ShmReader r(0);
+        string name = "/ms5611_bench_" + to_string(getpid());
+        if (w.open(name, prom) && r.open(name)) {
+            MS5611Sample s = MS5611Sample();
+            s.temp_adc = temp_adc[0];
+            s.pres_adc = pres_adc[0];
+            s.temp_x100 = temp_x100[0];
+            s.pres_x100 = pres_x100[0];
+            bench("shm_publish", 100000, [&](unsigned i) {
+                s.time_ns = i;
+                w.publish(s);
+            });
+            bench("shm_latest", 100000, [&](unsigned) {
+                MS5611Sample got;
+                r.latest(got);
+                sink += got.time_ns;
+            });
+        }
+    }
+
+    // transport: one SPI message
+    bench("read_adc", 1000, [&](unsigned) {
+        uint32_t data;
+        ms5611->read_adc(data);
+        sink += data;
+    });
+
+    // command setup and checks: runtime vs compile time command
+    bench("start_convert", 1000, [&](unsigned) {
+        sink += ms5611->start_convert_pres(MS5611::OSR256);
+    });
+
+    finish_convert(*ms5611, MS5611::OSR256);
+
+    bench("start_convert_fixed", 1000, [&](unsigned) {
+        sink += ms5611->start_convert<MS5611::PRES, MS5611::OSR256>();
+    });
+    finish_convert(*ms5611, MS5611::OSR256);
+
+    // end to end: temperature and pressure conversions, compensation
+    bench("cycle_osr256", 20, [&](unsigned) {
+        uint32_t t_adc, p_adc;
+        int32_t t, p;
+        if (ms5611->do_convert_temp(t_adc, MS5611::OSR256) &&
+            ms5611->do_convert_pres(p_adc, MS5611::OSR256) &&
+            ms5611->get_pressure(t_adc, p_adc, t, p))
+            sink += p;
+    });
+
+    bench("cycle_osr256_fixed", 20, [&](unsigned) {
+        uint32_t t_adc, p_adc;
+        int32_t t, p;
+        if (ms5611->convert<MS5611::TEMP, MS5611::OSR256>(t_adc) &&
+            ms5611->convert<MS5611::PRES, MS5611::OSR256>(p_adc) &&
+            ms5611->get_pressure(t_adc, p_adc, t, p))
+            sink += p;
+    });
+
+    // both conversions in one SPI message
+    bench("cycle_osr256_pair", 20, [&](unsigned) {
+        uint32_t t_adc, p_adc;
+        int32_t t, p;
+        if (ms5611->do_convert_pair(t_adc, p_adc, MS5611::OSR256,
+                                    MS5611::OSR256) &&
+            ms5611->get_pressure(t_adc, p_adc, t, p))
+            sink += p;
+    });
+
+    // per conversion
+    uint32_t burst[MS5611::BURST_MAX];
+    bench("burst_osr256", 1,
+          [&](unsigned) {
+              if (ms5611->do_convert_burst(burst, MS5611::BURST_MAX,
+                                           MS5611::OSR256))
+                  sink += burst[0];
+          },
+          MS5611::BURST_MAX);
+
+    // streamed pairs (conversions pipelined)
+    ms5611->stream_start(MS5611::OSR256, MS5611::OSR256);
+    bench("stream_osr256", 20, [&](unsigned) {
+        uint32_t t_adc, p_adc;
+        if (ms5611->stream_read(t_adc, p_adc))
+            sink += p_adc;
+    });
+    ms5611->stream_stop();
+
+    if (out != stdout)
+        fclose(out);
+
+    return 0;
+}
@@ -0,0 +1,443 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "ms5611_blog.h"
+
+using namespace std;
+
+// correct for gcc and a few other (but not all) compilers
+#define FUNC_NAME __PRETTY_FUNCTION__
+
+static const char blog_magic[8] = "MS5611B";
+
+static int64_t clock_ns(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static void put_varint(vector<uint8_t> &buf, int64_t v)
+{
+    uint64_t u = (uint64_t(v) << 1) ^ uint64_t(v >> 63); // zigzag
+    while (u >= 0x80) {
+        buf.push_back(uint8_t(u) | 0x80);
+        u >>= 7;
+    }
+    buf.push_back(uint8_t(u));
+}
+
+// returns false if the varint runs past end
+static bool get_varint(const uint8_t *&p, const uint8_t *end, int64_t &v)
+{
+    uint64_t u = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (p >= end)
+            return false;
+        uint8_t b = *p++;
+        u |= uint64_t(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            v = int64_t(u >> 1) ^ -int64_t(u & 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+MS5611BlogWriter::MS5611BlogWriter(int verbosity)
+    : _verbosity(verbosity), _fd(-1), _offset(0), _compress(false),
+      _block_samples(0), _osr(MS5611::OSR4096), _block_osr(MS5611::OSR4096)
+{
+}
+
+MS5611BlogWriter::~MS5611BlogWriter()
+{
+    close();
+}
+
+bool MS5611BlogWriter::open(const string &path, const uint16_t prom[8],
+                            MS5611::Osr osr, bool compress,
+                            unsigned block_samples)
+{
+    close();
+
+    if (block_samples == 0) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: block_samples=0 invalid" << endl;
+        return false;
+    }
+
+    _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (_fd < 0) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: opening " << path << endl;
+        return false;
+    }
+
+    _compress = compress;
+    _block_samples = block_samples;
+    _osr = osr;
+    _block_osr = osr;
+    _block.clear();
+    _block.reserve(block_samples);
+    _index.clear();
+
+    MS5611BlogHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, blog_magic, sizeof(hdr.magic));
+    hdr.version = MS5611BlogHeader::VERSION;
+    hdr.flags = MS5611BlogHeader::FLAG_BLOCK_OSR;
+    if (compress)
+        hdr.flags |= MS5611BlogHeader::FLAG_COMPRESSED;
+    memcpy(hdr.prom, prom, sizeof(hdr.prom));
+    hdr.osr = osr;
+    hdr.block_samples = block_samples;
+    hdr.real_ns = clock_ns(CLOCK_REALTIME);
+    hdr.mono_ns = clock_ns(CLOCK_MONOTONIC);
+
+    _offset = 0;
+    if (!_write(&hdr, sizeof(hdr))) {
+        ::close(_fd);
+        _fd = -1;
+        return false;
+    }
+
+    return true;
+}
+
+bool MS5611BlogWriter::write(const MS5611Sample &sample)
+{
+    if (_fd < 0)
+        return false;
+
+    // a block has one OSR
+    MS5611::Osr osr = sample.osr >= 0 ? MS5611::Osr(sample.osr) : _osr;
+    if (osr != _block_osr) {
+        if (!_flush())
+            return false;
+        _block_osr = osr;
+    }
+
+    MS5611BlogRecord rec;
+    rec.time_ns = sample.time_ns;
+    rec.temp_adc = sample.temp_adc;
+    rec.pres_adc = sample.pres_adc;
+    _block.push_back(rec);
+
+    if (_block.size() < _block_samples)
+        return true;
+
+    return _flush();
+}
+
+bool MS5611BlogWriter::close()
+{
+    if (_fd < 0)
+        return true;
+
+    bool ok = _flush();
+
+    MS5611BlogFooter footer;
+    memset(&footer, 0, sizeof(footer));
+    footer.index_offset = _offset;
+    footer.blocks = _index.size();
+    footer.magic = MS5611BlogFooter::MAGIC;
+
+    ok = ok && _write(_index.data(), _index.size() * sizeof(_index[0])) &&
+         _write(&footer, sizeof(footer));
+
+    if (::close(_fd) < 0)
+        ok = false;
+    _fd = -1;
+
+    return ok;
+}
+
+bool MS5611BlogWriter::_write(const void *data, size_t bytes)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    while (bytes > 0) {
+        ssize_t n = ::write(_fd, p, bytes);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (_verbosity > 0)
+                cerr << FUNC_NAME << " ERROR: writing" << endl;
+            return false;
+        }
+        p += n;
+        bytes -= n;
+        _offset += n;
+    }
+    return true;
+}
+
+// write the current block
+bool MS5611BlogWriter::_flush()
+{
+    if (_block.empty())
+        return true;
+
+    MS5611BlogBlock blk;
+    memset(&blk, 0, sizeof(blk));
+    blk.magic = MS5611BlogBlock::MAGIC;
+    blk.count = _block.size();
+    blk.first_time_ns = _block[0].time_ns;
+    blk.osr = _block_osr;
+
+    _buf.resize(sizeof(blk));
+    if (_compress) {
+        int64_t time_ns = blk.first_time_ns;
+        int64_t temp_adc = 0;
+        int64_t pres_adc = 0;
+        for (size_t i = 0; i < _block.size(); i++) {
+            put_varint(_buf, _block[i].time_ns - time_ns);
+            put_varint(_buf, int64_t(_block[i].temp_adc) - temp_adc);
+            put_varint(_buf, int64_t(_block[i].pres_adc) - pres_adc);
+            time_ns = _block[i].time_ns;
+            temp_adc = _block[i].temp_adc;
+            pres_adc = _block[i].pres_adc;
+        }
+        _buf.resize((_buf.size() + 7) & ~size_t(7), 0);
+    } else {
+        const uint8_t *p = (const uint8_t *)_block.data();
+        _buf.insert(_buf.end(), p, p + _block.size() * sizeof(_block[0]));
+    }
+    blk.bytes = _buf.size() - sizeof(blk);
+    memcpy(_buf.data(), &blk, sizeof(blk));
+
+    MS5611BlogIndex idx;
+    idx.first_time_ns = blk.first_time_ns;
+    idx.offset = _offset;
+
+    _block.clear();
+
+    if (!_write(_buf.data(), _buf.size()))
+        // error message already printed
+        return false;
+
+    // only blocks that made it to the file are indexed
+    _index.push_back(idx);
+
+    return true;
+}
+
+MS5611BlogReader::MS5611BlogReader(int verbosity)
+    : _verbosity(verbosity), _map(NULL), _size(0), _hdr(NULL)
+{
+}
+
+MS5611BlogReader::~MS5611BlogReader()
+{
+    close();
+}
+
+bool MS5611BlogReader::open(const string &path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: opening " << path << endl;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(MS5611BlogHeader)) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: " << path << " too short" << endl;
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: mapping " << path << endl;
+        return false;
+    }
+    _map = (const uint8_t *)map;
+    _size = st.st_size;
+    _hdr = (const MS5611BlogHeader *)_map;
+
+    if (memcmp(_hdr->magic, blog_magic, sizeof(blog_magic)) != 0 ||
+        _hdr->version != MS5611BlogHeader::VERSION ||
+        _hdr->block_samples == 0) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: " << path << " bad header" << endl;
+        close();
+        return false;
+    }
+
+    // use the index if the file was closed properly
+    const MS5611BlogFooter *footer = NULL;
+    if (_size >= sizeof(MS5611BlogHeader) + sizeof(MS5611BlogFooter))
+        footer = (const MS5611BlogFooter *)(_map + _size - sizeof(*footer));
+    if (footer != NULL && footer->magic == MS5611BlogFooter::MAGIC &&
+        footer->index_offset + footer->blocks * sizeof(MS5611BlogIndex) +
+                sizeof(*footer) ==
+            _size) {
+        const MS5611BlogIndex *idx =
+            (const MS5611BlogIndex *)(_map + footer->index_offset);
+        _index.assign(idx, idx + footer->blocks);
+        for (size_t b = 0; b < _index.size(); b++) {
+            if (_block(b) == NULL) {
+                if (_verbosity > 0)
+                    cerr << FUNC_NAME << " ERROR: " << path << " bad index"
+                         << endl;
+                close();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    if (_verbosity > 1)
+        cout << FUNC_NAME << ": " << path << " has no index" << endl;
+
+    return _rebuild_index();
+}
+
+void MS5611BlogReader::close()
+{
+    if (_map != NULL)
+        munmap((void *)_map, _size);
+    _map = NULL;
+    _size = 0;
+    _hdr = NULL;
+    _index.clear();
+}
+
+// scan block headers (e.g. after the writer was killed)
+//
+// stops at the first incomplete or corrupt block
+bool MS5611BlogReader::_rebuild_index()
+{
+    _index.clear();
+    uint64_t offset = sizeof(MS5611BlogHeader);
+    while (offset + sizeof(MS5611BlogBlock) <= _size) {
+        const MS5611BlogBlock *blk = (const MS5611BlogBlock *)(_map + offset);
+        if (blk->magic != MS5611BlogBlock::MAGIC ||
+            offset + sizeof(*blk) + blk->bytes > _size)
+            break;
+        MS5611BlogIndex idx;
+        idx.first_time_ns = blk->first_time_ns;
+        idx.offset = offset;
+        _index.push_back(idx);
+        offset += sizeof(*blk) + blk->bytes;
+    }
+    return true;
+}
+
+// block header, or NULL if it is not valid
+const MS5611BlogBlock *MS5611BlogReader::_block(size_t block) const
+{
+    if (block >= _index.size())
+        return NULL;
+    uint64_t offset = _index[block].offset;
+    if (offset % 8 != 0 || offset + sizeof(MS5611BlogBlock) > _size)
+        return NULL;
+    const MS5611BlogBlock *blk = (const MS5611BlogBlock *)(_map + offset);
+    if (blk->magic != MS5611BlogBlock::MAGIC ||
+        blk->count > _hdr->block_samples ||
+        offset + sizeof(*blk) + blk->bytes > _size)
+        return NULL;
+    if ((_hdr->flags & MS5611BlogHeader::FLAG_COMPRESSED) == 0 &&
+        blk->bytes != blk->count * sizeof(MS5611BlogRecord))
+        return NULL;
+    if ((_hdr->flags & MS5611BlogHeader::FLAG_BLOCK_OSR) != 0 &&
+        (blk->osr > MS5611::OSR4096 || (blk->osr & 1) != 0))
+        return NULL;
+    return blk;
+}
+
+size_t MS5611BlogReader::block_count(size_t block) const
+{
+    const MS5611BlogBlock *blk = _block(block);
+    return blk != NULL ? blk->count : 0;
+}
+
+MS5611::Osr MS5611BlogReader::block_osr(size_t block) const
+{
+    const MS5611BlogBlock *blk = _block(block);
+    if (blk == NULL || (_hdr->flags & MS5611BlogHeader::FLAG_BLOCK_OSR) == 0)
+        return MS5611::Osr(_hdr->osr);
+    return MS5611::Osr(blk->osr);
+}
+
+const MS5611BlogRecord *
+MS5611BlogReader::block_records(size_t block, MS5611BlogRecord *buf) const
+{
+    const MS5611BlogBlock *blk = _block(block);
+    if (blk == NULL)
+        return NULL;
+
+    const uint8_t *p = (const uint8_t *)(blk + 1);
+
+    if ((_hdr->flags & MS5611BlogHeader::FLAG_COMPRESSED) == 0)
+        return (const MS5611BlogRecord *)p;
+
+    const uint8_t *end = p + blk->bytes;
+    int64_t time_ns = blk->first_time_ns;
+    int64_t temp_adc = 0;
+    int64_t pres_adc = 0;
+    for (uint32_t i = 0; i < blk->count; i++) {
+        int64_t d_time, d_temp, d_pres;
+        if (!get_varint(p, end, d_time) || !get_varint(p, end, d_temp) ||
+            !get_varint(p, end, d_pres))
+            return NULL;
+        time_ns += d_time;
+        temp_adc += d_temp;
+        pres_adc += d_pres;
+        buf[i].time_ns = time_ns;
+        buf[i].temp_adc = temp_adc;
+        buf[i].pres_adc = pres_adc;
+    }
+    return buf;
+}
+
+bool MS5611BlogReader::seek(int64_t time_ns, size_t &block,
+                            size_t &record) const
+{
+    if (_index.empty())
+        return false;
+
+    // last block starting at or before time_ns
+    size_t lo = 0;
+    size_t hi = _index.size();
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (_index[mid].first_time_ns <= time_ns)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    vector<MS5611BlogRecord> buf(_hdr->block_samples);
+    for (size_t b = lo; b < _index.size(); b++) {
+        const MS5611BlogRecord *recs = block_records(b, buf.data());
+        if (recs == NULL)
+            return false;
+        size_t count = block_count(b);
+        for (size_t r = 0; r < count; r++) {
+            if (recs[r].time_ns >= time_ns) {
+                block = b;
+                record = r;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ms5611.h"
+#include "ms5611_sample.h"
+
+// Binary log
+//
+// A file is a header, a sequence of blocks of raw samples, and an index.
+//
+//   header    MS5611BlogHeader: PROM words, OSR, clock pair
+//   block     MS5611BlogBlock (with the samples' OSR), then count
+//             samples, either as
+//             MS5611BlogRecord (16 bytes each) or, if the file is
+//             compressed, as zigzag varint deltas from the previous sample
+//             (time_ns, temp_adc, pres_adc; the first is relative to
+//             first_time_ns, 0, 0), typically 5-7 bytes per sample
+//   index     MS5611BlogIndex per block, then MS5611BlogFooter
+//
+// A block ends early where the OSR changes (e.g. ms5611_log -a), so every
+// sample in it was converted at the block's OSR. Files without
+// FLAG_BLOCK_OSR have one OSR, the header's.
+//
+// The index is written when the file is closed; a reader rebuilds it from
+// the block headers if it is missing. All values are little-endian, and
+// everything is 8-byte aligned in the file, so records can be used in place
+// from a mapping.
+//
+// Sample times are CLOCK_MONOTONIC; the header has a CLOCK_REALTIME /
+// CLOCK_MONOTONIC pair taken when the file was opened.
+
+struct MS5611BlogHeader {
+    enum { VERSION = 1, FLAG_COMPRESSED = 0x0001, FLAG_BLOCK_OSR = 0x0002 };
+
+    char magic[8]; // "MS5611B"
+    uint32_t version;
+    uint32_t flags;
+    uint16_t prom[8];
+    uint32_t osr; // MS5611::Osr, the first block's with FLAG_BLOCK_OSR
+    uint32_t block_samples;
+    int64_t real_ns; // CLOCK_REALTIME ...
+    int64_t mono_ns; // ... and CLOCK_MONOTONIC at the same moment
+    uint8_t reserved[8];
+};
+
+struct MS5611BlogBlock {
+    enum : uint32_t { MAGIC = 0x314b4c42 }; // "BLK1"
+
+    uint32_t magic;
+    uint32_t count;
+    int64_t first_time_ns;
+    uint32_t bytes; // payload bytes following this header, a multiple of 8
+    uint32_t osr;   // MS5611::Osr, with FLAG_BLOCK_OSR
+    uint32_t reserved[2];
+};
+
+struct MS5611BlogRecord {
+    int64_t time_ns;
+    uint32_t temp_adc;
+    uint32_t pres_adc;
+};
+
+struct MS5611BlogIndex {
+    int64_t first_time_ns;
+    uint64_t offset; // of MS5611BlogBlock
+};
+
+struct MS5611BlogFooter {
+    enum : uint32_t { MAGIC = 0x31584449 }; // "IDX1"
+
+    uint64_t index_offset;
+    uint32_t blocks;
+    uint32_t magic;
+};
+
+class MS5611BlogWriter
+{
+public:
+    // verbosity is as for MS5611
+    MS5611BlogWriter(int verbosity = 1);
+
+    virtual ~MS5611BlogWriter();
+
+    bool open(const std::string &path, const uint16_t prom[8],
+              MS5611::Osr osr, bool compress = false,
+              unsigned block_samples = 256);
+
+    // write a sample; only the raw values, time and OSR are kept (the
+    // header's OSR if sample.osr is -1)
+    bool write(const MS5611Sample &sample);
+
+    // write the last block and the index
+    bool close();
+
+    bool is_open() const
+    {
+        return _fd >= 0;
+    }
+
+private:
+    int _verbosity;
+    int _fd;
+    uint64_t _offset; // file offset of next block
+    bool _compress;
+    unsigned _block_samples;
+    MS5611::Osr _osr;       // header's
+    MS5611::Osr _block_osr; // current block's
+    std::vector<MS5611BlogRecord> _block;
+    std::vector<uint8_t> _buf;
+    std::vector<MS5611BlogIndex> _index;
+
+    bool _write(const void *data, size_t bytes);
+    bool _flush();
+};
+
+class MS5611BlogReader
+{
+public:
+    // verbosity is as for MS5611
+    MS5611BlogReader(int verbosity = 1);
+
+    virtual ~MS5611BlogReader();
+
+    // map the file and load (or rebuild) its index
+    bool open(const std::string &path);
+
+    void close();
+
+    const MS5611BlogHeader &header() const
+    {
+        return *_hdr;
+    }
+
+    size_t blocks() const
+    {
+        return _index.size();
+    }
+
+    size_t block_count(size_t block) const;
+
+    // OSR of the samples in a block
+    MS5611::Osr block_osr(size_t block) const;
+
+    // Records of a block. For an uncompressed file this points into the
+    // mapping (no copy); otherwise the block is decoded into buf, which must
+    // hold header().block_samples records. NULL if the block is corrupt.
+    const MS5611BlogRecord *block_records(size_t block,
+                                          MS5611BlogRecord *buf) const;
+
+    // find the first record at or after time_ns; false if there is none
+    bool seek(int64_t time_ns, size_t &block, size_t &record) const;
+
+private:
+    int _verbosity;
+    const uint8_t *_map;
+    size_t _size;
+    const MS5611BlogHeader *_hdr;
+    std::vector<MS5611BlogIndex> _index;
+
+    const MS5611BlogBlock *_block(size_t block) const;
+    bool _rebuild_index();
+};
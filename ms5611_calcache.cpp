@@ -0,0 +1,126 @@
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "ms5611.h"
+#include "ms5611_calcache.h"
+
+using namespace std;
+
+// correct for gcc and a few other (but not all) compilers
+#define FUNC_NAME __PRETTY_FUNCTION__
+
+MS5611CalCache::MS5611CalCache(const string &path, int verbosity)
+    : _path(path), _verbosity(verbosity)
+{
+}
+
+bool MS5611CalCache::load()
+{
+    _entries.clear();
+
+    ifstream f(_path);
+    if (!f.is_open()) {
+        if (errno == ENOENT)
+            return true;
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: opening " << _path << ": "
+                 << strerror(errno) << endl;
+        return false;
+    }
+
+    string line;
+    while (getline(f, line)) {
+        istringstream is(line);
+        string key;
+        Entry entry;
+        is >> key >> hex;
+        int n;
+        for (n = 0; n < 8; n++) {
+            unsigned word;
+            if (!(is >> word) || word > 0xffff)
+                break;
+            entry.prom[n] = uint16_t(word);
+        }
+        string flag;
+        entry.idle = n == 8 && (is >> flag) && flag == "idle";
+        if (key.empty() || n != 8 ||
+            (entry.prom[7] & 0x000f) != MS5611::crc4(entry.prom.data())) {
+            if (_verbosity > 1)
+                cerr << FUNC_NAME << ": " << _path << ": ignoring \"" << line
+                     << "\"" << endl;
+            continue;
+        }
+        _entries[key] = entry;
+    }
+
+    return true;
+}
+
+bool MS5611CalCache::save() const
+{
+    string tmp = _path + ".tmp";
+    {
+        ofstream f(tmp, ios::trunc);
+        for (const auto &entry : _entries) {
+            f << entry.first << hex << setfill('0');
+            for (uint16_t word : entry.second.prom)
+                f << " " << setw(4) << word;
+            if (entry.second.idle)
+                f << " idle";
+            f << dec << endl;
+        }
+        f.close();
+        if (f.fail()) {
+            if (_verbosity > 0)
+                cerr << FUNC_NAME << " ERROR: writing " << tmp << endl;
+            unlink(tmp.c_str());
+            return false;
+        }
+    }
+
+    if (rename(tmp.c_str(), _path.c_str()) != 0) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: renaming " << tmp << ": "
+                 << strerror(errno) << endl;
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool MS5611CalCache::get(const string &key, uint16_t prom[8]) const
+{
+    auto it = _entries.find(key);
+    if (it == _entries.end())
+        return false;
+    memcpy(prom, it->second.prom.data(), 8 * sizeof(prom[0]));
+    return true;
+}
+
+void MS5611CalCache::put(const string &key, const uint16_t prom[8])
+{
+    Entry &entry = _entries[key];
+    memcpy(entry.prom.data(), prom, 8 * sizeof(prom[0]));
+    entry.idle = false;
+}
+
+bool MS5611CalCache::idle(const string &key) const
+{
+    auto it = _entries.find(key);
+    return it != _entries.end() && it->second.idle;
+}
+
+void MS5611CalCache::set_idle(const string &key, bool idle)
+{
+    auto it = _entries.find(key);
+    if (it != _entries.end())
+        it->second.idle = idle;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+
+// calibration (PROM) cache, keyed by device path
+//
+// An MS5611 given a cache tries a warm attach: it reads the whole PROM in
+// one SPI message and, if that matches the cached words (CRC included) and
+// the entry says the chip was left idle, skips the chip reset. Otherwise it
+// does the full reset and records the PROM it read. Either way the entry
+// is then marked busy, until MS5611::detach() leaves the chip idle again;
+// a process killed mid-conversion leaves it busy, so the next attach
+// resets the chip rather than trusting its state.
+//
+// The file is text, one device per line: the path, the eight PROM words in
+// hex, and "idle" if the chip was left idle. save() writes a temporary
+// file and renames it over the old one.
+class MS5611CalCache
+{
+public:
+    // verbosity is as for MS5611
+    MS5611CalCache(const std::string &path = "/var/tmp/ms5611.cal",
+                   int verbosity = 1);
+
+    // a missing file is an empty cache, not an error; entries with bad
+    // CRCs are dropped
+    bool load();
+
+    bool save() const;
+
+    // false if there is no entry for key
+    bool get(const std::string &key, uint16_t prom[8]) const;
+
+    // the entry is not idle
+    void put(const std::string &key, const uint16_t prom[8]);
+
+    // false if there is no entry for key
+    bool idle(const std::string &key) const;
+
+    // no effect if there is no entry for key
+    void set_idle(const std::string &key, bool idle);
+
+    void erase(const std::string &key)
+    {
+        _entries.erase(key);
+    }
+
+    size_t size() const
+    {
+        return _entries.size();
+    }
+
+private:
+    std::string _path;
+    int _verbosity;
+    struct Entry {
+        std::array<uint16_t, 8> prom;
+        bool idle;
+    };
+
+    std::map<std::string, Entry> _entries;
+};
@@ -0,0 +1,40 @@
+#include <ctime>
+#include <cstdint>
+#include "ms5611_clock.h"
+
+using namespace std;
+
+static int64_t clock_ns(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+int64_t MS5611Clock::raw_ns()
+{
+    return clock_ns(CLOCK_MONOTONIC_RAW);
+}
+
+int64_t MS5611Clock::real_ns()
+{
+    return clock_ns(CLOCK_REALTIME);
+}
+
+int64_t MS5611Clock::real_offset_ns()
+{
+    const int tries = 4;
+
+    int64_t best_window = INT64_MAX;
+    int64_t offset = 0;
+    for (int i = 0; i < tries; i++) {
+        int64_t before = raw_ns();
+        int64_t real = real_ns();
+        int64_t after = raw_ns();
+        if (after - before < best_window) {
+            best_window = after - before;
+            offset = real - (before + (after - before) / 2);
+        }
+    }
+    return offset;
+}
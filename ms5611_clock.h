@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+
+// clocks for sample timestamps
+//
+// Conversion times are taken from CLOCK_MONOTONIC_RAW, which is not slewed
+// by NTP, so intervals between samples are the hardware's. To place them
+// in wall-clock time, add the CLOCK_REALTIME - CLOCK_MONOTONIC_RAW offset
+// read close to the sample (the two drift apart by the NTP correction,
+// typically a few ppm, so the offset should be refreshed every second or
+// so).
+class MS5611Clock
+{
+public:
+    // CLOCK_MONOTONIC_RAW, ns
+    static int64_t raw_ns();
+
+    // CLOCK_REALTIME, ns since the epoch
+    static int64_t real_ns();
+
+    // CLOCK_REALTIME - CLOCK_MONOTONIC_RAW
+    //
+    // The realtime clock is read between two raw reads; of a few tries,
+    // the one with the shortest window is used, so a preemption between
+    // the reads does not skew the offset.
+    static int64_t real_offset_ns();
+};
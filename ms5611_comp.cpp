@@ -0,0 +1,239 @@
+#include <cstddef>
+#include <cstdint>
+#include "ms5611_comp.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MS5611_COMP_AVX2 1
+#endif
+
+// Compensation follows the data sheet, including the second-order
+// adjustment below 20 C. Both the scalar and AVX2 code compute the
+// second-order terms for every sample and mask them off above 20 C, so
+// there are no data-dependent branches.
+
+MS5611Comp::MS5611Comp()
+    : _c5_256(0), _c6(0), _c2_65536(0), _c4(0), _c1_32768(0), _c3(0)
+{
+}
+
+MS5611Comp::MS5611Comp(const uint16_t c[8])
+{
+    set_prom(c);
+}
+
+void MS5611Comp::set_prom(const uint16_t c[8])
+{
+    _c1_32768 = int64_t(c[1]) << 15;
+    _c2_65536 = int64_t(c[2]) << 16;
+    _c3 = c[3];
+    _c4 = c[4];
+    _c5_256 = int64_t(c[5]) << 8;
+    _c6 = c[6];
+}
+
+bool MS5611Comp::compensate(uint32_t temp_adc, uint32_t pres_adc,
+                            int32_t &temp_x100, int32_t &pres_x100) const
+{
+    Terms t;
+    if (!terms(temp_adc, t)) {
+        temp_x100 = t.temp_x100;
+        return false;
+    }
+
+    temp_x100 = t.temp_x100;
+    pres_x100 = pressure(t, pres_adc);
+
+    return true;
+}
+
+bool MS5611Comp::terms(uint32_t temp_adc, Terms &terms) const
+{
+    int64_t d2 = temp_adc;
+
+    // calculate temperature
+
+    int64_t dT = d2 - _c5_256;
+    int64_t temp = 2000 + _div_pow2(dT * _c6, 23);
+    // validate range according to part's spec
+    if (temp < -4000 || temp > 8500) {
+        terms.ok = false;
+        terms.temp_x100 = temp;
+        return false;
+    }
+
+    // second-order temperature adjustments
+    int64_t t_lo = temp - 2000;
+    int64_t t_vlo = temp - -1500;
+    int64_t lo = -int64_t(t_lo < 0);   // all ones below 20 C
+    int64_t vlo = -int64_t(t_vlo < 0); // all ones below -15 C
+    int64_t t2 = ((dT * dT) >> 31) & lo;
+    int64_t off2 = (5 * t_lo * t_lo / 2) & lo;
+    int64_t sens2 = off2 / 2;
+    off2 += (7 * t_vlo * t_vlo) & vlo;
+    sens2 += (11 * t_vlo * t_vlo / 2) & vlo;
+
+    // pressure terms
+    terms.ok = true;
+    terms.temp_x100 = temp - t2;
+    terms.off = _c2_65536 + _div_pow2(_c4 * dT, 7) - off2;
+    terms.sens = _c1_32768 + _div_pow2(_c3 * dT, 8) - sens2;
+
+    return true;
+}
+
+size_t MS5611Comp::compensate(const uint32_t *temp_adc,
+                              const uint32_t *pres_adc, size_t n,
+                              int32_t *temp_x100, int32_t *pres_x100) const
+{
+#ifdef MS5611_COMP_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        return _compensate_avx2(temp_adc, pres_adc, n, temp_x100, pres_x100);
+#endif
+    return _compensate_scalar(temp_adc, pres_adc, n, temp_x100, pres_x100);
+}
+
+size_t MS5611Comp::_compensate_scalar(const uint32_t *temp_adc,
+                                      const uint32_t *pres_adc, size_t n,
+                                      int32_t *temp_x100,
+                                      int32_t *pres_x100) const
+{
+    size_t good = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (compensate(temp_adc[i], pres_adc[i], temp_x100[i],
+                       pres_x100[i])) {
+            good++;
+        } else {
+            temp_x100[i] = INT32_MIN;
+            pres_x100[i] = INT32_MIN;
+        }
+    }
+    return good;
+}
+
+#ifdef MS5611_COMP_AVX2
+
+// AVX2 has no 64-bit arithmetic shift or 64-bit multiply. Every product
+// here except d1 * sens has both factors within 32 bits, so it can use
+// _mm256_mul_epi32; d1 * sens is built from two 32x32 multiplies.
+
+#define AVX2 __attribute__((target("avx2")))
+
+// arithmetic shift right of each 64-bit lane
+template <int K>
+AVX2 static inline __m256i srai64(__m256i x)
+{
+    __m256i sign = _mm256_cmpgt_epi64(_mm256_setzero_si256(), x);
+    return _mm256_or_si256(_mm256_srli_epi64(x, K),
+                           _mm256_slli_epi64(sign, 64 - K));
+}
+
+// signed divide of each 64-bit lane by 2^K, rounding toward zero
+template <int K>
+AVX2 static inline __m256i div_pow2(__m256i x)
+{
+    __m256i sign = _mm256_cmpgt_epi64(_mm256_setzero_si256(), x);
+    __m256i bias =
+        _mm256_and_si256(sign, _mm256_set1_epi64x((int64_t(1) << K) - 1));
+    return srai64<K>(_mm256_add_epi64(x, bias));
+}
+
+AVX2 size_t MS5611Comp::_compensate_avx2(const uint32_t *temp_adc,
+                                         const uint32_t *pres_adc, size_t n,
+                                         int32_t *temp_x100,
+                                         int32_t *pres_x100) const
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i c1_32768 = _mm256_set1_epi64x(_c1_32768);
+    const __m256i c2_65536 = _mm256_set1_epi64x(_c2_65536);
+    const __m256i c3 = _mm256_set1_epi64x(_c3);
+    const __m256i c4 = _mm256_set1_epi64x(_c4);
+    const __m256i c5_256 = _mm256_set1_epi64x(_c5_256);
+    const __m256i c6 = _mm256_set1_epi64x(_c6);
+    const __m256i k2000 = _mm256_set1_epi64x(2000);
+    const __m256i k1500 = _mm256_set1_epi64x(1500);
+    const __m256i t_min = _mm256_set1_epi64x(-4000);
+    const __m256i t_max = _mm256_set1_epi64x(8500);
+    const __m256i invalid = _mm256_set1_epi64x(INT32_MIN);
+    // gathers the low 32 bits of each 64-bit lane into the low 128 bits
+    const __m256i pack = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+
+    size_t good = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i d1 = _mm256_cvtepu32_epi64(
+            _mm_loadu_si128((const __m128i *)(pres_adc + i)));
+        __m256i d2 = _mm256_cvtepu32_epi64(
+            _mm_loadu_si128((const __m128i *)(temp_adc + i)));
+
+        // calculate temperature
+        __m256i dT = _mm256_sub_epi64(d2, c5_256);
+        __m256i temp =
+            _mm256_add_epi64(k2000, div_pow2<23>(_mm256_mul_epi32(dT, c6)));
+        __m256i bad = _mm256_or_si256(_mm256_cmpgt_epi64(t_min, temp),
+                                      _mm256_cmpgt_epi64(temp, t_max));
+
+        // second-order temperature adjustments
+        __m256i t_lo = _mm256_sub_epi64(temp, k2000);
+        __m256i t_vlo = _mm256_add_epi64(temp, k1500);
+        __m256i lo = _mm256_cmpgt_epi64(zero, t_lo);
+        __m256i vlo = _mm256_cmpgt_epi64(zero, t_vlo);
+        __m256i t2 = _mm256_and_si256(
+            _mm256_srli_epi64(_mm256_mul_epi32(dT, dT), 31), lo);
+        __m256i sq = _mm256_mul_epi32(t_lo, t_lo);
+        __m256i off2 = _mm256_and_si256( // 5 * sq / 2
+            _mm256_srli_epi64(
+                _mm256_add_epi64(_mm256_slli_epi64(sq, 2), sq), 1),
+            lo);
+        __m256i sens2 = _mm256_srli_epi64(off2, 1);
+        __m256i sq2 = _mm256_mul_epi32(t_vlo, t_vlo);
+        off2 = _mm256_add_epi64( // 7 * sq2
+            off2, _mm256_and_si256(
+                      _mm256_sub_epi64(_mm256_slli_epi64(sq2, 3), sq2), vlo));
+        sens2 = _mm256_add_epi64( // 11 * sq2 / 2
+            sens2,
+            _mm256_and_si256(
+                _mm256_srli_epi64(
+                    _mm256_add_epi64(
+                        _mm256_add_epi64(_mm256_slli_epi64(sq2, 3),
+                                         _mm256_slli_epi64(sq2, 1)),
+                        sq2),
+                    1),
+                vlo));
+
+        temp = _mm256_sub_epi64(temp, t2);
+
+        // calculate pressure
+        __m256i off = _mm256_sub_epi64(
+            _mm256_add_epi64(c2_65536,
+                             div_pow2<7>(_mm256_mul_epi32(c4, dT))),
+            off2);
+        __m256i sens = _mm256_sub_epi64(
+            _mm256_add_epi64(c1_32768,
+                             div_pow2<8>(_mm256_mul_epi32(c3, dT))),
+            sens2);
+        // d1 is 24 bits; sens = (sens >> 32) * 2^32 + (sens & 0xffffffff)
+        __m256i d1_sens = _mm256_add_epi64(
+            _mm256_mul_epu32(d1, sens),
+            _mm256_slli_epi64(_mm256_mul_epi32(d1, srai64<32>(sens)), 32));
+        __m256i pres =
+            div_pow2<15>(_mm256_sub_epi64(div_pow2<21>(d1_sens), off));
+
+        temp = _mm256_blendv_epi8(temp, invalid, bad);
+        pres = _mm256_blendv_epi8(pres, invalid, bad);
+        _mm_storeu_si128(
+            (__m128i *)(temp_x100 + i),
+            _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(temp, pack)));
+        _mm_storeu_si128(
+            (__m128i *)(pres_x100 + i),
+            _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(pres, pack)));
+
+        good += 4 - __builtin_popcount(
+                        _mm256_movemask_pd(_mm256_castsi256_pd(bad)));
+    }
+
+    return good + _compensate_scalar(temp_adc + i, pres_adc + i, n - i,
+                                     temp_x100 + i, pres_x100 + i);
+}
+
+#endif // MS5611_COMP_AVX2
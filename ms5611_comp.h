@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// MS5611 temperature and pressure compensation
+//
+// Holds the calibration coefficients from the PROM, pre-scaled the way the
+// data sheet's formulas use them, so compensation needs no device and does
+// no per-sample setup.
+class MS5611Comp
+{
+public:
+    // everything compensation needs from a temperature conversion
+    //
+    // Temperature changes slowly, so a stream that converts it less often
+    // than pressure (see MS5611::stream_set_temp_every) computes these
+    // once per temperature conversion, and each pressure sample costs one
+    // multiply and a few shifts.
+    struct Terms {
+        bool ok;           // temperature in range
+        int32_t temp_x100; // second-order adjusted if ok
+        int64_t off;       // with the second-order adjustment
+        int64_t sens;
+    };
+
+    MS5611Comp();
+
+    explicit MS5611Comp(const uint16_t c[8]);
+
+    void set_prom(const uint16_t c[8]);
+
+    // compensate one sample
+    //
+    // Raw values are 24 bits. Returns false if the temperature is out of
+    // the part's range (-40..85 C); then temp_x100 is that temperature and
+    // pres_x100 is unchanged.
+    bool compensate(uint32_t temp_adc, uint32_t pres_adc, int32_t &temp_x100,
+                    int32_t &pres_x100) const;
+
+    // compensate n samples
+    //
+    // Results are identical to compensate() for each sample; samples with
+    // the temperature out of range get INT32_MIN in both outputs. Returns
+    // the number of samples in range. Uses AVX2 when the CPU has it.
+    size_t compensate(const uint32_t *temp_adc, const uint32_t *pres_adc,
+                      size_t n, int32_t *temp_x100, int32_t *pres_x100) const;
+
+    // temperature half of compensate(); false as for compensate(), with
+    // terms.temp_x100 the out of range temperature
+    bool terms(uint32_t temp_adc, Terms &terms) const;
+
+    // pressure half: identical to compensate() with the same temp_adc;
+    // terms must be ok
+    static int32_t pressure(const Terms &terms, uint32_t pres_adc)
+    {
+        return _div_pow2(_div_pow2(pres_adc * terms.sens, 21) - terms.off,
+                         15);
+    }
+
+private:
+    // signed divide by 2^k, rounding toward zero like '/' does
+    static int64_t _div_pow2(int64_t x, int k)
+    {
+        return (x + ((x >> 63) & ((int64_t(1) << k) - 1))) >> k;
+    }
+
+    int64_t _c5_256; // c5 * 2^8
+    int64_t _c6;
+    int64_t _c2_65536; // c2 * 2^16
+    int64_t _c4;
+    int64_t _c1_32768; // c1 * 2^15
+    int64_t _c3;
+
+    size_t _compensate_scalar(const uint32_t *temp_adc,
+                              const uint32_t *pres_adc, size_t n,
+                              int32_t *temp_x100, int32_t *pres_x100) const;
+    size_t _compensate_avx2(const uint32_t *temp_adc, const uint32_t *pres_adc,
+                            size_t n, int32_t *temp_x100,
+                            int32_t *pres_x100) const;
+};
@@ -0,0 +1,373 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include "ms5611_csv.h"
+
+using namespace std;
+
+// correct for gcc and a few other (but not all) compilers
+#define FUNC_NAME __PRETTY_FUNCTION__
+
+// longest line: prefix, 2 x (10 + 8), 2 x 12, altitude (at most 31),
+// separators
+static const size_t line_max = 256;
+
+MS5611Csv::MS5611Csv(int fd, unsigned flush_lines, size_t buf_size)
+    : _fd(fd), _flush_lines(flush_lines), _lines(0), _error(false),
+      _buf(buf_size < 2 * line_max ? 2 * line_max : buf_size), _len(0),
+      _prefix_time(-1), _prefix_len(0)
+{
+}
+
+MS5611Csv::~MS5611Csv()
+{
+    flush();
+}
+
+// unsigned decimal
+static char *put_dec(char *p, uint64_t v)
+{
+    char tmp[20];
+    int n = 0;
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v != 0);
+    while (n > 0)
+        *p++ = tmp[--n];
+    return p;
+}
+
+// 8 hex digits
+static char *put_hex8(char *p, uint32_t v)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (int shift = 28; shift >= 0; shift -= 4)
+        *p++ = digits[(v >> shift) & 0x0f];
+    return p;
+}
+
+// v / 100 with two decimals, as printf("%.2f", v / 100.0) would
+static char *put_x100(char *p, int64_t v)
+{
+    if (v < 0) {
+        *p++ = '-';
+        v = -v;
+    }
+    p = put_dec(p, v / 100);
+    *p++ = '.';
+    *p++ = '0' + (v / 10) % 10;
+    *p++ = '0' + v % 10;
+    return p;
+}
+
+// as printf("%.2f", v)
+//
+// Rounding v * 100 to an integer gives the same result as printf unless
+// v * 100 is within rounding error of a tie, or v is not a modest finite
+// number; those go to snprintf.
+static char *put_double2(char *p, double v)
+{
+    double a = fabs(v) * 100;
+    double f = a - floor(a);
+    if (!(a < 1e15) || fabs(f - 0.5) < 1e-6) {
+        int n = snprintf(p, 32, "%.2f", v);
+        return p + (n < 32 ? n : 31);
+    }
+    if (signbit(v))
+        *p++ = '-';
+    int64_t x100 = int64_t(a + 0.5);
+    return put_x100(p, x100);
+}
+
+char *MS5611Csv::_reserve(size_t bytes)
+{
+    if (_len + bytes > _buf.size())
+        flush();
+    return _buf.data() + _len;
+}
+
+void MS5611Csv::_end_line(char *p)
+{
+    *p++ = '\n';
+    _len = p - _buf.data();
+    if (_flush_lines != 0 && ++_lines >= _flush_lines)
+        flush();
+}
+
+void MS5611Csv::header()
+{
+    static const char hdr[] =
+        "date, time, "
+        "adc_temp_dec, adc_temp_hex, adc_pres_dec, adc_pres_hex, "
+        "temp_c, pres_mbar, alt_m";
+    char *p = _reserve(sizeof(hdr));
+    memcpy(p, hdr, sizeof(hdr) - 1);
+    _end_line(p + sizeof(hdr) - 1);
+}
+
+void MS5611Csv::line(time_t t, const MS5611Sample &sample, double alt_m)
+{
+    if (t != _prefix_time) {
+        struct tm t_tm;
+        localtime_r(&t, &t_tm);
+        _prefix_len = strftime(_prefix, sizeof(_prefix), "%F, %T, ", &t_tm);
+        _prefix_time = t;
+    }
+
+    char *p = _reserve(line_max);
+    memcpy(p, _prefix, _prefix_len);
+    p += _prefix_len;
+    p = put_dec(p, sample.temp_adc);
+    *p++ = ',';
+    *p++ = ' ';
+    p = put_hex8(p, sample.temp_adc);
+    *p++ = ',';
+    *p++ = ' ';
+    p = put_dec(p, sample.pres_adc);
+    *p++ = ',';
+    *p++ = ' ';
+    p = put_hex8(p, sample.pres_adc);
+    *p++ = ',';
+    *p++ = ' ';
+    p = put_x100(p, sample.temp_x100);
+    *p++ = ',';
+    *p++ = ' ';
+    p = put_x100(p, sample.pres_x100);
+    *p++ = ',';
+    *p++ = ' ';
+    p = put_double2(p, alt_m);
+    _end_line(p);
+}
+
+bool MS5611Csv::flush()
+{
+    const char *p = _buf.data();
+    size_t len = _len;
+    while (len > 0 && !_error) {
+        ssize_t n = write(_fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            _error = true;
+            break;
+        }
+        p += n;
+        len -= n;
+    }
+    _len = 0;
+    _lines = 0;
+    return !_error;
+}
+
+MS5611CsvReader::MS5611CsvReader(int verbosity, size_t buf_size)
+    : _verbosity(verbosity), _fd(-1), _eof(true), _error(false), _skipped(0),
+      _mem(NULL), _buf(buf_size < 2 * line_max ? 2 * line_max : buf_size),
+      _begin(0), _end(0), _time_len(0), _time(0)
+{
+}
+
+MS5611CsvReader::~MS5611CsvReader()
+{
+    close();
+}
+
+bool MS5611CsvReader::open(const string &path)
+{
+    close();
+
+    if (path == "-") {
+        _fd = 0;
+    } else {
+        _fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (_fd < 0) {
+            if (_verbosity > 0)
+                cerr << FUNC_NAME << " ERROR: opening " << path << endl;
+            return false;
+        }
+    }
+
+    _eof = false;
+    _error = false;
+    _skipped = 0;
+    _begin = 0;
+    _end = 0;
+    _time_len = 0;
+
+    return true;
+}
+
+void MS5611CsvReader::open(const char *data, size_t size)
+{
+    close();
+
+    _mem = data;
+    _error = false;
+    _skipped = 0;
+    _begin = 0;
+    _end = size;
+    _time_len = 0;
+}
+
+void MS5611CsvReader::close()
+{
+    if (_fd > 0)
+        ::close(_fd);
+    _fd = -1;
+    _mem = NULL;
+    _eof = true;
+}
+
+// move the unparsed data to the front of the buffer and read more after it
+void MS5611CsvReader::_fill()
+{
+    if (_begin > 0) {
+        memmove(_buf.data(), _buf.data() + _begin, _end - _begin);
+        _end -= _begin;
+        _begin = 0;
+    }
+
+    if (_end == _buf.size()) {
+        // no newline in a full buffer; drop it
+        _skipped++;
+        _end = 0;
+    }
+
+    ssize_t n;
+    do {
+        n = ::read(_fd, _buf.data() + _end, _buf.size() - _end);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: reading" << endl;
+        _error = true;
+        _eof = true;
+    } else if (n == 0) {
+        _eof = true;
+    } else {
+        _end += n;
+    }
+}
+
+size_t MS5611CsvReader::read(MS5611Sample *samples, time_t *t, size_t n)
+{
+    const char *base = _mem != NULL ? _mem : _buf.data();
+    size_t got = 0;
+    while (got < n) {
+        const char *p = base + _begin;
+        const char *end = base + _end;
+        const char *nl = (const char *)memchr(p, '\n', end - p);
+        if (nl == NULL) {
+            if (!_eof) {
+                _fill();
+                continue;
+            }
+            if (p == end)
+                break;
+            nl = end; // last line has no newline
+        }
+
+        if (_parse(p, nl, samples[got], t[got]))
+            got++;
+        else
+            _skipped++;
+        _begin = (nl < end ? nl + 1 : nl) - base;
+    }
+    return got;
+}
+
+// unsigned decimal of at most digits digits; false if there are none
+static bool get_dec(const char *&p, const char *end, unsigned digits,
+                    uint32_t &v)
+{
+    const char *start = p;
+    v = 0;
+    while (p < end && unsigned(p - start) < digits && *p >= '0' && *p <= '9')
+        v = v * 10 + (*p++ - '0');
+    return p > start;
+}
+
+static bool get_char(const char *&p, const char *end, char c)
+{
+    if (p == end || *p != c)
+        return false;
+    p++;
+    return true;
+}
+
+static void skip_spaces(const char *&p, const char *end)
+{
+    while (p < end && *p == ' ')
+        p++;
+}
+
+// "2016-10-14, 21:14:30, 8357308, 007f85bc, 8413336, ..."
+bool MS5611CsvReader::_parse(const char *p, const char *end,
+                             MS5611Sample &sample, time_t &t)
+{
+    const char *line = p;
+    const char *time_end = p;
+    for (int commas = 0; time_end < end; time_end++)
+        if (*time_end == ',' && ++commas == 2)
+            break;
+    if (time_end == end)
+        return false;
+
+    size_t time_len = time_end - p;
+    if (time_len == _time_len && memcmp(p, _time_str, time_len) == 0) {
+        p = time_end;
+    } else {
+        uint32_t year, mon, mday, hour, min, sec;
+        if (!get_dec(p, end, 4, year) || !get_char(p, end, '-') ||
+            !get_dec(p, end, 2, mon) || !get_char(p, end, '-') ||
+            !get_dec(p, end, 2, mday) || !get_char(p, end, ','))
+            return false;
+        skip_spaces(p, end);
+        if (!get_dec(p, end, 2, hour) || !get_char(p, end, ':') ||
+            !get_dec(p, end, 2, min) || !get_char(p, end, ':') ||
+            !get_dec(p, end, 2, sec) || p != time_end)
+            return false;
+
+        struct tm t_tm;
+        memset(&t_tm, 0, sizeof(t_tm));
+        t_tm.tm_year = year - 1900;
+        t_tm.tm_mon = mon - 1;
+        t_tm.tm_mday = mday;
+        t_tm.tm_hour = hour;
+        t_tm.tm_min = min;
+        t_tm.tm_sec = sec;
+        t_tm.tm_isdst = -1;
+        _time = mktime(&t_tm);
+
+        _time_len = time_len < sizeof(_time_str) ? time_len : 0;
+        memcpy(_time_str, line, _time_len);
+    }
+    t = _time;
+
+    // adc_temp_dec, adc_temp_hex (skipped), adc_pres_dec
+    uint32_t temp_adc, pres_adc;
+    get_char(p, end, ',');
+    skip_spaces(p, end);
+    if (!get_dec(p, end, 8, temp_adc) || !get_char(p, end, ','))
+        return false;
+    while (p < end && *p != ',')
+        p++;
+    get_char(p, end, ',');
+    skip_spaces(p, end);
+    if (!get_dec(p, end, 8, pres_adc) || !get_char(p, end, ','))
+        return false;
+    if (temp_adc >= (1 << 24) || pres_adc >= (1 << 24))
+        return false;
+
+    sample.temp_adc = temp_adc;
+    sample.pres_adc = pres_adc;
+    return true;
+}
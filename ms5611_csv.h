@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+#include "ms5611_sample.h"
+
+// csv output for the logger
+//
+// Produces the same text as formatting with iostreams, but formats into a
+// reusable buffer by hand: integers are converted directly, temperature and
+// pressure are printed from their x100 values without floating point, and
+// the date/time prefix is only recomputed when the second changes. The
+// buffer goes out with write(2), either every flush_lines lines or, if
+// flush_lines is 0, only when it is full or on flush().
+class MS5611Csv
+{
+public:
+    MS5611Csv(int fd = 1, unsigned flush_lines = 1, size_t buf_size = 65536);
+
+    virtual ~MS5611Csv();
+
+    void set_flush_lines(unsigned flush_lines)
+    {
+        _flush_lines = flush_lines;
+    }
+
+    void header();
+
+    // t is the sample's (local) time
+    void line(time_t t, const MS5611Sample &sample, double alt_m);
+
+    // false if any write has failed
+    bool flush();
+
+private:
+    int _fd;
+    unsigned _flush_lines;
+    unsigned _lines; // since last flush
+    bool _error;
+    std::vector<char> _buf;
+    size_t _len;
+    time_t _prefix_time;
+    char _prefix[64]; // "date, time, "
+    size_t _prefix_len;
+
+    char *_reserve(size_t bytes);
+    void _end_line(char *p);
+};
+
+// csv input, for replaying logs
+//
+// Reads the logger's csv in large blocks and parses lines in place, with no
+// per-line allocation. Only the date, time and the two decimal ADC columns
+// are used; everything else is recomputed on replay. The date and time go
+// through mktime only when they change. Lines that don't parse (the header,
+// lines cut short, lines longer than the buffer) are skipped and counted.
+class MS5611CsvReader
+{
+public:
+    // verbosity is as for MS5611
+    MS5611CsvReader(int verbosity = 1, size_t buf_size = 1 << 20);
+
+    virtual ~MS5611CsvReader();
+
+    // "-" is stdin
+    bool open(const std::string &path);
+
+    // parse size bytes in memory (e.g. a chunk of a mapped file) in place;
+    // data must stay valid until close()
+    void open(const char *data, size_t size);
+
+    void close();
+
+    // read up to n samples; sets t (local time, as logged) and the raw
+    // values only
+    //
+    // Returns the number read, 0 at the end of the file or on a read error.
+    size_t read(MS5611Sample *samples, time_t *t, size_t n);
+
+    // a read failed
+    bool error() const
+    {
+        return _error;
+    }
+
+    // lines skipped because they did not parse
+    uint64_t skipped() const
+    {
+        return _skipped;
+    }
+
+private:
+    int _verbosity;
+    int _fd;
+    bool _eof;
+    bool _error;
+    uint64_t _skipped;
+    const char *_mem; // data for open(data, size), else NULL
+    std::vector<char> _buf;
+    size_t _begin; // unparsed data is _buf (or _mem) [_begin, _end)
+    size_t _end;
+    char _time_str[32]; // "date, time" of the last line, and its value
+    size_t _time_len;
+    time_t _time;
+
+    void _fill();
+    bool _parse(const char *p, const char *end, MS5611Sample &sample,
+                time_t &t);
+};
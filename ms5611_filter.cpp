@@ -0,0 +1,324 @@
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "ms5611_filter.h"
+
+using namespace std;
+
+#define FUNC_NAME __PRETTY_FUNCTION__
+
+// s / d rounded to nearest, halves away from zero
+static int32_t div_round(int64_t s, int64_t d)
+{
+    return int32_t(s >= 0 ? (s + d / 2) / d : -((-s + d / 2) / d));
+}
+
+MS5611Cic::MS5611Cic(unsigned r, unsigned order) : _r(r), _order(order)
+{
+    assert(r >= 1 && order >= 1 && order <= MAX_ORDER);
+    _gain = 1;
+    for (unsigned i = 0; i < order; i++)
+        _gain *= r;
+    assert(_gain < (int64_t(1) << 31));
+    reset();
+}
+
+void MS5611Cic::reset()
+{
+    _phase = 0;
+    _primed = false;
+    memset(_integ, 0, sizeof(_integ));
+    memset(_comb, 0, sizeof(_comb));
+}
+
+bool MS5611Cic::put(int32_t in, int32_t &out)
+{
+    if (!_primed) {
+        for (unsigned i = 0; i < _order * _r; i++)
+            _put(in, out);
+        _primed = true;
+    }
+    return _put(in, out);
+}
+
+bool MS5611Cic::_put(int32_t in, int32_t &out)
+{
+    uint64_t v = uint64_t(int64_t(in));
+    for (unsigned i = 0; i < _order; i++) {
+        _integ[i] += v;
+        v = _integ[i];
+    }
+
+    if (++_phase < _r)
+        return false;
+    _phase = 0;
+
+    for (unsigned i = 0; i < _order; i++) {
+        uint64_t d = v - _comb[i];
+        _comb[i] = v;
+        v = d;
+    }
+
+    out = div_round(int64_t(v), _gain);
+    return true;
+}
+
+MS5611Fir::MS5611Fir(const vector<int32_t> &taps, unsigned r)
+    : _taps(taps.rbegin(), taps.rend()), _r(r), _hist(2 * taps.size())
+{
+    assert(!taps.empty() && r >= 1);
+    reset();
+}
+
+void MS5611Fir::reset()
+{
+    _phase = 0;
+    _pos = 0;
+    _primed = false;
+}
+
+bool MS5611Fir::put(int32_t in, int32_t &out)
+{
+    unsigned n = _taps.size();
+
+    if (!_primed) {
+        fill(_hist.begin(), _hist.end(), in);
+        _primed = true;
+    }
+
+    _hist[_pos] = _hist[_pos + n] = in;
+    if (++_pos == n)
+        _pos = 0;
+
+    if (++_phase < _r)
+        return false;
+    _phase = 0;
+
+    // oldest first
+    const int32_t *x = &_hist[_pos];
+    int64_t acc = 0;
+    for (unsigned i = 0; i < n; i++)
+        acc += int64_t(_taps[i]) * x[i];
+
+    out = int32_t((acc + (1 << 14)) >> 15);
+    return true;
+}
+
+vector<int32_t> MS5611Fir::lowpass(unsigned n, double cutoff)
+{
+    assert(n >= 1 && cutoff > 0 && cutoff <= 0.5);
+
+    vector<double> h(n);
+    double sum = 0;
+    for (unsigned i = 0; i < n; i++) {
+        double x = i - (n - 1) / 2.0;
+        double s =
+            x == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * x) / (M_PI * x);
+        double w = n == 1 ? 1 : 0.54 - 0.46 * cos(2 * M_PI * i / (n - 1));
+        h[i] = s * w;
+        sum += h[i];
+    }
+
+    // quantize, then put the rounding error in the center tap so the DC
+    // gain is exactly 1
+    vector<int32_t> taps(n);
+    int32_t qsum = 0;
+    for (unsigned i = 0; i < n; i++) {
+        taps[i] = int32_t(lround(h[i] / sum * 32768));
+        qsum += taps[i];
+    }
+    taps[n / 2] += 32768 - qsum;
+    return taps;
+}
+
+MS5611Iir::MS5611Iir(double alpha)
+{
+    assert(alpha > 0 && alpha <= 1);
+    _alpha = llround(alpha * (1 << 16));
+    if (_alpha < 1)
+        _alpha = 1;
+    reset();
+}
+
+void MS5611Iir::reset()
+{
+    _y = 0;
+    _primed = false;
+}
+
+bool MS5611Iir::put(int32_t in, int32_t &out)
+{
+    int64_t x = int64_t(in) * (1 << 16);
+    if (!_primed) {
+        _y = x;
+        _primed = true;
+    } else {
+        // (arithmetic shift; rounds toward -inf either way)
+        _y += ((x - _y) * _alpha) >> 16;
+    }
+    out = int32_t((_y + (1 << 15)) >> 16);
+    return true;
+}
+
+MS5611Median::MS5611Median(unsigned n, int32_t threshold)
+    : _n(n), _threshold(threshold)
+{
+    assert(n >= 1 && n <= MAX_N && (n & 1) == 1 && threshold >= 0);
+    reset();
+}
+
+void MS5611Median::reset()
+{
+    _count = 0;
+    _pos = 0;
+    _rejected = 0;
+}
+
+bool MS5611Median::put(int32_t in, int32_t &out)
+{
+    unsigned i;
+
+    if (_count == _n) {
+        // drop the oldest input from the sorted list
+        int32_t old = _ring[_pos];
+        for (i = 0; _sorted[i] != old; i++)
+            ;
+        memmove(&_sorted[i], &_sorted[i + 1],
+                (_count - i - 1) * sizeof(_sorted[0]));
+        _count--;
+        _ring[_pos] = in;
+        if (++_pos == _n)
+            _pos = 0;
+    } else {
+        _ring[_count] = in;
+    }
+
+    // insert the new one
+    for (i = _count; i > 0 && _sorted[i - 1] > in; i--)
+        _sorted[i] = _sorted[i - 1];
+    _sorted[i] = in;
+    _count++;
+
+    int32_t median = _sorted[_count / 2];
+    if (_threshold == 0) {
+        out = median;
+    } else if (llabs(int64_t(in) - median) > _threshold) {
+        out = median;
+        _rejected++;
+    } else {
+        out = in;
+    }
+    return true;
+}
+
+MS5611FilterChain::MS5611FilterChain(int verbosity) : _verbosity(verbosity)
+{
+}
+
+void MS5611FilterChain::add(MS5611Filter *filter)
+{
+    _stages.emplace_back(filter);
+}
+
+bool MS5611FilterChain::add(const char *spec)
+{
+    vector<unique_ptr<MS5611Filter>> stages;
+
+    string s(spec);
+    size_t start = 0;
+    while (start <= s.size()) {
+        size_t end = s.find(',', start);
+        if (end == string::npos)
+            end = s.size();
+        string stage = s.substr(start, end - start);
+        start = end + 1;
+
+        // name:a[:b]
+        size_t colon = stage.find(':');
+        string name = stage.substr(0, colon);
+        const char *arg = colon == string::npos ? "" : &stage[colon + 1];
+        char *p;
+        double a = strtod(arg, &p);
+        bool has_b = *p == ':';
+        double b = has_b ? strtod(p + 1, &p) : 0;
+        bool ok = p != arg && *p == '\0';
+
+        if (ok && name == "cic") {
+            unsigned order = has_b ? unsigned(b) : 1;
+            ok = a >= 1 && a <= 65536 && a == floor(a) && order >= 1 &&
+                 order <= MS5611Cic::MAX_ORDER && b == floor(b) &&
+                 order * log2(a) < 31;
+            if (ok)
+                stages.emplace_back(new MS5611Cic(unsigned(a), order));
+        } else if (ok && name == "fir") {
+            ok = has_b && a >= 1 && a <= 1024 && a == floor(a) && b >= 1 &&
+                 b <= 1024 && b == floor(b);
+            if (ok)
+                stages.emplace_back(new MS5611Fir(
+                    MS5611Fir::lowpass(unsigned(b), 0.5 / a), unsigned(a)));
+        } else if (ok && name == "iir") {
+            ok = !has_b && a > 0 && a <= 1;
+            if (ok)
+                stages.emplace_back(new MS5611Iir(a));
+        } else if (ok && name == "median") {
+            ok = a >= 1 && a <= MS5611Median::MAX_N && a == floor(a) &&
+                 (unsigned(a) & 1) == 1 && b >= 0 && b < INT32_MAX &&
+                 b == floor(b);
+            if (ok)
+                stages.emplace_back(
+                    new MS5611Median(unsigned(a), int32_t(b)));
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            if (_verbosity >= 1)
+                cerr << FUNC_NAME << " ERROR: bad filter \"" << stage
+                     << "\"" << endl;
+            return false;
+        }
+    }
+
+    for (auto &stage : stages)
+        _stages.push_back(move(stage));
+    return true;
+}
+
+bool MS5611FilterChain::put(int32_t in, int32_t &out)
+{
+    for (auto &stage : _stages)
+        if (!stage->put(in, in))
+            return false;
+    out = in;
+    return true;
+}
+
+void MS5611FilterChain::reset()
+{
+    for (auto &stage : _stages)
+        stage->reset();
+}
+
+unsigned MS5611FilterChain::decimation() const
+{
+    unsigned r = 1;
+    for (auto &stage : _stages)
+        r *= stage->decimation();
+    return r;
+}
+
+double MS5611FilterChain::delay() const
+{
+    // each stage's delay is in its own input samples
+    double d = 0;
+    unsigned r = 1;
+    for (auto &stage : _stages) {
+        d += stage->delay() * r;
+        r *= stage->decimation();
+    }
+    return d;
+}
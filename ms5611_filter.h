@@ -0,0 +1,207 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// streaming filters for a sample stream (raw ADC or x100 values)
+//
+// Sampling fast at a low OSR and filtering in software is an alternative to
+// the slow high-OSR conversions. Each filter takes one input at a time and
+// may or may not produce an output (decimators produce one per R inputs).
+// Everything is fixed point with no allocation after construction.
+class MS5611Filter
+{
+public:
+    virtual ~MS5611Filter()
+    {
+    }
+
+    // returns true if out was written
+    virtual bool put(int32_t in, int32_t &out) = 0;
+
+    virtual void reset() = 0;
+
+    // inputs per output
+    virtual unsigned decimation() const
+    {
+        return 1;
+    }
+
+    // group delay at DC, in input samples
+    virtual double delay() const = 0;
+};
+
+// CIC decimator: order stages of R-sample moving averages, decimated by R
+//
+// Order 1 is a plain block average. Gain (R^order) is divided out with
+// rounding; it must fit in 31 bits so 64-bit integrators can't lose data.
+// The first input is run through order x R times to fill the filter, so
+// there is no startup transient.
+class MS5611Cic : public MS5611Filter
+{
+public:
+    static const unsigned MAX_ORDER = 4;
+
+    MS5611Cic(unsigned r, unsigned order = 1);
+
+    virtual bool put(int32_t in, int32_t &out);
+
+    virtual void reset();
+
+    virtual unsigned decimation() const
+    {
+        return _r;
+    }
+
+    virtual double delay() const
+    {
+        return _order * (_r - 1) / 2.0;
+    }
+
+private:
+    bool _put(int32_t in, int32_t &out);
+
+    unsigned _r;
+    unsigned _order;
+    int64_t _gain;
+    unsigned _phase;
+    bool _primed;
+    // unsigned so wraparound is defined
+    uint64_t _integ[MAX_ORDER];
+    uint64_t _comb[MAX_ORDER];
+};
+
+// FIR filter with Q15 taps, optionally decimated by R
+//
+// The first input fills the history, so there is no startup transient.
+class MS5611Fir : public MS5611Filter
+{
+public:
+    MS5611Fir(const std::vector<int32_t> &taps, unsigned r = 1);
+
+    virtual bool put(int32_t in, int32_t &out);
+
+    virtual void reset();
+
+    virtual unsigned decimation() const
+    {
+        return _r;
+    }
+
+    // (assumes symmetric taps)
+    virtual double delay() const
+    {
+        return (_taps.size() - 1) / 2.0;
+    }
+
+    // windowed-sinc (Hamming) lowpass, cutoff in cycles per sample
+    // (0..0.5), taps summing to 1.0 (32768)
+    static std::vector<int32_t> lowpass(unsigned n, double cutoff);
+
+private:
+    std::vector<int32_t> _taps; // reversed, so oldest input first
+    unsigned _r;
+    unsigned _phase;
+    // each input is stored twice, n apart, so the newest n inputs are
+    // always contiguous
+    std::vector<int32_t> _hist;
+    unsigned _pos;
+    bool _primed;
+};
+
+// first-order IIR lowpass: y += alpha * (x - y)
+//
+// State is kept in Q16 so small alphas don't stall on rounding. The first
+// input initializes the state, so there is no startup transient.
+class MS5611Iir : public MS5611Filter
+{
+public:
+    // 0 < alpha <= 1
+    MS5611Iir(double alpha);
+
+    virtual bool put(int32_t in, int32_t &out);
+
+    virtual void reset();
+
+    virtual double delay() const
+    {
+        return (1 << 16) / double(_alpha) - 1;
+    }
+
+private:
+    int64_t _alpha; // Q16
+    int64_t _y;     // Q16
+    bool _primed;
+};
+
+// median spike rejector over the last n inputs (n odd)
+//
+// With threshold 0 the output is the running median. Otherwise inputs
+// pass through unchanged unless they are more than threshold from the
+// median, in which case the median replaces them; that rejects isolated
+// spikes without delaying the signal.
+class MS5611Median : public MS5611Filter
+{
+public:
+    static const unsigned MAX_N = 63;
+
+    MS5611Median(unsigned n, int32_t threshold = 0);
+
+    virtual bool put(int32_t in, int32_t &out);
+
+    virtual void reset();
+
+    virtual double delay() const
+    {
+        return _threshold == 0 ? (_n - 1) / 2.0 : 0;
+    }
+
+    unsigned rejected() const
+    {
+        return _rejected;
+    }
+
+private:
+    unsigned _n;
+    int32_t _threshold;
+    unsigned _count; // inputs in the window
+    unsigned _pos;   // oldest input in _ring
+    unsigned _rejected;
+    int32_t _ring[MAX_N];   // inputs in arrival order
+    int32_t _sorted[MAX_N]; // the same, sorted
+};
+
+// filters run in sequence
+class MS5611FilterChain : public MS5611Filter
+{
+public:
+    MS5611FilterChain(int verbosity = 1);
+
+    void add(MS5611Filter *filter); // takes ownership
+
+    // add stages from a comma-separated spec:
+    //   cic:R[:ORDER]   CIC decimator
+    //   fir:R:N         N-tap lowpass at 0.5/R, decimated by R
+    //   iir:ALPHA       first-order lowpass
+    //   median:N[:T]    median (or spike rejection at threshold T)
+    // returns false (and adds nothing) if spec is not valid
+    bool add(const char *spec);
+
+    size_t stages() const
+    {
+        return _stages.size();
+    }
+
+    virtual bool put(int32_t in, int32_t &out);
+
+    virtual void reset();
+
+    virtual unsigned decimation() const;
+
+    virtual double delay() const;
+
+private:
+    int _verbosity;
+    std::vector<std::unique_ptr<MS5611Filter>> _stages;
+};
@@ -0,0 +1,71 @@
+#include <cmath>
+#include <cstdint>
+#include "ms5611_kalman.h"
+
+using namespace std;
+
+// initial velocity uncertainty, m/s
+static const double v_sigma_init = 10.0;
+
+MS5611Kalman::MS5611Kalman(double accel_sigma, double alt_sigma)
+    : _primed(false), _time_ns(0), _h(0), _v(0), _p00(0), _p01(0), _p11(0)
+{
+    set_noise(accel_sigma, alt_sigma);
+}
+
+void MS5611Kalman::set_noise(double accel_sigma, double alt_sigma)
+{
+    _q = accel_sigma * accel_sigma;
+    _r = alt_sigma * alt_sigma;
+}
+
+bool MS5611Kalman::update(const MS5611Sample &sample)
+{
+    int32_t alt_cm = _alt.altitude_cm(sample.pres_x100, sample.temp_x100);
+    if (sample.pres_x100 == INT32_MIN || alt_cm == INT32_MIN)
+        return false;
+    // the middle of the pressure conversion is when it was measured; the
+    // read time adds the read's jitter to dt
+    int64_t time_ns =
+        sample.times.mid_ns != 0 ? sample.times.mid_ns : sample.time_ns;
+    return update(time_ns, alt_cm / 100.0);
+}
+
+bool MS5611Kalman::update(int64_t time_ns, double alt_m)
+{
+    if (!_primed) {
+        _h = alt_m;
+        _v = 0;
+        _p00 = _r;
+        _p01 = 0;
+        _p11 = v_sigma_init * v_sigma_init;
+        _time_ns = time_ns;
+        _primed = true;
+        return true;
+    }
+
+    if (time_ns <= _time_ns)
+        return false;
+    double dt = (time_ns - _time_ns) * 1e-9;
+    _time_ns = time_ns;
+
+    // predict: x = F x, P = F P F' + Q
+    double dt2 = dt * dt;
+    _h += _v * dt;
+    _p00 += dt * (2 * _p01 + dt * _p11) + _q * dt2 * dt2 / 4;
+    _p01 += dt * _p11 + _q * dt2 * dt / 2;
+    _p11 += _q * dt2;
+
+    // correct with the measurement
+    double s = _p00 + _r;
+    double k0 = _p00 / s;
+    double k1 = _p01 / s;
+    double y = alt_m - _h;
+    _h += k0 * y;
+    _v += k1 * y;
+    _p11 -= k1 * _p01;
+    _p00 -= k0 * _p00;
+    _p01 -= k0 * _p01;
+
+    return true;
+}
@@ -1,80 +1,525 @@
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 #include <cassert>
+#include <cerrno>
 #include <cmath>
+#include <csignal>
 #include <cstring>
 #include <ctime>
 #include <chrono>
-#include <iomanip>
 #include <iostream>
-#include <thread>
-#include <unistd.h>
 #include "ms5611.h"
+#include "ms5611_acq.h"
+#include "ms5611_alt.h"
+#include "ms5611_blog.h"
+#include "ms5611_calcache.h"
+#include "ms5611_clock.h"
+#include "ms5611_csv.h"
+#include "ms5611_filter.h"
+#include "ms5611_osrctl.h"
+#include "ms5611_sample.h"
+#include "ms5611_server.h"
+#include "ms5611_shm.h"
 
 using namespace std;
 
 const char *dev_name = "/dev/spidev0.0";
 constexpr unsigned spi_clk = 20000000;
-constexpr unsigned log_interval_s = 1;
 
-static double pressure_to_altitude(double p, double t)
-{
-    // http://keisan.casio.com/exec/system/1224585971
-    double p0 = 1013.25; // pressure at sea level
-    return ((pow(p0 / p, 1 / 5.257) - 1) * (t + 273.15)) / 0.0065;
-}
+// altitude for csv output (-q sets sea level pressure)
+static MS5611Alt alt;
+
+// csv output (stdout)
+static MS5611Csv csv;
+
+// binary log (-b)
+static MS5611BlogWriter blog;
+
+// shared memory for other processes (-S)
+static MS5611ShmWriter shm;
+
+// subscribers on a Unix-domain socket (-u) or UDP port (-U)
+static MS5611Server server;
+static bool serving = false;
 
-static void show_csv_hdr()
+// csv filters (-F), the same for temperature and pressure so they decimate
+// together
+static MS5611FilterChain filter_temp;
+static MS5611FilterChain filter_pres;
+
+// log one sample, as csv or to the binary log
+//
+// csv lines are stamped with the middle of the pressure conversion
+static void log_sample(const MS5611Sample &sample)
 {
-    cout << "date, time, "
-         << "adc_temp_dec, adc_temp_hex, adc_pres_dec, adc_pres_hex, "
-         << "temp_c, pres_mbar, alt_m" << endl;
+    if (shm.is_open())
+        shm.publish(sample);
+
+    if (serving)
+        server.publish(sample);
+
+    if (blog.is_open()) {
+        if (!blog.write(sample))
+            cerr << "binary log write error" << endl;
+    } else if (!serving) {
+        MS5611Sample s = sample;
+        // out of range samples bypass the filters
+        if (filter_pres.stages() > 0 && sample.pres_x100 != INT32_MIN) {
+            filter_temp.put(sample.temp_x100, s.temp_x100);
+            if (!filter_pres.put(sample.pres_x100, s.pres_x100))
+                return;
+        }
+        int32_t alt_cm = alt.altitude_cm(s.pres_x100, s.temp_x100);
+        time_t t = (sample.times.mid_ns + sample.real_offset_ns) / 1000000000;
+        csv.line(t, s, alt_cm == INT32_MIN ? NAN : alt_cm / 100.0);
+    }
 }
 
-static void show_csv(const MS5611 &ms5611,
-                     chrono::system_clock::time_point now_time,
-                     uint32_t adc_temp, uint32_t adc_pres)
+// sample read just now, with its conversion times
+static MS5611Sample make_sample(const MS5611 &ms5611, uint32_t adc_temp,
+                                uint32_t adc_pres, MS5611Times times,
+                                MS5611::Osr osr)
 {
-    int32_t temp, pres;
-    ms5611.get_pressure(adc_temp, adc_pres, temp, pres);
-    double alt = pressure_to_altitude(pres / 100.0, temp / 100.0);
-
-    time_t t = chrono::system_clock::to_time_t(now_time);
-    struct tm t_tm;
-    localtime_r(&t, &t_tm);
-    char t_str[80];
-    memset(t_str, 0, sizeof(t_str));
-    strftime(t_str, 79, "%F, %T, ", &t_tm);
-
-    cout.setf(ios::fixed, ios::floatfield);
-    cout.precision(2);
-    cout << t_str << dec << setw(0) << adc_temp << ", " << hex << setw(8)
-         << setfill('0') << adc_temp << ", " << dec << setw(0) << adc_pres
-         << ", " << hex << setw(8) << setfill('0') << adc_pres << ", "
-         << temp / 100.0 << ", " << pres / 100.0 << ", " << alt << endl;
+    MS5611Sample sample;
+    times.mid_ns = MS5611::mid_ns(times.pres_start_ns, times.pres_read_ns, osr);
+    sample.times = times;
+    sample.real_offset_ns = MS5611Clock::real_offset_ns();
+    sample.time_ns = chrono::duration_cast<chrono::nanoseconds>(
+                         MS5611::Clock::now().time_since_epoch())
+                         .count();
+    sample.temp_adc = adc_temp;
+    sample.pres_adc = adc_pres;
+    sample.osr = osr;
+    sample.reserved = 0;
+    if (!ms5611.get_pressure(adc_temp, adc_pres, sample.temp_x100,
+                             sample.pres_x100)) {
+        sample.temp_x100 = INT32_MIN;
+        sample.pres_x100 = INT32_MIN;
+    }
+    return sample;
 }
 
 static void usage(const char *prog_name)
 {
-    printf("usage: %s [-d] [-i N]\n", prog_name);
+    printf("usage: %s [-a SPEC] [-b FILE [-z]] [-c] [-d] [-f N] [-i N] [-m]\n"
+           "       [-o N] [-q MBAR] [-F SPEC] [-C FILE] [-p CPU] [-r PRIO]\n"
+           "       [-s USEC] [-S NAME] [-t N[:C]] [-u PATH] [-U PORT]\n",
+           prog_name);
+    printf("       -a SPEC  with -c, adapt OSR up to -o, comma-separated\n");
+    printf("                rate:HZ, noise:PA, motion:PA_S, hold:N,\n");
+    printf("                window:SEC, or auto (no)\n");
+    printf("       -b FILE  binary log to FILE instead of csv (no)\n");
+    printf("       -z       compress binary log (no)\n");
+    printf("       -c       continuous, as fast as the OSR allows (no)\n");
+    printf("       -C FILE  calibration cache, no reset if it matches (no)\n");
     printf("       -d       dump calibration parameters (no)\n");
-    printf("       -i N     log interval, seconds (1)\n");
+    printf("       -f N     flush csv every N lines, 0 when full (1)\n");
+    printf("       -i N     log interval, seconds, may be fractional (1)\n");
+    printf("       -m       one SPI message per sample, blocking (no)\n");
+    printf("       -o N     oversampling, 256..4096 (4096)\n");
+    printf("       -p CPU   with -c, pin acquisition thread to CPU (no)\n");
+    printf("       -q MBAR  sea level pressure for altitude (1013.25)\n");
+    printf("       -r PRIO  with -c, SCHED_FIFO priority, lock memory (no)\n");
+    printf("       -s USEC  with -c, spin USEC before each deadline (0)\n");
+    printf("       -S NAME  also publish to shared memory NAME (no)\n");
+    printf("       -t N[:C] with -c, temperature every N samples, sooner\n");
+    printf("                if it changes C degrees (1)\n");
+    printf("       -u PATH  serve Unix socket PATH instead of csv (no)\n");
+    printf("       -U PORT  serve UDP PORT on loopback instead of csv (no)\n");
+    printf("       -F SPEC  filter csv output, comma-separated stages of\n");
+    printf("                cic:R[:ORDER], fir:R:TAPS, iir:ALPHA,\n");
+    printf("                median:N[:THRESHOLD] (none)\n");
     exit(1);
 }
 
+static bool osr_from_int(unsigned long n, MS5611::Osr &osr)
+{
+    switch (n) {
+    case 256:
+        osr = MS5611::OSR256;
+        return true;
+    case 512:
+        osr = MS5611::OSR512;
+        return true;
+    case 1024:
+        osr = MS5611::OSR1024;
+        return true;
+    case 2048:
+        osr = MS5611::OSR2048;
+        return true;
+    case 4096:
+        osr = MS5611::OSR4096;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// arm a timer to expire at a CLOCK_MONOTONIC time, then every interval
+// (steady_clock is CLOCK_MONOTONIC)
+static void timer_arm(int fd, MS5611::Clock::time_point when,
+                      chrono::nanoseconds interval = chrono::nanoseconds(0))
+{
+    int64_t ns =
+        chrono::duration_cast<chrono::nanoseconds>(when.time_since_epoch())
+            .count();
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = ns / 1000000000;
+    its.it_value.tv_nsec = ns % 1000000000;
+    its.it_interval.tv_sec = interval.count() / 1000000000;
+    its.it_interval.tv_nsec = interval.count() % 1000000000;
+    timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+// number of expirations since last read
+static uint64_t timer_read(int fd)
+{
+    uint64_t exp = 0;
+    if (read(fd, &exp, sizeof(exp)) != sizeof(exp))
+        return 0;
+    return exp;
+}
+
+static void epoll_add(int epfd, int fd)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void print_lateness(const MS5611Acq &acq)
+{
+    MS5611Stats::Hist h;
+    acq.lateness(h);
+    if (h.count == 0)
+        return;
+    cerr << "wakeup lateness usec: mean " << h.sum_ns / h.count / 1000
+         << ", p50 " << h.percentile_ns(50) / 1000 << ", p99 "
+         << h.percentile_ns(99) / 1000 << ", p99.9 "
+         << h.percentile_ns(99.9) / 1000 << ", max " << h.max_ns / 1000
+         << endl;
+}
+
+// adaptive OSR (-a)
+static void print_osr(const MS5611Acq &acq)
+{
+    cerr << "osr " << (256 << (acq.osr() >> 1)) << ", "
+         << (acq.moving() ? "moving" : "steady") << ", "
+         << acq.osr_switches_up() << " switches up, "
+         << acq.osr_switches_down() << " down" << endl;
+}
+
+// subscriber throughput
+static void print_clients()
+{
+    vector<MS5611Server::ClientStats> stats;
+    server.stats(stats);
+    for (auto &c : stats)
+        cerr << c.peer << ": every " << c.decimation << ", " << c.records
+             << " samples in " << c.frames << " frames, " << c.dropped
+             << " dropped, " << c.bytes / (c.seconds > 0 ? c.seconds : 1)
+             << " bytes/s" << endl;
+}
+
+// Event loop. A timer ticks at the log interval, and each tick begins the
+// temperature conversion; the MS5611's async_fd() wakes the loop when a
+// conversion is done, to read it and begin the pressure one, so the loop
+// never blocks on the device. With one_message, each tick instead runs
+// both conversions in a single SPI message, with the kernel timing the
+// waits, and the loop blocks for the duration. In continuous mode there
+// are no timers; MS5611Acq pipelines conversions back to back and signals when
+// samples are ready, and with osr_ctl adapts the OSR to the pressure
+// changes. SIGINT/SIGTERM end the loop; SIGUSR1 prints the MS5611
+// statistics to stderr.
+//
+// A deadline is missed when a tick comes while the previous sample is
+// still being converted (or more than one tick expired), or in continuous
+// mode when a wakeup is more than a conversion time late or a sample is
+// dropped.
+static void log_loop(MS5611 &ms5611, MS5611::Osr osr,
+                     chrono::nanoseconds interval, bool continuous,
+                     bool one_message, const MS5611Acq::Realtime &rt,
+                     const MS5611OsrCtl::Config *osr_ctl)
+{
+    enum { IDLE, TEMP, PRES } phase = IDLE;
+    int64_t conv_ns = int64_t(MS5611::conv_usec(osr)) * 1000;
+    MS5611Times times = MS5611Times();
+    uint32_t adc_temp = 0;
+    unsigned long samples = 0;
+    unsigned long missed = 0;
+
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &sigs, NULL);
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    int sig_fd = signalfd(-1, &sigs, SFD_CLOEXEC);
+    int tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    int conv_fd = continuous || one_message ? -1 : ms5611.async_fd();
+    if (epfd < 0 || sig_fd < 0 || tick_fd < 0 ||
+        (conv_fd < 0 && !continuous && !one_message)) {
+        cerr << "event loop setup error" << endl;
+        return;
+    }
+    epoll_add(epfd, sig_fd);
+    epoll_add(epfd, tick_fd);
+    if (conv_fd >= 0)
+        epoll_add(epfd, conv_fd);
+    if (serving)
+        epoll_add(epfd, server.fd());
+
+    // continuous acquisition runs on its own thread, so a slow consumer
+    // (e.g. a pipe) does not delay conversions
+    MS5611Acq acq(ms5611, osr);
+    acq.set_realtime(rt);
+    if (osr_ctl != NULL)
+        acq.set_osr_ctl(*osr_ctl);
+    if (continuous) {
+        if (!acq.start()) {
+            cerr << "start streaming error" << endl;
+            return;
+        }
+        epoll_add(epfd, acq.fd());
+    } else {
+        timer_arm(tick_fd, MS5611::Clock::now() + interval, interval);
+    }
+
+    bool done = false;
+    while (!done) {
+        struct epoll_event evs[4];
+        int n = epoll_wait(epfd, evs, 4, -1);
+        if (n < 0 && errno != EINTR) {
+            cerr << "event loop error" << endl;
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = evs[i].data.fd;
+
+            if (fd == sig_fd) {
+                struct signalfd_siginfo si;
+                if (read(sig_fd, &si, sizeof(si)) != sizeof(si))
+                    continue;
+                if (si.ssi_signo == SIGUSR1) {
+                    MS5611Stats stats;
+                    if (ms5611.get_stats(stats))
+                        stats.print(cerr);
+                    else
+                        cerr << "statistics not built in" << endl;
+                    if (continuous)
+                        print_lateness(acq);
+                    if (osr_ctl != NULL)
+                        print_osr(acq);
+                    if (serving)
+                        print_clients();
+                } else {
+                    done = true;
+                }
+
+            } else if (fd == tick_fd) {
+                uint64_t exp = timer_read(tick_fd);
+                if (exp > 1)
+                    missed += exp - 1;
+                if (phase != IDLE) {
+                    missed++;
+                    continue;
+                }
+                if (one_message) {
+                    // one message: the reads and the pressure start are
+                    // spaced by the conversion delays
+                    uint32_t adc_pres;
+                    times.temp_start_ns = MS5611Clock::raw_ns();
+                    if (ms5611.do_convert_pair(adc_temp, adc_pres, osr, osr)) {
+                        times.pres_read_ns = MS5611Clock::raw_ns();
+                        times.temp_read_ns = times.temp_start_ns + conv_ns;
+                        times.pres_start_ns = times.temp_read_ns;
+                        log_sample(make_sample(ms5611, adc_temp, adc_pres,
+                                               times, osr));
+                        samples++;
+                    } else {
+                        cerr << "convert error" << endl;
+                    }
+                    continue;
+                }
+                // temperature; stamped before the command goes out, as
+                // stream_next() does
+                times.temp_start_ns = MS5611Clock::raw_ns();
+                if (ms5611.begin(MS5611::TEMP, osr) !=
+                    MS5611::Clock::time_point()) {
+                    phase = TEMP;
+                } else {
+                    cerr << "start convert error (temperature)" << endl;
+                }
+
+            } else if (serving && fd == server.fd()) {
+                server.poll();
+
+            } else if (fd == acq.fd()) {
+                MS5611Sample buf[64];
+                size_t got;
+                while ((got = acq.read(buf, 64)) > 0) {
+                    for (size_t j = 0; j < got; j++)
+                        log_sample(buf[j]);
+                    samples += got;
+                }
+
+            } else if (fd == conv_fd && phase != IDLE) {
+                // async_fd() is disarmed by the read
+                bool conv_done;
+                uint32_t adc;
+                int64_t read_ns = MS5611Clock::raw_ns();
+                if (!ms5611.try_complete(conv_done, adc)) {
+                    cerr << "read adc error ("
+                         << (phase == TEMP ? "temperature" : "pressure")
+                         << ")" << endl;
+                    phase = IDLE;
+                    continue;
+                }
+                if (!conv_done)
+                    continue;
+
+                if (phase == TEMP) {
+                    times.temp_read_ns = read_ns;
+                    adc_temp = adc;
+                    // pressure
+                    times.pres_start_ns = MS5611Clock::raw_ns();
+                    if (ms5611.begin(MS5611::PRES, osr) !=
+                        MS5611::Clock::time_point()) {
+                        phase = PRES;
+                    } else {
+                        cerr << "start convert error (pressure)" << endl;
+                        phase = IDLE;
+                    }
+                } else {
+                    times.pres_read_ns = read_ns;
+                    log_sample(make_sample(ms5611, adc_temp, adc, times, osr));
+                    samples++;
+                    phase = IDLE;
+                }
+            }
+        }
+    }
+
+    if (continuous) {
+        acq.stop();
+        missed += acq.late() + acq.overruns();
+        print_lateness(acq);
+        if (osr_ctl != NULL)
+            print_osr(acq);
+    }
+
+    cerr << samples << " samples, " << missed << " missed deadlines" << endl;
+
+    close(tick_fd);
+    close(sig_fd);
+    close(epfd);
+}
+
 int main(int argc, char *argv[])
 {
+    const char *osr_spec = NULL;
+    const char *blog_name = NULL;
+    const char *cache_name = NULL;
+    const char *shm_name = NULL;
+    const char *unix_path = NULL;
+    unsigned udp_port = 0;
+    bool blog_compress = false;
+    bool continuous = false;
     bool dump_cal = false;
-    unsigned long interval_s = 1;
+    bool one_message = false;
+    MS5611Acq::Realtime rt;
+    double interval_s = 1;
+    MS5611::Osr osr = MS5611::OSR4096;
+    unsigned temp_every = 1;
+    double temp_drift = 0;
 
     int c;
-    while ((c = getopt(argc, argv, "di:?")) != -1) {
+    const char *opts = "a:b:cC:df:F:i:mo:p:q:r:s:S:t:u:U:z?";
+    while ((c = getopt(argc, argv, opts)) != -1) {
         switch (c) {
+        case 'a':
+            osr_spec = optarg;
+            break;
+        case 'b':
+            blog_name = optarg;
+            break;
+        case 'c':
+            continuous = true;
+            break;
+        case 'C':
+            cache_name = optarg;
+            break;
         case 'd':
             dump_cal = true;
             break;
+        case 'f':
+            csv.set_flush_lines(strtoul(optarg, NULL, 0));
+            break;
+        case 'F':
+            if (!filter_temp.add(optarg) || !filter_pres.add(optarg))
+                usage(argv[0]);
+            break;
         case 'i':
-            interval_s = strtoul(optarg, NULL, 0);
-            if (interval_s == 0)
+            interval_s = strtod(optarg, NULL);
+            if (!(interval_s >= 0.000001))
+                usage(argv[0]);
+            break;
+        case 'm':
+            one_message = true;
+            break;
+        case 'o':
+            if (!osr_from_int(strtoul(optarg, NULL, 0), osr))
+                usage(argv[0]);
+            break;
+        case 'p':
+            rt.cpu = strtol(optarg, NULL, 0);
+            break;
+        case 'r':
+            rt.priority = strtol(optarg, NULL, 0);
+            if (rt.priority < 1 || rt.priority > 99)
                 usage(argv[0]);
+            rt.lock_memory = true;
+            break;
+        case 's':
+            rt.spin_usec = strtoul(optarg, NULL, 0);
+            break;
+        case 'S':
+            shm_name = optarg;
+            break;
+        case 't': {
+            char *p;
+            temp_every = strtoul(optarg, &p, 0);
+            if (*p == ':')
+                temp_drift = strtod(p + 1, &p);
+            if (temp_every < 1 || *p != '\0' || !(temp_drift >= 0))
+                usage(argv[0]);
+            break;
+        }
+        case 'u':
+            unix_path = optarg;
+            break;
+        case 'U':
+            udp_port = strtoul(optarg, NULL, 0);
+            if (udp_port == 0 || udp_port > 65535)
+                usage(argv[0]);
+            break;
+        case 'q': {
+            double qnh = strtod(optarg, NULL);
+            if (!(qnh >= 100 && qnh <= 2000))
+                usage(argv[0]);
+            alt.set_qnh(llround(qnh * 100));
+            break;
+        }
+        case 'z':
+            blog_compress = true;
             break;
         default:
             usage(argv[0]);
@@ -82,46 +527,75 @@ int main(int argc, char *argv[])
         }
     }
 
-    auto next_time = chrono::system_clock::now();
-    auto interval = chrono::seconds(interval_s);
+    chrono::nanoseconds interval(llround(interval_s * 1e9));
+
+    // -o is the highest OSR the controller may pick
+    MS5611OsrCtl::Config osr_cfg;
+    osr_cfg.max_osr = osr;
+    if (osr_spec != NULL &&
+        (!continuous || !MS5611OsrCtl::parse(osr_spec, osr_cfg)))
+        usage(argv[0]);
+    if ((temp_every > 1 || temp_drift > 0) && !continuous)
+        usage(argv[0]);
+    if ((rt.cpu >= 0 || rt.priority > 0 || rt.spin_usec > 0) && !continuous)
+        usage(argv[0]);
 
     tzset();
 
-    MS5611 ms5611(dev_name, spi_clk);
+    // calibration cache (-C): attach warm if the PROM matches
+    MS5611CalCache cache(cache_name != NULL ? cache_name : "");
+    if (cache_name != NULL)
+        cache.load();
+
+    MS5611 ms5611(dev_name, spi_clk, 1, cache_name != NULL ? &cache : NULL);
+
+    // the entry stays busy on disk until a clean exit, so after a crash
+    // the next start resets the chip
+    if (cache_name != NULL && ms5611.is_ready())
+        cache.save();
 
-    if (dump_cal)
+    // temperature decimation, for the stream
+    ms5611.stream_set_temp_every(temp_every, lround(temp_drift * 100));
+
+    if (dump_cal) {
         ms5611.dump_prom();
+        // csv output does not go through cout
+        cout.flush();
+    }
 
-    show_csv_hdr();
-
-    while (true) {
-        next_time += interval;
-        this_thread::sleep_until(next_time);
-        auto sleep_interval = chrono::milliseconds(10);
-        // temperature
-        if (ms5611.start_convert_temp()) {
-            this_thread::sleep_for(sleep_interval);
-            uint32_t adc_temp;
-            if (ms5611.read_adc(adc_temp)) {
-                // pressure
-                if (ms5611.start_convert_pres()) {
-                    this_thread::sleep_for(sleep_interval);
-                    uint32_t adc_pres;
-                    if (ms5611.read_adc(adc_pres)) {
-                        show_csv(ms5611, next_time, adc_temp, adc_pres);
-                    } else {
-                        cerr << "read adc error (pressure)" << endl;
-                    }
-                } else {
-                    cerr << "start convert error (pressure)" << endl;
-                }
-            } else {
-                cerr << "read adc error (temperature)" << endl;
-            }
-        } else {
-            cerr << "start convert error (temperature)" << endl;
-        }
+    if (shm_name != NULL) {
+        uint16_t prom[8];
+        ms5611.get_prom(prom);
+        if (!shm.open(shm_name, prom))
+            return 1;
+    }
+
+    // subscribers replace csv output
+    if (unix_path != NULL && !server.listen_unix(unix_path))
+        return 1;
+    if (udp_port != 0 && !server.listen_udp(udp_port))
+        return 1;
+    serving = unix_path != NULL || udp_port != 0;
+
+    if (blog_name != NULL) {
+        uint16_t prom[8];
+        ms5611.get_prom(prom);
+        if (!blog.open(blog_name, prom, osr, blog_compress))
+            return 1;
+    } else if (!serving) {
+        csv.header();
     }
 
+    log_loop(ms5611, osr, interval, continuous, one_message, rt,
+             osr_spec != NULL ? &osr_cfg : NULL);
+
+    // chip left idle, so the next start can attach warm
+    ms5611.detach();
+    if (cache_name != NULL)
+        cache.save();
+
+    if (!blog.close() || !csv.flush())
+        return 1;
+
     return 0;
 }
@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include "ms5611_osrctl.h"
+
+using namespace std;
+
+MS5611OsrCtl::MS5611OsrCtl(const Config &cfg, MS5611::Osr osr)
+    : _cfg(cfg), _switches_up(0), _switches_down(0), _head(0), _count(0)
+{
+    reset(osr);
+}
+
+bool MS5611OsrCtl::parse(const char *spec, Config &cfg)
+{
+    Config c = cfg;
+
+    string s(spec);
+    if (s == "auto")
+        return true;
+
+    size_t start = 0;
+    while (start <= s.size()) {
+        size_t end = s.find(',', start);
+        if (end == string::npos)
+            end = s.size();
+        string item = s.substr(start, end - start);
+        start = end + 1;
+
+        // name:value
+        size_t colon = item.find(':');
+        if (colon == string::npos)
+            return false;
+        string name = item.substr(0, colon);
+        const char *arg = &item[colon + 1];
+        char *p;
+        double v = strtod(arg, &p);
+        if (p == arg || *p != '\0' || !(v >= 0))
+            return false;
+
+        if (name == "rate" && v > 0 && v <= pair_hz(MS5611::OSR256))
+            c.rate_hz = v;
+        else if (name == "noise" && v > 0)
+            c.noise_pa = v;
+        else if (name == "motion" && v > 0)
+            c.motion_pa_s = v;
+        else if (name == "hold" && v == floor(v) && v <= 65536)
+            c.hold = unsigned(v);
+        else if (name == "window" && v > 0 && v <= 60)
+            c.window_s = v;
+        else
+            return false;
+    }
+
+    cfg = c;
+    return true;
+}
+
+void MS5611OsrCtl::reset(MS5611::Osr osr)
+{
+    _osr = osr;
+    _moving = false;
+    _slope_pa_s = 0;
+    _noise_pa = 0;
+    _noise_var = -1;
+    _noise_s = 0;
+    _steady_ns = -1;
+    _pending = osr;
+    _pending_count = 0;
+    _head = 0;
+    _count = 0;
+}
+
+double MS5611OsrCtl::resolution_pa(MS5611::Osr osr)
+{
+    // datasheet, pressure resolution rms (mbar) x 100
+    static const double res[5] = {6.5, 4.2, 2.7, 1.8, 1.2};
+    return res[osr >> 1];
+}
+
+MS5611::Osr MS5611OsrCtl::update(int64_t time_ns, int32_t pres_x100,
+                                 MS5611::Osr osr)
+{
+    if (pres_x100 == INT32_MIN)
+        return _osr;
+
+    if (_count == WINDOW_MAX) {
+        _head = (_head + 1) % WINDOW_MAX;
+        _count--;
+    }
+    Point &pt = _window[(_head + _count) % WINDOW_MAX];
+    pt.time_ns = time_ns;
+    pt.pres_x100 = pres_x100;
+    pt.osr = osr;
+    _count++;
+
+    int64_t window_ns = llround(_cfg.window_s * 1e9);
+    while (_count > 1 && time_ns - _window[_head].time_ns > window_ns) {
+        _head = (_head + 1) % WINDOW_MAX;
+        _count--;
+    }
+    if (_count < WINDOW_MIN)
+        return _osr;
+
+    const Point &prev = _window[(_head + _count - 2) % WINDOW_MAX];
+    double var = _fit();
+    double rate = fabs(_slope_pa_s);
+    if (!_moving && rate >= _cfg.motion_pa_s)
+        _moving = true;
+    else if (_moving && rate < _cfg.motion_pa_s / 2)
+        _moving = false;
+
+    // the noise is only measured once the window is all steady, as the
+    // residuals around a change in slope are not noise; it varies a lot
+    // from one window to the next, so it is averaged over four (all there
+    // are at first)
+    if (_moving)
+        _steady_ns = -1;
+    else if (_steady_ns < 0)
+        _steady_ns = time_ns;
+    if (!_moving && time_ns - _steady_ns >= window_ns) {
+        double dt = (time_ns - prev.time_ns) * 1e-9;
+        _noise_s += dt;
+        if (_noise_var < 0)
+            _noise_var = var;
+        else
+            _noise_var += min(1.0, dt / min(_noise_s, 4 * _cfg.window_s)) *
+                          (var - _noise_var);
+        _noise_pa = sqrt(_noise_var);
+    }
+
+    bool now;
+    MS5611::Osr want = _choose(now);
+    if (want == _osr) {
+        _pending_count = 0;
+        return _osr;
+    }
+    if (!now) {
+        if (want != _pending) {
+            _pending = want;
+            _pending_count = 0;
+        }
+        if (++_pending_count < _cfg.hold)
+            return _osr;
+    }
+
+    if (want > _osr)
+        _switches_up++;
+    else
+        _switches_down++;
+    if (_noise_var >= 0) {
+        double scale = resolution_pa(want) / resolution_pa(_osr);
+        _noise_var *= scale * scale;
+        _noise_pa = sqrt(_noise_var);
+    }
+    _osr = want;
+    _pending_count = 0;
+
+    return _osr;
+}
+
+// least squares line through the window; returns the variance of the
+// residuals, scaled to _osr
+double MS5611OsrCtl::_fit()
+{
+    const Point &last = _window[(_head + _count - 1) % WINDOW_MAX];
+    double n = _count;
+
+    // relative to the last point, so doubles keep the precision
+    double st = 0;
+    double sp = 0;
+    for (size_t i = 0; i < _count; i++) {
+        const Point &pt = _window[(_head + i) % WINDOW_MAX];
+        st += (pt.time_ns - last.time_ns) * 1e-9;
+        sp += pt.pres_x100 - last.pres_x100;
+    }
+    double mt = st / n;
+    double mp = sp / n;
+
+    double sxx = 0;
+    double sxy = 0;
+    for (size_t i = 0; i < _count; i++) {
+        const Point &pt = _window[(_head + i) % WINDOW_MAX];
+        double t = (pt.time_ns - last.time_ns) * 1e-9 - mt;
+        double p = pt.pres_x100 - last.pres_x100 - mp;
+        sxx += t * t;
+        sxy += t * p;
+    }
+    _slope_pa_s = sxx > 0 ? sxy / sxx : 0;
+
+    double ss = 0;
+    double res = resolution_pa(_osr);
+    for (size_t i = 0; i < _count; i++) {
+        const Point &pt = _window[(_head + i) % WINDOW_MAX];
+        double t = (pt.time_ns - last.time_ns) * 1e-9 - mt;
+        double p = pt.pres_x100 - last.pres_x100 - mp;
+        double e = (p - _slope_pa_s * t) * res / resolution_pa(pt.osr);
+        ss += e * e;
+    }
+    return ss / (n - 2);
+}
+
+// the OSR wanted after the last fit; now if it should not wait for hold
+MS5611::Osr MS5611OsrCtl::_choose(bool &now) const
+{
+    double res = resolution_pa(_osr);
+
+    // steady: lowest OSR within the noise target, or max_osr; the current
+    // one (in range) until the noise has been measured for four windows
+    int steady = _cfg.max_osr;
+    if (_cfg.noise_pa > 0 && _noise_s < 4 * _cfg.window_s) {
+        steady = max(int(_cfg.min_osr), min(int(_osr), steady));
+    } else if (_cfg.noise_pa > 0) {
+        for (int o = _cfg.min_osr; o <= _cfg.max_osr; o += 2) {
+            MS5611::Osr osr = MS5611::Osr(o);
+            double pred = _noise_pa * resolution_pa(osr) / res;
+            double target = o != _osr ? _cfg.noise_pa * 0.8 : _cfg.noise_pa;
+            if (pred <= target) {
+                steady = o;
+                break;
+            }
+        }
+    }
+
+    now = false;
+    if (!_moving)
+        return MS5611::Osr(steady);
+
+    // moving: highest OSR that keeps up
+    int fast = _cfg.min_osr;
+    for (int o = _cfg.max_osr; o >= _cfg.min_osr; o -= 2) {
+        MS5611::Osr osr = MS5611::Osr(o);
+        bool ok;
+        if (_cfg.rate_hz > 0)
+            ok = pair_hz(osr) >= _cfg.rate_hz;
+        else
+            ok = fabs(_slope_pa_s) / pair_hz(osr) <= resolution_pa(osr);
+        if (ok) {
+            fast = o;
+            break;
+        }
+    }
+
+    int want = min(fast, steady);
+    now = want < _osr;
+    return MS5611::Osr(want);
+}
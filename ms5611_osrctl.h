@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "ms5611.h"
+
+// adaptive oversampling for a conversion stream
+//
+// Each compensated pressure sample goes to update(), which fits a line to
+// the last window_s seconds of them: the slope is the rate of change and
+// the rms residual the noise, scaled to the current OSR by the datasheet's
+// resolution for each OSR (samples in the window may have been taken at
+// another one) and smoothed over four windows of steady pressure.
+// Pressures are in Pa, as pres_x100.
+//
+// Steady, the controller asks for max_osr, or with a noise target for the
+// lowest OSR whose predicted noise is within noise_pa. Moving (changing by
+// motion_pa_s or more), it asks for the highest OSR that still samples at
+// rate_hz, or without a rate target for the highest OSR at which the
+// pressure changes less per sample than the datasheet resolution; never
+// more than it would steady. Temperature is converted at the same OSR.
+//
+// Hysteresis: motion starts at motion_pa_s and ends below half of that.
+// The OSR drops as soon as motion asks for it; any other change must be
+// asked for hold times in a row. With a noise target the current OSR is
+// kept while its noise is within the target, but another one is only
+// picked if its prediction is 20% under it.
+class MS5611OsrCtl
+{
+public:
+    // samples in the window at most, whatever window_s
+    static const size_t WINDOW_MAX = 1024;
+
+    // samples in the window before the first decision
+    static const size_t WINDOW_MIN = 8;
+
+    struct Config {
+        MS5611::Osr min_osr;
+        MS5611::Osr max_osr;
+        double rate_hz;     // sample rate to hold while moving, 0 for none
+        double noise_pa;    // rms noise to hold while steady, 0 for none
+        double motion_pa_s; // rate of change that is motion
+        double window_s;
+        unsigned hold;
+
+        Config()
+            : min_osr(MS5611::OSR256), max_osr(MS5611::OSR4096), rate_hz(0),
+              noise_pa(0), motion_pa_s(20), window_s(0.5), hold(16)
+        {
+        }
+    };
+
+    // osr is what the stream starts at
+    MS5611OsrCtl(const Config &cfg = Config(),
+                 MS5611::Osr osr = MS5611::OSR4096);
+
+    // set cfg from comma-separated rate:HZ, noise:PA, motion:PA_S, hold:N
+    // and window:SEC, or "auto" for the defaults; false if spec is bad
+    static bool parse(const char *spec, Config &cfg);
+
+    // add a sample converted at osr; returns the OSR to use from now on
+    //
+    // Out of range samples (INT32_MIN) are ignored.
+    MS5611::Osr update(int64_t time_ns, int32_t pres_x100, MS5611::Osr osr);
+
+    // forget the window, e.g. after a stream restart; the switch counts
+    // are kept
+    void reset(MS5611::Osr osr);
+
+    MS5611::Osr osr() const
+    {
+        return _osr;
+    }
+
+    bool moving() const
+    {
+        return _moving;
+    }
+
+    // from the last fit
+    double slope_pa_s() const
+    {
+        return _slope_pa_s;
+    }
+
+    // at osr(); 0 until measured
+    double noise_pa() const
+    {
+        return _noise_pa;
+    }
+
+    uint64_t switches_up() const
+    {
+        return _switches_up;
+    }
+
+    uint64_t switches_down() const
+    {
+        return _switches_down;
+    }
+
+    // datasheet rms pressure resolution at osr, Pa
+    static double resolution_pa(MS5611::Osr osr);
+
+    // temperature/pressure pairs per second at osr
+    static double pair_hz(MS5611::Osr osr)
+    {
+        return 1e6 / (2 * MS5611::conv_usec(osr));
+    }
+
+private:
+    struct Point {
+        int64_t time_ns;
+        int32_t pres_x100;
+        MS5611::Osr osr;
+    };
+
+    Config _cfg;
+    MS5611::Osr _osr;
+    bool _moving;
+    double _slope_pa_s;
+    double _noise_pa;
+    double _noise_var; // smoothed, -1 until measured
+    double _noise_s;    // time measured
+    int64_t _steady_ns; // steady since, -1 while moving
+    uint64_t _switches_up;
+    uint64_t _switches_down;
+    MS5611::Osr _pending; // change asked for
+    unsigned _pending_count;
+
+    // window, oldest first from _head
+    Point _window[WINDOW_MAX];
+    size_t _head;
+    size_t _count;
+
+    double _fit();
+    MS5611::Osr _choose(bool &now) const;
+};
@@ -0,0 +1,121 @@
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include "ms5611_pool.h"
+
+using namespace std;
+
+MS5611Pool::MS5611Pool(unsigned threads)
+    : _queued(0), _pending(0), _next(0), _stop(false), _steals(0)
+{
+    if (threads == 0)
+        threads = thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+
+    for (unsigned i = 0; i < threads; i++)
+        _workers.push_back(unique_ptr<Worker>(new Worker));
+    // start only once every deque exists, since workers steal
+    for (unsigned i = 0; i < threads; i++)
+        _workers[i]->thread = thread(&MS5611Pool::_run, this, i);
+}
+
+MS5611Pool::~MS5611Pool()
+{
+    wait();
+
+    {
+        lock_guard<mutex> l(_lock);
+        _stop = true;
+    }
+    _work_cv.notify_all();
+
+    for (auto &w : _workers)
+        w->thread.join();
+}
+
+void MS5611Pool::submit(Task task)
+{
+    // counted before it is queued, so a worker never takes an uncounted
+    // task
+    unsigned n;
+    {
+        lock_guard<mutex> l(_lock);
+        n = _next;
+        _next = (_next + 1) % _workers.size();
+        _queued++;
+        _pending++;
+    }
+
+    {
+        Worker &w = *_workers[n];
+        lock_guard<mutex> l(w.lock);
+        w.tasks.push_back(move(task));
+    }
+    _work_cv.notify_one();
+}
+
+void MS5611Pool::wait()
+{
+    unique_lock<mutex> l(_lock);
+    _done_cv.wait(l, [this] { return _pending == 0; });
+}
+
+// newest from our own deque, else oldest from someone else's
+bool MS5611Pool::_take(unsigned self, Task &task)
+{
+    bool got = false;
+    {
+        Worker &w = *_workers[self];
+        lock_guard<mutex> l(w.lock);
+        if (!w.tasks.empty()) {
+            task = move(w.tasks.back());
+            w.tasks.pop_back();
+            got = true;
+        }
+    }
+
+    for (size_t i = 1; !got && i < _workers.size(); i++) {
+        Worker &w = *_workers[(self + i) % _workers.size()];
+        lock_guard<mutex> l(w.lock);
+        if (!w.tasks.empty()) {
+            task = move(w.tasks.front());
+            w.tasks.pop_front();
+            _steals.fetch_add(1, memory_order_relaxed);
+            got = true;
+        }
+    }
+
+    if (got) {
+        lock_guard<mutex> l(_lock);
+        _queued--;
+    }
+    return got;
+}
+
+void MS5611Pool::_run(unsigned self)
+{
+    for (;;) {
+        Task task;
+        if (_take(self, task)) {
+            task();
+            lock_guard<mutex> l(_lock);
+            if (--_pending == 0)
+                _done_cv.notify_all();
+            continue;
+        }
+
+        // _queued can be briefly ahead of the deques (see submit()), or
+        // count a task another worker is taking; let that finish
+        unique_lock<mutex> l(_lock);
+        if (_queued > 0) {
+            l.unlock();
+            this_thread::yield();
+            continue;
+        }
+        _work_cv.wait(l, [this] { return _stop || _queued > 0; });
+        if (_stop)
+            return;
+    }
+}
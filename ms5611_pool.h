@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// work-stealing thread pool
+//
+// Each worker has its own task deque. submit() deals tasks out round robin;
+// a worker takes the newest task from its own deque and, when that is
+// empty, steals the oldest from another's, so uneven tasks (log chunks that
+// take different times to parse, say) still keep every core busy. Tasks
+// are meant to be coarse: a shared lock is taken once per task to track
+// what is queued and what has finished. Tasks must not throw.
+class MS5611Pool
+{
+public:
+    typedef std::function<void()> Task;
+
+    // threads = 0 for one per core
+    MS5611Pool(unsigned threads = 0);
+
+    // waits for all tasks
+    virtual ~MS5611Pool();
+
+    unsigned threads() const
+    {
+        return unsigned(_workers.size());
+    }
+
+    void submit(Task task);
+
+    // wait until every submitted task has finished
+    void wait();
+
+    // tasks run by a worker other than the one they were dealt to
+    uint64_t steals() const
+    {
+        return _steals.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Worker {
+        std::mutex lock;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::mutex _lock; // for the rest
+    std::condition_variable _work_cv;
+    std::condition_variable _done_cv;
+    size_t _queued;  // in some deque
+    size_t _pending; // submitted and not finished
+    unsigned _next;  // worker for the next submit()
+    bool _stop;
+    std::atomic<uint64_t> _steals;
+
+    void _run(unsigned self);
+    bool _take(unsigned self, Task &task);
+};
@@ -0,0 +1,241 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "ms5611.h"
+#include "ms5611_alt.h"
+#include "ms5611_blog.h"
+#include "ms5611_calcache.h"
+#include "ms5611_csv.h"
+#include "ms5611_filter.h"
+#include "ms5611_sample.h"
+
+using namespace std;
+
+// offline replay
+//
+// Reads csv logs from ms5611_log, or binary logs (-b), and runs the raw
+// values through MS5611::get_pressure with calibration from the log or a
+// calibration cache instead of a device. The output is csv as ms5611_log
+// writes it, so old logs can be redone with another sea level pressure or
+// filter. Samples go through in batches, and csv is parsed and written in
+// large blocks without per-line allocation.
+
+static const size_t batch = 4096;
+
+static MS5611Alt alt;
+static MS5611Csv csv(1, 0, 1 << 20);
+static MS5611FilterChain filter_temp;
+static MS5611FilterChain filter_pres;
+static bool no_output = false;
+
+static uint64_t samples = 0;
+static uint64_t range_errors = 0;
+
+// compensate a batch and write it
+static void replay(const MS5611 &ms5611, MS5611Sample *s, const time_t *t,
+                   size_t n)
+{
+    static uint32_t temp_adc[batch];
+    static uint32_t pres_adc[batch];
+    static int32_t temp_x100[batch];
+    static int32_t pres_x100[batch];
+
+    for (size_t i = 0; i < n; i++) {
+        temp_adc[i] = s[i].temp_adc;
+        pres_adc[i] = s[i].pres_adc;
+    }
+    range_errors +=
+        n - ms5611.get_pressure(temp_adc, pres_adc, n, temp_x100, pres_x100);
+    samples += n;
+
+    if (no_output)
+        return;
+
+    for (size_t i = 0; i < n; i++) {
+        s[i].temp_x100 = temp_x100[i];
+        s[i].pres_x100 = pres_x100[i];
+        // out of range samples bypass the filters
+        if (filter_pres.stages() > 0 && s[i].pres_x100 != INT32_MIN) {
+            filter_temp.put(temp_x100[i], s[i].temp_x100);
+            if (!filter_pres.put(pres_x100[i], s[i].pres_x100))
+                continue;
+        }
+        int32_t alt_cm = alt.altitude_cm(s[i].pres_x100, s[i].temp_x100);
+        csv.line(t[i], s[i], alt_cm == INT32_MIN ? NAN : alt_cm / 100.0);
+    }
+}
+
+// ms5611 is NULL without calibration
+static bool replay_csv(const char *path, const MS5611 *ms5611)
+{
+    if (ms5611 == NULL || !ms5611->has_cal()) {
+        cerr << path << ": csv logs need calibration (-C)" << endl;
+        return false;
+    }
+
+    MS5611CsvReader reader;
+    if (!reader.open(path))
+        return false;
+
+    static MS5611Sample s[batch];
+    static time_t t[batch];
+    size_t n;
+    while ((n = reader.read(s, t, batch)) > 0)
+        replay(*ms5611, s, t, n);
+
+    // the header is always skipped
+    if (reader.skipped() > 1)
+        cerr << path << ": " << reader.skipped() - 1 << " bad lines" << endl;
+
+    return !reader.error();
+}
+
+static bool replay_blog(const char *path)
+{
+    MS5611BlogReader reader;
+    if (!reader.open(path))
+        return false;
+
+    const MS5611BlogHeader &hdr = reader.header();
+    MS5611 ms5611(hdr.prom);
+    if (!ms5611.has_cal())
+        return false;
+
+    int64_t real_offset_ns = hdr.real_ns - hdr.mono_ns;
+    vector<MS5611BlogRecord> buf(hdr.block_samples);
+    static MS5611Sample s[batch];
+    static time_t t[batch];
+    size_t n = 0;
+    for (size_t b = 0; b < reader.blocks(); b++) {
+        const MS5611BlogRecord *recs = reader.block_records(b, buf.data());
+        if (recs == NULL) {
+            cerr << path << ": block " << b << " corrupt" << endl;
+            continue;
+        }
+        size_t count = reader.block_count(b);
+        for (size_t r = 0; r < count; r++) {
+            s[n].temp_adc = recs[r].temp_adc;
+            s[n].pres_adc = recs[r].pres_adc;
+            t[n] = (recs[r].time_ns + real_offset_ns) / 1000000000;
+            if (++n == batch) {
+                replay(ms5611, s, t, n);
+                n = 0;
+            }
+        }
+    }
+    replay(ms5611, s, t, n);
+
+    return true;
+}
+
+// binary logs start with their magic; anything else is taken as csv
+static bool is_blog(const char *path)
+{
+    if (strcmp(path, "-") == 0)
+        return false;
+
+    char magic[8];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    bool blog = read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+                memcmp(magic, "MS5611B", sizeof(magic)) == 0;
+    close(fd);
+    return blog;
+}
+
+static void usage(const char *prog_name)
+{
+    printf("usage: %s [-C FILE [-k KEY]] [-n] [-q MBAR] [-F SPEC] LOG...\n",
+           prog_name);
+    printf("       -C FILE  calibration cache, for csv logs (no)\n");
+    printf("       -k KEY   calibration cache entry (/dev/spidev0.0)\n");
+    printf("       -n       no output, only the summary (no)\n");
+    printf("       -q MBAR  sea level pressure for altitude (1013.25)\n");
+    printf("       -F SPEC  filter output, as for ms5611_log (none)\n");
+    printf("       LOG      csv or binary log, - for stdin\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *cache_name = NULL;
+    const char *cache_key = "/dev/spidev0.0";
+
+    int c;
+    while ((c = getopt(argc, argv, "C:F:k:nq:?")) != -1) {
+        switch (c) {
+        case 'C':
+            cache_name = optarg;
+            break;
+        case 'F':
+            if (!filter_temp.add(optarg) || !filter_pres.add(optarg))
+                usage(argv[0]);
+            break;
+        case 'k':
+            cache_key = optarg;
+            break;
+        case 'n':
+            no_output = true;
+            break;
+        case 'q': {
+            double qnh = strtod(optarg, NULL);
+            if (!(qnh >= 100 && qnh <= 2000))
+                usage(argv[0]);
+            alt.set_qnh(llround(qnh * 100));
+            break;
+        }
+        default:
+            usage(argv[0]);
+            break;
+        }
+    }
+    if (optind >= argc)
+        usage(argv[0]);
+
+    tzset();
+
+    // calibration for csv logs
+    uint16_t prom[8];
+    memset(prom, 0, sizeof(prom));
+    if (cache_name != NULL) {
+        MS5611CalCache cache(cache_name);
+        if (!cache.load() || !cache.get(cache_key, prom)) {
+            cerr << cache_name << ": no calibration for " << cache_key
+                 << endl;
+            return 1;
+        }
+    }
+    MS5611 ms5611(prom);
+
+    if (!no_output)
+        csv.header();
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    bool ok = true;
+    for (int i = optind; i < argc; i++) {
+        if (is_blog(argv[i]))
+            ok = replay_blog(argv[i]) && ok;
+        else
+            ok = replay_csv(argv[i], cache_name != NULL ? &ms5611 : NULL) &&
+                 ok;
+    }
+    chrono::duration<double> secs = chrono::steady_clock::now() - start;
+
+    if (!csv.flush())
+        ok = false;
+
+    cerr << samples << " samples, " << range_errors << " out of range, "
+         << samples / secs.count() / 1e6 << " Msamples/s" << endl;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// lock-free single-producer, single-consumer ring
+//
+// N must be a power of two. The producer never waits: push() on a full ring
+// drops the item and counts an overrun. Producer and consumer indexes are
+// on separate cache lines, and each side keeps a cached copy of the other's
+// index so the shared line is only read when the cached one runs out.
+template <typename T, size_t N>
+class MS5611Ring
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+    MS5611Ring()
+        : _head(0), _tail_cache(0), _overruns(0), _tail(0), _head_cache(0),
+          _items()
+    {
+    }
+
+    // producer side
+    bool push(const T &item)
+    {
+        uint64_t head = _head.load(std::memory_order_relaxed);
+        if (head - _tail_cache == N) {
+            _tail_cache = _tail.load(std::memory_order_acquire);
+            if (head - _tail_cache == N) {
+                _overruns.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        _items[head & (N - 1)] = item;
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side; returns number of items copied (up to n)
+    size_t pop(T *items, size_t n)
+    {
+        uint64_t tail = _tail.load(std::memory_order_relaxed);
+        if (_head_cache - tail < n)
+            _head_cache = _head.load(std::memory_order_acquire);
+        size_t avail = size_t(_head_cache - tail);
+        if (n > avail)
+            n = avail;
+        for (size_t i = 0; i < n; i++)
+            items[i] = _items[(tail + i) & (N - 1)];
+        _tail.store(tail + n, std::memory_order_release);
+        return n;
+    }
+
+    // approximate unless called from the consumer with the producer idle
+    size_t size() const
+    {
+        return size_t(_head.load(std::memory_order_acquire) -
+                      _tail.load(std::memory_order_acquire));
+    }
+
+    static size_t capacity()
+    {
+        return N;
+    }
+
+    // items dropped because the ring was full
+    uint64_t overruns() const
+    {
+        return _overruns.load(std::memory_order_relaxed);
+    }
+
+private:
+    // producer's cache line
+    alignas(64) std::atomic<uint64_t> _head;
+    uint64_t _tail_cache;
+    std::atomic<uint64_t> _overruns;
+
+    // consumer's cache line
+    alignas(64) std::atomic<uint64_t> _tail;
+    uint64_t _head_cache;
+
+    alignas(64) T _items[N];
+};
@@ -0,0 +1,144 @@
+#include <cmath>
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include "ms5611_rollup.h"
+
+using namespace std;
+
+MS5611Agg::MS5611Agg()
+    : count(0), range_errors(0), temp_min(INT32_MAX), temp_max(INT32_MIN),
+      pres_min(INT32_MAX), pres_max(INT32_MIN), temp_sum(0), pres_sum(0),
+      pres_diff2(0), pres_diffs(0), temp_first(0), temp_last(0),
+      pres_first(0), pres_last(0)
+{
+}
+
+void MS5611Agg::add(int32_t temp_x100, int32_t pres_x100, bool join)
+{
+    if (temp_x100 == INT32_MIN || pres_x100 == INT32_MIN) {
+        range_errors++;
+        return;
+    }
+
+    if (count == 0) {
+        temp_first = temp_x100;
+        pres_first = pres_x100;
+    } else if (join) {
+        double d = pres_x100 - pres_last;
+        pres_diff2 += d * d;
+        pres_diffs++;
+    }
+    temp_last = temp_x100;
+    pres_last = pres_x100;
+
+    if (temp_x100 < temp_min)
+        temp_min = temp_x100;
+    if (temp_x100 > temp_max)
+        temp_max = temp_x100;
+    if (pres_x100 < pres_min)
+        pres_min = pres_x100;
+    if (pres_x100 > pres_max)
+        pres_max = pres_x100;
+    temp_sum += temp_x100;
+    pres_sum += pres_x100;
+    count++;
+}
+
+void MS5611Agg::merge(const MS5611Agg &later, bool join)
+{
+    range_errors += later.range_errors;
+    if (later.count == 0)
+        return;
+
+    if (count == 0) {
+        uint64_t errors = range_errors;
+        *this = later;
+        range_errors = errors;
+        return;
+    }
+
+    if (join) {
+        double d = later.pres_first - pres_last;
+        pres_diff2 += d * d;
+        pres_diffs++;
+    }
+    pres_diff2 += later.pres_diff2;
+    pres_diffs += later.pres_diffs;
+    temp_last = later.temp_last;
+    pres_last = later.pres_last;
+
+    if (later.temp_min < temp_min)
+        temp_min = later.temp_min;
+    if (later.temp_max > temp_max)
+        temp_max = later.temp_max;
+    if (later.pres_min < pres_min)
+        pres_min = later.pres_min;
+    if (later.pres_max > pres_max)
+        pres_max = later.pres_max;
+    temp_sum += later.temp_sum;
+    pres_sum += later.pres_sum;
+    count += later.count;
+}
+
+// Allan deviation: sqrt(sum((p[i] - p[i-1])^2) / (2 (n - 1))), with n - 1
+// the differences
+double MS5611Agg::pres_noise() const
+{
+    if (pres_diffs == 0)
+        return 0;
+    return sqrt(pres_diff2 / (2 * pres_diffs));
+}
+
+MS5611Rollup::MS5611Rollup(unsigned period_s)
+    : _period(period_s > 0 ? period_s : 1), _cur_start(0), _cur(NULL),
+      _started(false), _first_osr(-1), _last_osr(-1), _osr_cur(NULL)
+{
+}
+
+void MS5611Rollup::add(time_t t, int32_t temp_x100, int32_t pres_x100,
+                       int osr)
+{
+    time_t start = t - ((t % _period) + _period) % _period;
+    if (_cur == NULL || start != _cur_start) {
+        _cur = &_periods[start];
+        _cur_start = start;
+    }
+    // a change of OSR is not a difference, for any of the aggregates
+    bool join = _started && osr == _last_osr;
+    _cur->add(temp_x100, pres_x100, join);
+    _total.add(temp_x100, pres_x100, join);
+
+    // a new run at this OSR
+    if (!join)
+        _osr_cur = &_osrs[osr];
+    if (!_started)
+        _first_osr = osr;
+    _osr_cur->add(temp_x100, pres_x100, join);
+    _started = true;
+    _last_osr = osr;
+}
+
+void MS5611Rollup::merge(const MS5611Rollup &later)
+{
+    bool join = !_started || !later._started ||
+                _last_osr == later._first_osr;
+    for (auto &p : later._periods)
+        _periods[p.first].merge(p.second, join);
+    _total.merge(later._total, join);
+
+    if (!later._started)
+        return;
+
+    // only the run at the join continues across it
+    for (auto &o : later._osrs) {
+        bool join = _started && o.first == _last_osr &&
+                    o.first == later._first_osr;
+        _osrs[o.first].merge(o.second, join);
+    }
+    if (!_started)
+        _first_osr = later._first_osr;
+    _started = true;
+    _last_osr = later._last_osr;
+    _osr_cur = &_osrs[_last_osr];
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <map>
+
+// summary of a span of compensated samples
+//
+// merge() is associative, so spans can be summarized independently (e.g.
+// chunks of a log on different cores) and then combined in time order.
+// Noise is the Allan deviation of pressure at the sample interval, from the
+// squared differences of successive samples; each span keeps its first and
+// last values so merge() can add the difference across the join. A sample
+// added (or a span merged) without join does not follow on from the ones
+// before it, e.g. after a change of OSR, and adds no difference.
+// Temperature and pressure are x100, as from MS5611::get_pressure.
+struct MS5611Agg {
+    uint64_t count;
+    uint64_t range_errors; // samples with INT32_MIN values, not counted
+    int32_t temp_min;
+    int32_t temp_max;
+    int32_t pres_min;
+    int32_t pres_max;
+    int64_t temp_sum;
+    int64_t pres_sum;
+    double pres_diff2; // sum of squared successive differences
+    uint64_t pres_diffs; // differences in pres_diff2
+    int32_t temp_first;
+    int32_t temp_last;
+    int32_t pres_first;
+    int32_t pres_last;
+
+    MS5611Agg();
+
+    void add(int32_t temp_x100, int32_t pres_x100, bool join = true);
+
+    // later's samples all come after these
+    void merge(const MS5611Agg &later, bool join = true);
+
+    double temp_mean() const
+    {
+        return count > 0 ? double(temp_sum) / count : 0;
+    }
+
+    double pres_mean() const
+    {
+        return count > 0 ? double(pres_sum) / count : 0;
+    }
+
+    // change over the span
+    int32_t temp_drift() const
+    {
+        return temp_last - temp_first;
+    }
+
+    double pres_noise() const;
+};
+
+// MS5611Agg per period (e.g. per minute) and per OSR, plus a total
+//
+// The per-OSR noise is only from successive samples at the same OSR: each
+// run of samples at one OSR is joined to the previous run at that OSR
+// without a difference, as time (and pressure) passed at other OSRs in
+// between. The periods and the total don't count the step at a change of
+// OSR either.
+class MS5611Rollup
+{
+public:
+    MS5611Rollup(unsigned period_s = 60);
+
+    // osr is the MS5611::Osr the sample was converted at, -1 if not known
+    void add(time_t t, int32_t temp_x100, int32_t pres_x100, int osr = -1);
+
+    // later's samples all come after these, period must match
+    void merge(const MS5611Rollup &later);
+
+    // by period start time
+    const std::map<time_t, MS5611Agg> &periods() const
+    {
+        return _periods;
+    }
+
+    const MS5611Agg &total() const
+    {
+        return _total;
+    }
+
+    // by MS5611::Osr, -1 for not known
+    const std::map<int, MS5611Agg> &osrs() const
+    {
+        return _osrs;
+    }
+
+private:
+    time_t _period;
+    std::map<time_t, MS5611Agg> _periods;
+    MS5611Agg _total;
+    time_t _cur_start; // period of the last add(), usually the next one's
+    MS5611Agg *_cur;
+    std::map<int, MS5611Agg> _osrs;
+    bool _started;   // anything added
+    int _first_osr;  // of the first sample
+    int _last_osr;   // of the last sample
+    MS5611Agg *_osr_cur; // _osrs[_last_osr]
+};
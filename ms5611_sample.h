@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+// conversion timestamps, CLOCK_MONOTONIC_RAW ns (see MS5611Clock)
+//
+// A conversion's start is when its command went out and its read is when
+// its ADC result was read back, which may be well after it finished. The
+// chip averages over the whole conversion, so mid_ns, the middle of the
+// pressure conversion, is the best single time for the sample.
+struct MS5611Times {
+    int64_t temp_start_ns;
+    int64_t temp_read_ns;
+    int64_t pres_start_ns;
+    int64_t pres_read_ns;
+    int64_t mid_ns;
+};
+
+// one temperature/pressure pair
+struct MS5611Sample {
+    int64_t time_ns; // CLOCK_MONOTONIC when the pressure was read
+    uint32_t temp_adc;
+    uint32_t pres_adc;
+    int32_t temp_x100; // INT32_MIN if the temperature is out of range
+    int32_t pres_x100; // INT32_MIN if the temperature is out of range
+    MS5611Times times; // all 0 if not recorded
+    int64_t real_offset_ns; // CLOCK_REALTIME - CLOCK_MONOTONIC_RAW, or 0
+    int32_t osr; // MS5611::Osr of the pressure conversion, -1 if not known
+    uint32_t reserved;
+};
@@ -0,0 +1,110 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "ms5611_sched.h"
+
+using namespace std;
+
+// correct for gcc and a few other (but not all) compilers
+#define FUNC_NAME __PRETTY_FUNCTION__
+
+MS5611Sched::MS5611Sched(int verbosity) : _verbosity(verbosity), _stop(false)
+{
+}
+
+int MS5611Sched::add(const string &dev_name, unsigned spi_clk, MS5611::Osr osr)
+{
+    return _add(new MS5611(dev_name, spi_clk, _verbosity), osr);
+}
+
+int MS5611Sched::add(MS5611::Transport &xport, MS5611::Osr osr)
+{
+    return _add(new MS5611(xport, _verbosity), osr);
+}
+
+// take ownership of a device
+int MS5611Sched::_add(MS5611 *ms5611, MS5611::Osr osr)
+{
+    unique_ptr<MS5611> dev(ms5611);
+
+    if (!dev->is_ready()) {
+        // error message already printed
+        return -1;
+    }
+
+    _devs.push_back(Dev());
+    _devs.back().ms5611 = move(dev);
+    _devs.back().osr = osr;
+    _devs.back().pairs = 0;
+    _devs.back().errors = 0;
+
+    return int(_devs.size()) - 1;
+}
+
+bool MS5611Sched::run(Callback callback, unsigned long max_pairs)
+{
+    _stop = false;
+    _start = MS5611::Clock::now();
+
+    for (size_t d = 0; d < _devs.size(); d++) {
+        Dev &dev = _devs[d];
+        dev.pairs = 0;
+        dev.errors = 0;
+        dev.last = _start;
+        if (!dev.ms5611->stream_start(dev.osr, dev.osr)) {
+            // error message already printed
+            for (size_t s = 0; s < d; s++)
+                _devs[s].ms5611->stream_stop();
+            return false;
+        }
+    }
+
+    unsigned long total = 0;
+    bool ok = true;
+    while (!_stop && !_devs.empty() && (max_pairs == 0 || total < max_pairs)) {
+        // device whose conversion finishes first
+        size_t next = 0;
+        for (size_t d = 1; d < _devs.size(); d++)
+            if (_devs[d].ms5611->stream_deadline() <
+                _devs[next].ms5611->stream_deadline())
+                next = d;
+        Dev &dev = _devs[next];
+
+        this_thread::sleep_until(dev.ms5611->stream_deadline());
+
+        bool pair;
+        uint32_t temp_adc;
+        uint32_t pres_adc;
+        if (!dev.ms5611->stream_next(pair, temp_adc, pres_adc)) {
+            // error message already printed
+            dev.errors++;
+            if (!dev.ms5611->stream_start(dev.osr, dev.osr)) {
+                ok = false;
+                break;
+            }
+            continue;
+        }
+
+        if (pair) {
+            dev.pairs++;
+            dev.last = MS5611::Clock::now();
+            total++;
+            callback(int(next), temp_adc, pres_adc);
+        }
+    }
+
+    for (size_t d = 0; d < _devs.size(); d++)
+        _devs[d].ms5611->stream_stop();
+
+    return ok;
+}
+
+double MS5611Sched::rate_hz(int dev) const
+{
+    const Dev &d = _devs[dev];
+    double sec = chrono::duration<double>(d.last - _start).count();
+    if (sec <= 0)
+        return 0;
+    return d.pairs / sec;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ms5611.h"
+
+// acquisition scheduler for several MS5611 devices
+//
+// One thread keeps every device converting. Each device runs its own
+// temperature/pressure stream (MS5611::stream_next); the scheduler sleeps
+// until the earliest conversion deadline among the devices, services that
+// device, and repeats. While one device converts the others are read and
+// restarted, so throughput scales with the number of devices until the SPI
+// transfers themselves fill the time.
+class MS5611Sched
+{
+public:
+    // called with each temperature/pressure pair; dev is the index
+    // returned by add()
+    typedef std::function<void(int dev, uint32_t temp_adc, uint32_t pres_adc)>
+        Callback;
+
+    // verbosity is as for MS5611
+    MS5611Sched(int verbosity = 1);
+
+    // add a device; returns its index, or -1 if it is not ready
+    int add(const std::string &dev_name, unsigned spi_clk = 1000000,
+            MS5611::Osr osr = MS5611::OSR4096);
+
+    // add a device on an existing transport; xport must outlive this
+    int add(MS5611::Transport &xport, MS5611::Osr osr = MS5611::OSR4096);
+
+    int devices() const
+    {
+        return int(_devs.size());
+    }
+
+    MS5611 &device(int dev)
+    {
+        return *_devs[dev].ms5611;
+    }
+
+    // run until stop() is called or max_pairs pairs (total over all
+    // devices, 0 for no limit) have been delivered
+    //
+    // A device with an error is restarted; returns false if that fails.
+    bool run(Callback callback, unsigned long max_pairs = 0);
+
+    // make run() return; may be called from the callback or another thread
+    void stop()
+    {
+        _stop = true;
+    }
+
+    // statistics for the last run(); read them from the callback or after
+    // run() returns, not from another thread during a run
+    unsigned long pairs(int dev) const
+    {
+        return _devs[dev].pairs;
+    }
+
+    unsigned long errors(int dev) const
+    {
+        return _devs[dev].errors;
+    }
+
+    // pairs per second
+    double rate_hz(int dev) const;
+
+private:
+    struct Dev {
+        std::unique_ptr<MS5611> ms5611;
+        MS5611::Osr osr;
+        unsigned long pairs;
+        unsigned long errors;
+        MS5611::Clock::time_point last; // time of last pair
+    };
+
+    int _verbosity;
+    std::vector<Dev> _devs;
+    std::atomic<bool> _stop;
+    MS5611::Clock::time_point _start;
+
+    int _add(MS5611 *ms5611, MS5611::Osr osr);
+};
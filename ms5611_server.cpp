@@ -0,0 +1,553 @@
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "ms5611_clock.h"
+#include "ms5611_server.h"
+
+using namespace std;
+
+// correct for gcc and a few other (but not all) compilers
+#define FUNC_NAME __PRETTY_FUNCTION__
+
+static const size_t frame_max =
+    sizeof(MS5611FrameHeader) +
+    MS5611Subscribe::BATCH_MAX * sizeof(MS5611FrameRecord);
+
+static bool sub_valid(const MS5611Subscribe &sub)
+{
+    return sub.magic == MS5611Subscribe::MAGIC &&
+           (sub.decimation == 0 ||
+            (sub.batch >= 1 && sub.batch <= MS5611Subscribe::BATCH_MAX &&
+             sub.policy <= MS5611Subscribe::DISCONNECT));
+}
+
+MS5611Server::MS5611Server(int verbosity, size_t queue_bytes)
+    : _verbosity(verbosity), _queue_bytes(max(queue_bytes, frame_max)),
+      _epoll_fd(epoll_create1(EPOLL_CLOEXEC)), _unix_fd(-1), _udp_fd(-1),
+      _expire_ns(0)
+{
+}
+
+MS5611Server::~MS5611Server()
+{
+    for (auto &c : _clients)
+        if (c->fd >= 0)
+            close(c->fd);
+    if (_unix_fd >= 0) {
+        close(_unix_fd);
+        unlink(_unix_path.c_str());
+    }
+    if (_udp_fd >= 0)
+        close(_udp_fd);
+    if (_epoll_fd >= 0)
+        close(_epoll_fd);
+}
+
+// watch fd for input; data.ptr is the client, or the listening fd member
+static void epoll_add(int epfd, int fd, void *ptr)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = ptr;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+bool MS5611Server::listen_unix(const string &path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: path too long" << endl;
+        return false;
+    }
+    strcpy(addr.sun_path, path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unlink(path.c_str());
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(fd, 16) != 0) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: " << path << ": " << strerror(errno)
+                 << endl;
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+
+    _unix_fd = fd;
+    _unix_path = path;
+    epoll_add(_epoll_fd, fd, &_unix_fd);
+    return true;
+}
+
+bool MS5611Server::listen_udp(unsigned port)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: port " << port << ": "
+                 << strerror(errno) << endl;
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+
+    _udp_fd = fd;
+    epoll_add(_epoll_fd, fd, &_udp_fd);
+    return true;
+}
+
+unsigned MS5611Server::udp_port() const
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (_udp_fd < 0 ||
+        getsockname(_udp_fd, (struct sockaddr *)&addr, &len) != 0)
+        return 0;
+    return ntohs(addr.sin_port);
+}
+
+void MS5611Server::poll()
+{
+    struct epoll_event evs[16];
+    int n;
+    while ((n = epoll_wait(_epoll_fd, evs, 16, 0)) > 0) {
+        for (int i = 0; i < n; i++) {
+            void *ptr = evs[i].data.ptr;
+            if (ptr == &_unix_fd) {
+                _accept();
+            } else if (ptr == &_udp_fd) {
+                _read_udp();
+            } else {
+                Client &c = *(Client *)ptr;
+                if (evs[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                    _read(c);
+                if (!c.dead && (evs[i].events & EPOLLOUT))
+                    _flush(c);
+            }
+        }
+        _sweep();
+        if (n < 16)
+            break;
+    }
+}
+
+void MS5611Server::_accept()
+{
+    int fd;
+    while ((fd = accept4(_unix_fd, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        unique_ptr<Client> c(new Client());
+        c->fd = fd;
+        c->peer = _unix_path + ":" + to_string(fd);
+        c->stats.peer = c->peer;
+        epoll_add(_epoll_fd, fd, c.get());
+        _clients.push_back(move(c));
+    }
+}
+
+// stream client: subscriptions, or EOF
+void MS5611Server::_read(Client &c)
+{
+    for (;;) {
+        ssize_t n = recv(c.fd, c.rx + c.rx_len, sizeof(c.rx) - c.rx_len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (n <= 0) {
+            c.dead = true;
+            return;
+        }
+        c.rx_len += n;
+        if (c.rx_len == sizeof(c.rx)) {
+            MS5611Subscribe sub;
+            memcpy(&sub, c.rx, sizeof(sub));
+            c.rx_len = 0;
+            if (!sub_valid(sub)) {
+                c.dead = true;
+                return;
+            }
+            _subscribe(c, sub);
+        }
+    }
+}
+
+void MS5611Server::_read_udp()
+{
+    for (;;) {
+        MS5611Subscribe sub;
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        ssize_t n = recvfrom(_udp_fd, &sub, sizeof(sub), 0,
+                             (struct sockaddr *)&addr, &addr_len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return;
+        if (n != sizeof(sub) || !sub_valid(sub))
+            continue;
+
+        Client *c = NULL;
+        for (auto &p : _clients)
+            if (p->fd < 0 && p->addr.sin_port == addr.sin_port &&
+                p->addr.sin_addr.s_addr == addr.sin_addr.s_addr)
+                c = p.get();
+        if (c == NULL) {
+            if (sub.decimation == 0)
+                continue;
+            unique_ptr<Client> p(new Client());
+            p->fd = -1;
+            p->addr = addr;
+            p->peer = string("udp:") + to_string(ntohs(addr.sin_port));
+            p->stats.peer = p->peer;
+            c = p.get();
+            _clients.push_back(move(p));
+        }
+        c->seen_ns = MS5611Clock::raw_ns();
+        _subscribe(*c, sub);
+    }
+}
+
+void MS5611Server::_subscribe(Client &c, const MS5611Subscribe &sub)
+{
+    if (sub.decimation == 0) {
+        c.dead = true;
+        return;
+    }
+
+    // a renewal of the same subscription keeps the batch in progress
+    if (c.subscribed && sub.decimation == c.sub.decimation &&
+        sub.batch == c.sub.batch && sub.policy == c.sub.policy)
+        return;
+
+    if (!c.subscribed) {
+        c.start_ns = MS5611Clock::raw_ns();
+        c.subscribed = true;
+    }
+    c.sub = sub;
+    c.phase = 0;
+    c.batch.clear();
+    c.batch.reserve(sub.batch);
+    c.stats.decimation = sub.decimation;
+}
+
+void MS5611Server::publish(const MS5611Sample &sample)
+{
+    MS5611FrameRecord rec;
+    if (sample.real_offset_ns != 0)
+        rec.time_ns = sample.times.mid_ns + sample.real_offset_ns;
+    else
+        rec.time_ns = MS5611Clock::real_ns();
+    rec.temp_adc = sample.temp_adc;
+    rec.pres_adc = sample.pres_adc;
+    rec.temp_x100 = sample.temp_x100;
+    rec.pres_x100 = sample.pres_x100;
+
+    for (auto &p : _clients) {
+        Client &c = *p;
+        if (!c.subscribed || c.dead)
+            continue;
+        if (c.phase++ % c.sub.decimation != 0)
+            continue;
+        c.batch.push_back(rec);
+        if (c.batch.size() >= c.sub.batch)
+            _send_frame(c);
+    }
+
+    // UDP clients that stopped renewing
+    int64_t now = sample.times.pres_read_ns != 0 ? sample.times.pres_read_ns
+                                                 : MS5611Clock::raw_ns();
+    if (now >= _expire_ns) {
+        for (auto &p : _clients)
+            if (p->fd < 0 &&
+                now - p->seen_ns > int64_t(UDP_TIMEOUT_S) * 1000000000)
+                p->dead = true;
+        _expire_ns = now + 1000000000;
+    }
+
+    _sweep();
+}
+
+void MS5611Server::_send_frame(Client &c)
+{
+    size_t count = c.batch.size();
+    MS5611FrameHeader hdr;
+    hdr.magic = MS5611FrameHeader::MAGIC;
+    hdr.count = count;
+    hdr.record_size = sizeof(MS5611FrameRecord);
+    hdr.first = c.next;
+    hdr.dropped = c.stats.dropped;
+    c.next += count;
+
+    size_t rec_bytes = count * sizeof(MS5611FrameRecord);
+    vector<uint8_t> frame(sizeof(hdr) + rec_bytes);
+    memcpy(frame.data(), &hdr, sizeof(hdr));
+    memcpy(frame.data() + sizeof(hdr), c.batch.data(), rec_bytes);
+    c.batch.clear();
+
+    if (c.fd >= 0) {
+        _enqueue(c, frame, count);
+        return;
+    }
+
+    ssize_t n = sendto(_udp_fd, frame.data(), frame.size(), MSG_DONTWAIT,
+                       (struct sockaddr *)&c.addr, sizeof(c.addr));
+    if (n == ssize_t(frame.size())) {
+        c.stats.frames++;
+        c.stats.records += count;
+        c.stats.bytes += n;
+    } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+               errno != ENOBUFS) {
+        c.dead = true; // e.g. ECONNREFUSED: the client is gone
+    } else {
+        c.stats.dropped += count;
+    }
+}
+
+// queue a frame for a stream client, applying its policy if it doesn't
+// fit, and try to send
+void MS5611Server::_enqueue(Client &c, vector<uint8_t> &frame, size_t records)
+{
+    size_t rec_size = sizeof(MS5611FrameRecord);
+
+    if (c.queued + frame.size() > _queue_bytes) {
+        switch (c.sub.policy) {
+        case MS5611Subscribe::DROP_NEWEST:
+            c.stats.dropped += records;
+            return;
+        case MS5611Subscribe::DROP_OLDEST: {
+            // oldest frames first, but not one that is partly sent
+            size_t keep = c.sent > 0 ? 1 : 0;
+            while (c.queue.size() > keep &&
+                   c.queued + frame.size() > _queue_bytes) {
+                auto old = c.queue.begin() + keep;
+                c.queued -= old->size();
+                c.stats.dropped +=
+                    (old->size() - sizeof(MS5611FrameHeader)) / rec_size;
+                c.queue.erase(old);
+            }
+            if (c.queued + frame.size() > _queue_bytes) {
+                c.stats.dropped += records;
+                return;
+            }
+            break;
+        }
+        case MS5611Subscribe::DISCONNECT:
+        default:
+            c.dead = true;
+            return;
+        }
+    }
+
+    c.queued += frame.size();
+    c.queue.push_back(move(frame));
+    _flush(c);
+}
+
+void MS5611Server::_flush(Client &c)
+{
+    while (!c.queue.empty()) {
+        vector<uint8_t> &f = c.queue.front();
+        ssize_t n = send(c.fd, f.data() + c.sent, f.size() - c.sent,
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n < 0) {
+            c.dead = true;
+            return;
+        }
+        c.sent += n;
+        c.stats.bytes += n;
+        if (c.sent == f.size()) {
+            c.stats.frames++;
+            c.stats.records +=
+                (f.size() - sizeof(MS5611FrameHeader)) /
+                sizeof(MS5611FrameRecord);
+            c.queued -= f.size();
+            c.sent = 0;
+            c.queue.pop_front();
+        }
+    }
+    _watch_out(c, !c.queue.empty());
+}
+
+void MS5611Server::_watch_out(Client &c, bool on)
+{
+    if (c.want_out == on)
+        return;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | (on ? uint32_t(EPOLLOUT) : 0u);
+    ev.data.ptr = &c;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, c.fd, &ev);
+    c.want_out = on;
+}
+
+// remove dead clients
+void MS5611Server::_sweep()
+{
+    for (size_t i = 0; i < _clients.size();) {
+        Client &c = *_clients[i];
+        if (!c.dead) {
+            i++;
+            continue;
+        }
+        if (_verbosity > 1)
+            cout << FUNC_NAME << ": " << c.peer << " gone" << endl;
+        if (c.fd >= 0)
+            close(c.fd); // also removes it from the epoll set
+        _clients.erase(_clients.begin() + i);
+    }
+}
+
+void MS5611Server::stats(vector<ClientStats> &stats) const
+{
+    int64_t now = MS5611Clock::raw_ns();
+    stats.clear();
+    for (auto &p : _clients) {
+        if (!p->subscribed)
+            continue;
+        stats.push_back(p->stats);
+        stats.back().seconds = (now - p->start_ns) / 1e9;
+    }
+}
+
+MS5611Client::MS5611Client(int verbosity)
+    : _verbosity(verbosity), _fd(-1), _udp(false)
+{
+}
+
+MS5611Client::~MS5611Client()
+{
+    close();
+}
+
+bool MS5611Client::open_unix(const string &path, const MS5611Subscribe &sub)
+{
+    close();
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    _fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (_fd < 0 || connect(_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: " << path << ": " << strerror(errno)
+                 << endl;
+        close();
+        return false;
+    }
+    _udp = false;
+
+    return subscribe(sub);
+}
+
+bool MS5611Client::open_udp(unsigned port, const MS5611Subscribe &sub)
+{
+    close();
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    _fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (_fd < 0 || connect(_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: port " << port << ": "
+                 << strerror(errno) << endl;
+        close();
+        return false;
+    }
+    _udp = true;
+
+    return subscribe(sub);
+}
+
+bool MS5611Client::subscribe(const MS5611Subscribe &sub)
+{
+    if (send(_fd, &sub, sizeof(sub), MSG_NOSIGNAL) != sizeof(sub)) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: " << strerror(errno) << endl;
+        return false;
+    }
+    return true;
+}
+
+void MS5611Client::close()
+{
+    if (_fd >= 0)
+        ::close(_fd);
+    _fd = -1;
+}
+
+bool MS5611Client::_read_all(void *buf, size_t len)
+{
+    uint8_t *p = (uint8_t *)buf;
+    while (len > 0) {
+        ssize_t n = recv(_fd, p, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool MS5611Client::read(MS5611FrameHeader &hdr,
+                        vector<MS5611FrameRecord> &records)
+{
+    if (_udp) {
+        _buf.resize(frame_max);
+        ssize_t n;
+        do {
+            n = recv(_fd, _buf.data(), _buf.size(), 0);
+        } while (n < 0 && errno == EINTR);
+        if (n < ssize_t(sizeof(hdr)))
+            return false;
+        memcpy(&hdr, _buf.data(), sizeof(hdr));
+        if (hdr.magic != MS5611FrameHeader::MAGIC ||
+            hdr.record_size != sizeof(MS5611FrameRecord) ||
+            size_t(n) != sizeof(hdr) + hdr.count * sizeof(MS5611FrameRecord))
+            return false;
+        records.resize(hdr.count);
+        memcpy(records.data(), _buf.data() + sizeof(hdr),
+               hdr.count * sizeof(MS5611FrameRecord));
+        return true;
+    }
+
+    if (!_read_all(&hdr, sizeof(hdr)) ||
+        hdr.magic != MS5611FrameHeader::MAGIC ||
+        hdr.record_size != sizeof(MS5611FrameRecord))
+        return false;
+    records.resize(hdr.count);
+    return _read_all(records.data(), hdr.count * sizeof(MS5611FrameRecord));
+}
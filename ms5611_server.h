@@ -0,0 +1,185 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ms5611_sample.h"
+
+// sample stream server for local subscribers
+//
+// Clients connect to a Unix-domain stream socket, or send datagrams to a
+// UDP port on loopback, with an MS5611Subscribe giving their decimation,
+// how many samples to batch per frame, and what to do when they fall
+// behind. Each client then gets MS5611Frames: a header and batch records.
+// On a stream socket frames follow each other; over UDP each datagram is
+// one frame, and a client must resend its subscription at least every
+// UDP_TIMEOUT_S seconds or it is dropped.
+//
+// publish() never blocks. Stream clients have a bounded queue of frames
+// not yet accepted by the socket; when a frame doesn't fit, the client's
+// policy drops it (DROP_NEWEST), drops queued frames that haven't started
+// going out (DROP_OLDEST), or disconnects the client (DISCONNECT). UDP
+// frames the socket can't take right away are dropped. Dropped records
+// are counted per client and reported in every frame header.
+//
+// All values are in host byte order; the server is for the local machine.
+
+struct MS5611Subscribe {
+    enum : uint32_t { MAGIC = 0x3153354d }; // "M5S1"
+    enum Policy : uint32_t { DROP_NEWEST = 0, DROP_OLDEST = 1, DISCONNECT = 2 };
+    enum { BATCH_MAX = 256 };
+
+    uint32_t magic;
+    uint16_t decimation; // every Nth sample; 0 to unsubscribe
+    uint16_t batch;      // records per frame, 1..BATCH_MAX
+    uint32_t policy;
+    uint32_t reserved;
+};
+
+struct MS5611FrameHeader {
+    enum : uint32_t { MAGIC = 0x3146354d }; // "M5F1"
+
+    uint32_t magic;
+    uint16_t count;       // records following
+    uint16_t record_size; // sizeof(MS5611FrameRecord)
+    uint64_t first;       // client's index of the first record
+    uint64_t dropped;     // records dropped for this client so far
+};
+
+struct MS5611FrameRecord {
+    int64_t time_ns; // CLOCK_REALTIME, middle of the pressure conversion
+    uint32_t temp_adc;
+    uint32_t pres_adc;
+    int32_t temp_x100; // INT32_MIN if out of range
+    int32_t pres_x100;
+};
+
+class MS5611Server
+{
+public:
+    static const unsigned UDP_TIMEOUT_S = 10;
+
+    struct ClientStats {
+        std::string peer;
+        unsigned decimation;
+        uint64_t frames;
+        uint64_t records;
+        uint64_t bytes;
+        uint64_t dropped; // records
+        double seconds;   // since subscribing
+    };
+
+    // verbosity is as for MS5611; queue_bytes bounds each stream client's
+    // unsent frames
+    MS5611Server(int verbosity = 1, size_t queue_bytes = 65536);
+
+    virtual ~MS5611Server();
+
+    // remove any socket at path first
+    bool listen_unix(const std::string &path);
+
+    // 127.0.0.1 only; port 0 picks a free one (see udp_port())
+    bool listen_udp(unsigned port);
+
+    // bound UDP port, 0 if not listening
+    unsigned udp_port() const;
+
+    // readable when poll() has something to do, for poll/epoll
+    int fd() const
+    {
+        return _epoll_fd;
+    }
+
+    // accept clients, read subscriptions and send queued frames; does not
+    // block
+    void poll();
+
+    void publish(const MS5611Sample &sample);
+
+    size_t clients() const
+    {
+        return _clients.size();
+    }
+
+    void stats(std::vector<ClientStats> &stats) const;
+
+private:
+    struct Client {
+        int fd; // -1 for UDP
+        struct sockaddr_in addr; // UDP
+        std::string peer;
+        bool subscribed;
+        bool dead;
+        MS5611Subscribe sub;
+        unsigned phase; // for decimation
+        uint64_t next;  // index of the next record
+        std::vector<MS5611FrameRecord> batch;
+        std::deque<std::vector<uint8_t>> queue; // stream only
+        size_t queued; // bytes in queue
+        size_t sent;   // bytes of queue.front() already sent
+        bool want_out; // EPOLLOUT registered
+        uint8_t rx[sizeof(MS5611Subscribe)];
+        size_t rx_len;
+        int64_t start_ns;
+        int64_t seen_ns; // last UDP subscription
+        ClientStats stats;
+    };
+
+    int _verbosity;
+    size_t _queue_bytes;
+    int _epoll_fd;
+    int _unix_fd;
+    std::string _unix_path;
+    int _udp_fd;
+    std::vector<std::unique_ptr<Client>> _clients;
+    int64_t _expire_ns; // next check for silent UDP clients
+
+    void _accept();
+    void _read(Client &c);
+    void _read_udp();
+    void _subscribe(Client &c, const MS5611Subscribe &sub);
+    void _send_frame(Client &c);
+    void _enqueue(Client &c, std::vector<uint8_t> &frame, size_t records);
+    void _flush(Client &c);
+    void _watch_out(Client &c, bool on);
+    void _sweep();
+};
+
+// subscriber side of MS5611Server
+class MS5611Client
+{
+public:
+    // verbosity is as for MS5611
+    MS5611Client(int verbosity = 1);
+
+    virtual ~MS5611Client();
+
+    bool open_unix(const std::string &path, const MS5611Subscribe &sub);
+
+    bool open_udp(unsigned port, const MS5611Subscribe &sub);
+
+    // change the subscription, or (UDP) renew it
+    bool subscribe(const MS5611Subscribe &sub);
+
+    void close();
+
+    int fd() const
+    {
+        return _fd;
+    }
+
+    // wait for the next frame
+    bool read(MS5611FrameHeader &hdr, std::vector<MS5611FrameRecord> &records);
+
+private:
+    int _verbosity;
+    int _fd;
+    bool _udp;
+    std::vector<uint8_t> _buf;
+
+    bool _read_all(void *buf, size_t len);
+};
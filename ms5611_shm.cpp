@@ -0,0 +1,267 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "ms5611_shm.h"
+
+using namespace std;
+
+// correct for gcc and a few other (but not all) compilers
+#define FUNC_NAME __PRETTY_FUNCTION__
+
+static_assert(sizeof(MS5611Sample) % 8 == 0,
+              "MS5611Sample must be a whole number of words");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+              "shared memory needs lock-free 64-bit atomics");
+
+static const char shm_magic[8] = "MS5611S";
+
+// seqlock write: seq goes odd, the sample is stored, seq goes even
+static void slot_write(MS5611ShmSlot &slot, uint64_t n,
+                       const MS5611Sample &sample)
+{
+    uint64_t words[MS5611ShmSlot::WORDS];
+    memcpy(words, &sample, sizeof(words));
+
+    slot.seq.store(2 * n + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (int i = 0; i < MS5611ShmSlot::WORDS; i++)
+        slot.words[i].store(words[i], memory_order_relaxed);
+    slot.seq.store(2 * n + 2, memory_order_release);
+}
+
+// seqlock read: false if the slot was being written, or doesn't hold
+// sample n (any sample if n is UINT64_MAX); retries while it is being
+// written only if it may still end up holding sample n
+//
+// A write takes a few stores, so a sequence that stays at the same odd
+// value for stuck_tries looks means the writer stopped in the middle
+// (e.g. it was killed); that is false too, rather than a spin forever.
+// The reader yields while it waits, in case the writer was only preempted.
+static const unsigned stuck_tries = 1000;
+
+static bool slot_read(const MS5611ShmSlot &slot, uint64_t n,
+                      MS5611Sample &sample, uint64_t *got_n = NULL)
+{
+    uint64_t words[MS5611ShmSlot::WORDS];
+    uint64_t stuck_seq = 0;
+    unsigned stuck = 0;
+    for (;;) {
+        uint64_t seq = slot.seq.load(memory_order_acquire);
+        if (seq == 0)
+            return false; // never written
+        if (seq & 1) {
+            if (n != UINT64_MAX && seq > 2 * n + 1)
+                return false; // overwriting n already
+            if (seq != stuck_seq) {
+                stuck_seq = seq;
+                stuck = 0;
+            } else if (++stuck >= stuck_tries) {
+                return false;
+            }
+            this_thread::yield();
+            continue;
+        }
+        if (n != UINT64_MAX && seq != 2 * n + 2)
+            return false;
+
+        for (int i = 0; i < MS5611ShmSlot::WORDS; i++)
+            words[i] = slot.words[i].load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (slot.seq.load(memory_order_relaxed) != seq)
+            continue;
+
+        memcpy(&sample, words, sizeof(words));
+        if (got_n != NULL)
+            *got_n = seq / 2 - 1;
+        return true;
+    }
+}
+
+static size_t shm_size(uint64_t history)
+{
+    return sizeof(MS5611ShmHeader) + history * sizeof(MS5611ShmSlot);
+}
+
+MS5611ShmWriter::MS5611ShmWriter(int verbosity)
+    : _verbosity(verbosity), _hdr(NULL), _slots(NULL), _size(0), _mask(0)
+{
+}
+
+MS5611ShmWriter::~MS5611ShmWriter()
+{
+    close();
+}
+
+bool MS5611ShmWriter::open(const string &name, const uint16_t prom[8],
+                           unsigned history)
+{
+    close();
+
+    if (history < 2 || (history & (history - 1)) != 0) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: history " << history
+                 << " is not a power of two" << endl;
+        return false;
+    }
+
+    // a new segment, so readers of an old one keep what they mapped
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: creating " << name << ": "
+                 << strerror(errno) << endl;
+        return false;
+    }
+
+    size_t size = shm_size(history);
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: mapping " << name << endl;
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    // ftruncate zeroed it: every slot has sequence 0 (never written)
+    _name = name;
+    _size = size;
+    _hdr = (MS5611ShmHeader *)map;
+    _slots = (MS5611ShmSlot *)(_hdr + 1);
+    _mask = history - 1;
+
+    memcpy(_hdr->magic, shm_magic, sizeof(_hdr->magic));
+    _hdr->history = history;
+    _hdr->sample_size = sizeof(MS5611Sample);
+    memcpy(_hdr->prom, prom, sizeof(_hdr->prom));
+    _hdr->version.store(MS5611ShmHeader::VERSION, memory_order_release);
+
+    return true;
+}
+
+void MS5611ShmWriter::close()
+{
+    if (_hdr == NULL)
+        return;
+
+    munmap(_hdr, _size);
+    shm_unlink(_name.c_str());
+    _hdr = NULL;
+    _slots = NULL;
+}
+
+void MS5611ShmWriter::publish(const MS5611Sample &sample)
+{
+    uint64_t n = _hdr->count.load(memory_order_relaxed);
+    slot_write(_slots[n & _mask], n, sample);
+    slot_write(_hdr->latest, n, sample);
+    _hdr->count.store(n + 1, memory_order_release);
+}
+
+MS5611ShmReader::MS5611ShmReader(int verbosity)
+    : _verbosity(verbosity), _hdr(NULL), _slots(NULL), _size(0), _mask(0),
+      _lost(0)
+{
+}
+
+MS5611ShmReader::~MS5611ShmReader()
+{
+    close();
+}
+
+bool MS5611ShmReader::open(const string &name)
+{
+    close();
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: opening " << name << ": "
+                 << strerror(errno) << endl;
+        return false;
+    }
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(MS5611ShmHeader))
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: mapping " << name << endl;
+        return false;
+    }
+
+    const MS5611ShmHeader *hdr = (const MS5611ShmHeader *)map;
+    if (memcmp(hdr->magic, shm_magic, sizeof(hdr->magic)) != 0 ||
+        hdr->version.load(memory_order_acquire) != MS5611ShmHeader::VERSION ||
+        hdr->sample_size != sizeof(MS5611Sample) || hdr->history < 2 ||
+        (hdr->history & (hdr->history - 1)) != 0 ||
+        size_t(st.st_size) < shm_size(hdr->history)) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: " << name
+                 << " is not a compatible sample segment" << endl;
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    _hdr = hdr;
+    _slots = (const MS5611ShmSlot *)(hdr + 1);
+    _size = st.st_size;
+    _mask = hdr->history - 1;
+    _lost = 0;
+
+    return true;
+}
+
+void MS5611ShmReader::close()
+{
+    if (_hdr == NULL)
+        return;
+
+    munmap((void *)_hdr, _size);
+    _hdr = NULL;
+    _slots = NULL;
+}
+
+bool MS5611ShmReader::latest(MS5611Sample &sample, uint64_t *n) const
+{
+    return slot_read(_hdr->latest, UINT64_MAX, sample, n);
+}
+
+size_t MS5611ShmReader::read(uint64_t &next, MS5611Sample *samples, size_t n)
+{
+    uint64_t count = _hdr->count.load(memory_order_acquire);
+    if (count > next && count - next > _mask + 1) {
+        _lost += count - (_mask + 1) - next;
+        next = count - (_mask + 1);
+    }
+
+    size_t got = 0;
+    while (got < n && next < count) {
+        if (slot_read(_slots[next & _mask], next, samples[got]))
+            got++;
+        else
+            _lost++; // overwritten since count was read
+        next++;
+    }
+    return got;
+}
+
+size_t MS5611ShmReader::recent(MS5611Sample *samples, size_t n)
+{
+    uint64_t count = _hdr->count.load(memory_order_acquire);
+    uint64_t next = count > n ? count - n : 0;
+    return read(next, samples, n);
+}
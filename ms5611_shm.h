@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "ms5611_sample.h"
+
+// shared-memory publishing of samples
+//
+// The writer (e.g. ms5611_log -S) creates a POSIX shared memory segment
+// holding the PROM, a "latest sample" slot and a history ring of the most
+// recent samples. Any number of readers in other processes map it
+// read-only. Every slot is a seqlock: the writer bumps the slot's sequence
+// to odd, stores the sample, and bumps it to even; a reader copies the
+// sample and retries if the sequence was odd or changed meanwhile. The
+// writer never waits for readers, and a read is a few loads from shared
+// cache lines, with no locks and no system calls.
+//
+// Sample n (counting from 0) is in history slot n % history, and a slot
+// holding sample n has sequence 2n + 2, so readers can tell when a slot
+// they want has been overwritten. Sample words are copied as relaxed
+// atomics, so a torn read is detected rather than undefined.
+
+struct MS5611ShmSlot {
+    enum { WORDS = sizeof(MS5611Sample) / 8 };
+
+    alignas(64) std::atomic<uint64_t> seq;
+    std::atomic<uint64_t> words[WORDS];
+};
+
+struct MS5611ShmHeader {
+    enum { VERSION = 1 };
+
+    char magic[8]; // "MS5611S"
+    std::atomic<uint32_t> version; // stored last, when the rest is valid
+    uint32_t history; // slots in the ring, a power of two
+    uint32_t sample_size; // sizeof(MS5611Sample)
+    uint32_t reserved;
+    uint16_t prom[8];
+    alignas(64) std::atomic<uint64_t> count; // samples published
+    MS5611ShmSlot latest;
+    // history slots follow
+};
+
+class MS5611ShmWriter
+{
+public:
+    // verbosity is as for MS5611
+    MS5611ShmWriter(int verbosity = 1);
+
+    // unlinks the segment
+    virtual ~MS5611ShmWriter();
+
+    // create (or replace) the segment; name is as for shm_open, e.g.
+    // "/ms5611", and history must be a power of two
+    bool open(const std::string &name, const uint16_t prom[8],
+              unsigned history = 1024);
+
+    void close();
+
+    bool is_open() const
+    {
+        return _hdr != NULL;
+    }
+
+    void publish(const MS5611Sample &sample);
+
+private:
+    int _verbosity;
+    std::string _name;
+    MS5611ShmHeader *_hdr;
+    MS5611ShmSlot *_slots;
+    size_t _size;
+    uint64_t _mask;
+};
+
+class MS5611ShmReader
+{
+public:
+    // verbosity is as for MS5611
+    MS5611ShmReader(int verbosity = 1);
+
+    virtual ~MS5611ShmReader();
+
+    // map an existing segment
+    bool open(const std::string &name);
+
+    void close();
+
+    const uint16_t *prom() const
+    {
+        return _hdr->prom;
+    }
+
+    unsigned history() const
+    {
+        return unsigned(_mask + 1);
+    }
+
+    // samples published so far
+    uint64_t count() const
+    {
+        return _hdr->count.load(std::memory_order_acquire);
+    }
+
+    // newest sample; false if there is none yet, or if the writer stopped
+    // in the middle of storing it (it died) and the slot stays unreadable.
+    // n, if given, is set to its index.
+    bool latest(MS5611Sample &sample, uint64_t *n = NULL) const;
+
+    // samples from index next on, oldest first; advances next
+    //
+    // Samples that were overwritten before they could be read, or left
+    // half-written by a writer that died, are skipped and counted in
+    // lost().
+    size_t read(uint64_t &next, MS5611Sample *samples, size_t n);
+
+    // the newest n (or fewer) samples, oldest first
+    size_t recent(MS5611Sample *samples, size_t n);
+
+    uint64_t lost() const
+    {
+        return _lost;
+    }
+
+private:
+    int _verbosity;
+    const MS5611ShmHeader *_hdr;
+    const MS5611ShmSlot *_slots;
+    size_t _size;
+    uint64_t _mask;
+    uint64_t _lost;
+};
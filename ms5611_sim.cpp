@@ -0,0 +1,187 @@
+#include <linux/spi/spidev.h>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include "ms5611_sim.h"
+
+using namespace std;
+
+MS5611Sim::MS5611Sim()
+    : _temp_adc(8569150), _pres_adc(9085466), _noise(0), _rand(1),
+      _realtime(true), _latency_usec(0), _converting(false), _conv_result(0),
+      _adc(0), _cmd(0), _byte(-1), _out(0), _messages(0), _conversions(0),
+      _early_reads(0)
+{
+    // data sheet example values
+    const uint16_t prom[8] = {0x0000, 40127, 36924, 23317,
+                              23282,  33464, 28312, 0x0000};
+    set_prom(prom);
+    memset(_faults, 0, sizeof(_faults));
+    _reset_done = _now();
+    _conv_done = _now();
+}
+
+void MS5611Sim::set_prom(const uint16_t prom[8])
+{
+    memcpy(_prom, prom, sizeof(_prom));
+    _prom[7] = (_prom[7] & 0xfff0) | MS5611::crc4(_prom);
+}
+
+void MS5611Sim::get_prom(uint16_t prom[8]) const
+{
+    memcpy(prom, _prom, sizeof(_prom));
+}
+
+// maximum conversion time from the data sheet
+// cmd must be a valid convert command
+unsigned MS5611Sim::conv_usec(uint8_t cmd)
+{
+    static const unsigned usec[] = {600, 1170, 2280, 4540, 9040};
+    return usec[(cmd >> 1) & 0x07];
+}
+
+MS5611Sim::Clock::time_point MS5611Sim::_now() const
+{
+    return Clock::now();
+}
+
+// sleep, or when not in real time, skip ahead
+//
+// Skipping moves the chip's deadlines back instead of sleeping, so
+// chip-internal timing (e.g. reset) still behaves as seen from the SPI side.
+void MS5611Sim::_wait(unsigned usec)
+{
+    if (usec == 0)
+        return;
+
+    if (_realtime) {
+        this_thread::sleep_for(chrono::microseconds(usec));
+    } else {
+        chrono::microseconds d(usec);
+        _reset_done -= d;
+        _conv_done -= d;
+    }
+}
+
+// check for (and consume) an injected fault
+bool MS5611Sim::_fault(Fault fault)
+{
+    if (_faults[fault] == 0)
+        return false;
+    _faults[fault]--;
+    return true;
+}
+
+// complete conversion if its time is up
+void MS5611Sim::_update()
+{
+    if (_converting && _now() >= _conv_done) {
+        _adc = _conv_result;
+        _converting = false;
+    }
+}
+
+// clock one byte into (and out of) the chip
+uint8_t MS5611Sim::_clock(uint8_t tx)
+{
+    _update();
+
+    if (_byte < 0) {
+        // first byte of a frame is the command
+        _byte = 0;
+        _cmd = tx;
+        _out = 0;
+        if (_now() < _reset_done) {
+            // resetting; command ignored
+            _cmd = 0xff;
+        } else if (tx == 0x1e) {
+            // reset
+            _reset_done = _now() + chrono::microseconds(2800);
+            if (_fault(FAULT_RESET))
+                _cmd = 0xfe; // SDO stays low for the whole frame
+            _converting = false;
+            _adc = 0;
+        } else if (tx == 0x00) {
+            // adc read; a read during a conversion returns zero
+            if (_converting)
+                _early_reads++;
+            else
+                _out = _adc;
+            if (_fault(FAULT_ADC_ZERO))
+                _out = 0;
+            _adc = 0;
+        } else if ((tx & 0xf1) == 0xa0) {
+            // prom read, 16 bits left-justified in 24
+            int n = (tx >> 1) & 0x07;
+            uint16_t word = _prom[n];
+            if (n == 1 && _fault(FAULT_PROM))
+                word ^= 0x0100;
+            _out = uint32_t(word) << 8;
+        } else if ((tx & 0xe1) == 0x40 && (tx & 0x0e) <= 0x08) {
+            // start conversion; ignored if one is in progress
+            if (!_converting) {
+                uint32_t adc = (tx & 0x10) ? _pres_adc : _temp_adc;
+                if (_noise != 0) {
+                    _rand = _rand * 1103515245 + 12345;
+                    adc += (_rand >> 8) % (2 * _noise + 1);
+                    adc -= _noise;
+                }
+                _conv_result = adc & 0x00ffffff;
+                _conv_done = _now();
+                if (_realtime)
+                    _conv_done += chrono::microseconds(conv_usec(tx));
+                _converting = true;
+                _adc = 0;
+                _conversions++;
+            }
+        }
+        return 0;
+    }
+
+    _byte++;
+
+    if (_cmd == 0x1e)
+        // SDO is low while resetting, high when done
+        return _now() < _reset_done ? 0x00 : 0xff;
+
+    if (_cmd == 0xfe)
+        return 0x00;
+
+    uint8_t rx = _out >> 16;
+    _out = (_out << 8) & 0x00ffffff;
+    return rx;
+}
+
+// chip select deasserted
+void MS5611Sim::_deselect()
+{
+    _byte = -1;
+}
+
+bool MS5611Sim::transfer(struct spi_ioc_transfer *xfer, unsigned n)
+{
+    _messages++;
+
+    if (_fault(FAULT_XFER))
+        return false;
+
+    _wait(_latency_usec);
+
+    for (unsigned i = 0; i < n; i++) {
+        const uint8_t *tx = (const uint8_t *)uintptr_t(xfer[i].tx_buf);
+        uint8_t *rx = (uint8_t *)uintptr_t(xfer[i].rx_buf);
+        for (unsigned b = 0; b < xfer[i].len; b++) {
+            uint8_t r = _clock(tx != NULL ? tx[b] : 0x00);
+            if (rx != NULL)
+                rx[b] = r;
+        }
+        _wait(xfer[i].delay_usecs);
+        if (xfer[i].cs_change && i + 1 < n)
+            _deselect();
+    }
+
+    _deselect();
+
+    return true;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include "ms5611.h"
+
+// simulated MS5611 chip
+//
+// Decodes the command bytes in each SPI message the way the chip does:
+//   0x1e       reset (SDO low for 2.8 msec, then high)
+//   0xa0..0xae PROM read (2 bytes)
+//   0x40..0x58 start conversion (temperature or pressure, OSR)
+//   0x00       ADC read (3 bytes; zero if no conversion is complete)
+//
+// By default, time is real: delay_usecs in transfers and injected latency
+// are slept, and conversions take the data sheet's maximum conversion time.
+// With set_realtime(false), nothing sleeps and conversions complete
+// immediately, which is useful for throughput measurements.
+class MS5611Sim : public MS5611::Transport
+{
+public:
+    enum Fault {
+        FAULT_XFER = 0, // transfer() fails
+        FAULT_RESET,    // chip never comes out of reset
+        FAULT_PROM,     // a bit in PROM word 1 is flipped when read
+        FAULT_ADC_ZERO, // ADC read returns zero
+        FAULT_COUNT
+    };
+
+    // PROM and ADC values are the data sheet's example
+    // (20.07 C, 1000.09 mbar)
+    MS5611Sim();
+
+    virtual ~MS5611Sim()
+    {
+    }
+
+    // set PROM contents; the CRC in prom[7] is calculated
+    void set_prom(const uint16_t prom[8]);
+
+    void get_prom(uint16_t prom[8]) const;
+
+    // raw values returned by temperature and pressure conversions
+    void set_adc(uint32_t temp_adc, uint32_t pres_adc)
+    {
+        _temp_adc = temp_adc;
+        _pres_adc = pres_adc;
+    }
+
+    // add uniform noise of +/- lsb to each conversion result
+    void set_noise(uint32_t lsb)
+    {
+        _noise = lsb;
+    }
+
+    void set_realtime(bool realtime)
+    {
+        _realtime = realtime;
+    }
+
+    // added to the duration of each transfer() call
+    void set_latency(unsigned usec)
+    {
+        _latency_usec = usec;
+    }
+
+    // make the next count occurrences of an operation fail
+    void inject_fault(Fault fault, unsigned count = 1)
+    {
+        _faults[fault] = count;
+    }
+
+    // maximum conversion time from the data sheet
+    static unsigned conv_usec(uint8_t cmd);
+
+    unsigned long messages() const
+    {
+        return _messages;
+    }
+
+    unsigned long conversions() const
+    {
+        return _conversions;
+    }
+
+    // ADC reads issued while a conversion was still in progress
+    unsigned long early_reads() const
+    {
+        return _early_reads;
+    }
+
+    virtual bool transfer(struct spi_ioc_transfer *xfer, unsigned n);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    uint16_t _prom[8];
+    uint32_t _temp_adc;
+    uint32_t _pres_adc;
+    uint32_t _noise;
+    uint32_t _rand;
+    bool _realtime;
+    unsigned _latency_usec;
+    unsigned _faults[FAULT_COUNT];
+
+    // chip state
+    Clock::time_point _reset_done;
+    Clock::time_point _conv_done;
+    bool _converting;
+    uint32_t _conv_result;
+    uint32_t _adc; // result of last completed conversion, zero after read
+    uint8_t _cmd;  // command byte of current chip select frame
+    int _byte;     // byte number in current frame, -1 if no frame
+    uint32_t _out; // data being shifted out
+
+    unsigned long _messages;
+    unsigned long _conversions;
+    unsigned long _early_reads;
+
+    Clock::time_point _now() const;
+    void _wait(unsigned usec);
+    bool _fault(Fault fault);
+    void _update();
+    uint8_t _clock(uint8_t tx);
+    void _deselect();
+};
@@ -0,0 +1,71 @@
+#include <linux/spi/spidev.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include "ms5611_spidev.h"
+
+using namespace std;
+
+// correct for gcc and a few other (but not all) compilers
+#define FUNC_NAME __PRETTY_FUNCTION__
+
+// open spi device and configure it
+MS5611Spidev::MS5611Spidev(const string &dev_name, unsigned spi_clk,
+                           int verbosity)
+    : _dev_name(dev_name), _fd(-1), _verbosity(verbosity)
+{
+    if (spi_clk == 0 || spi_clk > 20000000) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: spi_clk=" << spi_clk << " invalid"
+                 << endl;
+        return;
+    }
+
+    // open spi device
+    _fd = open(_dev_name.c_str(), O_RDWR);
+    if (_fd < 0) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: opening " << _dev_name << endl;
+        return;
+    }
+
+    // Configure spi bus. The chip should work in either mode 0 or mode 3;
+    // most of the waveforms in the data sheet look like mode 0 so use that.
+    uint8_t mode = SPI_MODE_0;
+    uint8_t bits = 8;
+    uint32_t clk = spi_clk;
+    if (ioctl(_fd, SPI_IOC_WR_MODE, &mode) < 0 ||
+        ioctl(_fd, SPI_IOC_RD_MODE, &mode) < 0 ||
+        ioctl(_fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0 ||
+        ioctl(_fd, SPI_IOC_RD_BITS_PER_WORD, &bits) < 0 ||
+        ioctl(_fd, SPI_IOC_WR_MAX_SPEED_HZ, &clk) < 0 ||
+        ioctl(_fd, SPI_IOC_RD_MAX_SPEED_HZ, &clk) < 0) {
+        if (_verbosity > 0)
+            cerr << FUNC_NAME << " ERROR: initializing " << _dev_name << endl;
+        close(_fd);
+        _fd = -1;
+        return;
+    }
+}
+
+MS5611Spidev::~MS5611Spidev()
+{
+    if (_fd < 0)
+        return;
+
+    close(_fd);
+    _fd = -1;
+}
+
+bool MS5611Spidev::transfer(struct spi_ioc_transfer *xfer, unsigned n)
+{
+    if (_fd < 0)
+        return false;
+
+    return ioctl(_fd, SPI_IOC_MESSAGE(n), xfer) >= 0;
+}
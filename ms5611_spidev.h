@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include "ms5611.h"
+
+// MS5611 transport over a Linux spidev device
+class MS5611Spidev : public MS5611::Transport
+{
+public:
+    // verbosity is as for MS5611
+    MS5611Spidev(const std::string &dev_name, unsigned spi_clk = 1000000,
+                 int verbosity = 1);
+
+    virtual ~MS5611Spidev();
+
+    bool is_open() const
+    {
+        return _fd >= 0;
+    }
+
+    virtual bool transfer(struct spi_ioc_transfer *xfer, unsigned n);
+
+private:
+    std::string _dev_name;
+    int _fd;
+    int _verbosity;
+};
@@ -0,0 +1,124 @@
+#include <atomic>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include "ms5611_stats.h"
+
+using namespace std;
+
+uint64_t MS5611Stats::Hist::percentile_ns(double p) const
+{
+    if (count == 0)
+        return 0;
+    uint64_t want = uint64_t(count * p / 100.0 + 0.5);
+    if (want < 1)
+        want = 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < BUCKETS; b++) {
+        seen += bucket[b];
+        if (seen >= want) {
+            uint64_t edge = b == 0 ? 0 : (uint64_t(1) << b) - 1;
+            return edge < max_ns ? edge : max_ns;
+        }
+    }
+    return max_ns;
+}
+
+const char *MS5611Stats::op_name(int op)
+{
+    static const char *names[OPS] = {"reset",      "prom",
+                                     "start_convert", "read_adc",
+                                     "do_convert", "do_convert_pair",
+                                     "do_convert_burst", "read_adc_convert",
+                                     "wakeup"};
+    return op >= 0 && op < OPS ? names[op] : "?";
+}
+
+void MS5611Stats::print(ostream &os) const
+{
+    static const char *osr_names[OSRS] = {"256",  "512",  "1024",
+                                          "2048", "4096", "-"};
+
+    // leave the caller's formatting as it was
+    ios::fmtflags flags = os.flags();
+    streamsize precision = os.precision();
+
+    os << "spi_clk " << spi_clk << endl;
+    os << "startup_us " << startup_ns / 1000 << (warm ? " warm" : " cold")
+       << endl;
+    os << "op               osr        count   errors    mean_us     p50_us"
+          "     p99_us     max_us"
+       << endl;
+    for (int op = 0; op < OPS; op++) {
+        for (int osr = 0; osr < OSRS; osr++) {
+            const Hist &h = hist[op][osr];
+            if (h.count == 0)
+                continue;
+            os << left << setw(16) << op_name(op) << " " << setw(4)
+               << osr_names[osr] << right << " " << setw(12) << h.count << " "
+               << setw(8) << h.errors << fixed << setprecision(1) << " "
+               << setw(10) << h.sum_ns / 1000.0 / h.count << " " << setw(10)
+               << h.percentile_ns(50) / 1000.0 << " " << setw(10)
+               << h.percentile_ns(99) / 1000.0 << " " << setw(10)
+               << h.max_ns / 1000.0 << endl;
+        }
+    }
+    os.flags(flags);
+    os.precision(precision);
+    os << "crc_errors " << crc_errors << endl;
+    os << "range_errors " << range_errors << endl;
+    os << "zero_adc " << zero_adc << endl;
+}
+
+void MS5611HistCounter::reset()
+{
+    _count = 0;
+    _errors = 0;
+    _sum_ns = 0;
+    _max_ns = 0;
+    for (auto &b : _bucket)
+        b = 0;
+}
+
+void MS5611HistCounter::snapshot(MS5611Stats::Hist &hist) const
+{
+    const memory_order relaxed = memory_order_relaxed;
+
+    hist.count = _count.load(relaxed);
+    hist.errors = _errors.load(relaxed);
+    hist.sum_ns = _sum_ns.load(relaxed);
+    hist.max_ns = _max_ns.load(relaxed);
+    for (int b = 0; b < MS5611Stats::BUCKETS; b++)
+        hist.bucket[b] = _bucket[b].load(relaxed);
+}
+
+MS5611StatsCounters::MS5611StatsCounters()
+    : _spi_clk(0), _startup_ns(0), _warm(false)
+{
+    reset();
+}
+
+void MS5611StatsCounters::reset()
+{
+    for (auto &per_op : _hist)
+        for (MS5611HistCounter &h : per_op)
+            h.reset();
+    _crc_errors = 0;
+    _range_errors = 0;
+    _zero_adc = 0;
+}
+
+void MS5611StatsCounters::snapshot(MS5611Stats &stats) const
+{
+    const memory_order relaxed = memory_order_relaxed;
+
+    stats.spi_clk = _spi_clk;
+    stats.startup_ns = _startup_ns;
+    stats.warm = _warm;
+    for (int op = 0; op < MS5611Stats::OPS; op++)
+        for (int osr = 0; osr < MS5611Stats::OSRS; osr++)
+            _hist[op][osr].snapshot(stats.hist[op][osr]);
+    stats.crc_errors = _crc_errors.load(relaxed);
+    stats.range_errors = _range_errors.load(relaxed);
+    stats.zero_adc = _zero_adc.load(relaxed);
+}
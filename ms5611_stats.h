@@ -0,0 +1,146 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+
+// MS5611 instrumentation
+//
+// When built with MS5611_STATS defined, MS5611 times every SPI message and
+// keeps a log2 latency histogram per operation and OSR, along with error
+// counters; MS5611::get_stats() takes a snapshot. Without MS5611_STATS
+// none of this is compiled into MS5611. The setting changes MS5611's
+// layout, so everything using ms5611.h must be built with the same one.
+struct MS5611Stats {
+    enum Op {
+        RESET,
+        PROM,             // all eight words, one message
+        START_CONVERT,
+        READ_ADC,
+        DO_CONVERT,       // convert, wait, read
+        DO_CONVERT_PAIR,  // temperature and pressure, one message
+        DO_CONVERT_BURST, // pressure conversions, one message
+        READ_ADC_CONVERT, // streaming: read, start next
+        WAKEUP,           // streaming: lateness past the conversion deadline
+        OPS
+    };
+
+    // OSR256..OSR4096 are 0..4; OSR_NONE for operations without one
+    static const int OSR_NONE = 5;
+    static const int OSRS = 6;
+
+    // bucket 0 counts 0 ns, bucket b counts [2^(b-1), 2^b) ns
+    static const int BUCKETS = 32;
+
+    struct Hist {
+        uint64_t count; // including errors
+        uint64_t errors;
+        uint64_t sum_ns;
+        uint64_t max_ns;
+        uint64_t bucket[BUCKETS];
+
+        // upper edge of the bucket holding the p'th percentile (0..100),
+        // or max_ns if that is less
+        uint64_t percentile_ns(double p) const;
+    };
+
+    unsigned spi_clk; // 0 if unknown (caller's transport)
+    uint64_t startup_ns; // construction: attach, PROM read and check
+    bool warm;           // attached without a reset (MS5611CalCache)
+    Hist hist[OPS][OSRS];
+    uint64_t crc_errors;
+    uint64_t range_errors; // temperature out of range in get_pressure
+    uint64_t zero_adc;     // ADC reads of 0 (read during a conversion)
+
+    static const char *op_name(int op);
+
+    // one line per non-empty histogram, then the counters
+    void print(std::ostream &os) const;
+};
+
+// live histogram behind MS5611Stats::Hist; updates are relaxed atomics, so
+// a snapshot can be taken from any thread without locking
+class MS5611HistCounter
+{
+public:
+    MS5611HistCounter()
+    {
+        reset();
+    }
+
+    void record(uint64_t ns, bool ok = true)
+    {
+        int b = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+        if (b >= MS5611Stats::BUCKETS)
+            b = MS5611Stats::BUCKETS - 1;
+        _count.fetch_add(1, std::memory_order_relaxed);
+        if (!ok)
+            _errors.fetch_add(1, std::memory_order_relaxed);
+        _sum_ns.fetch_add(ns, std::memory_order_relaxed);
+        if (ns > _max_ns.load(std::memory_order_relaxed))
+            _max_ns.store(ns, std::memory_order_relaxed);
+        _bucket[b].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void snapshot(MS5611Stats::Hist &hist) const;
+
+    void reset();
+
+private:
+    std::atomic<uint64_t> _count;
+    std::atomic<uint64_t> _errors;
+    std::atomic<uint64_t> _sum_ns;
+    std::atomic<uint64_t> _max_ns;
+    std::atomic<uint64_t> _bucket[MS5611Stats::BUCKETS];
+};
+
+// live counters behind MS5611Stats
+class MS5611StatsCounters
+{
+public:
+    MS5611StatsCounters();
+
+    void set_spi_clk(unsigned spi_clk)
+    {
+        _spi_clk = spi_clk;
+    }
+
+    void set_startup(uint64_t ns, bool warm)
+    {
+        _startup_ns = ns;
+        _warm = warm;
+    }
+
+    void record(MS5611Stats::Op op, int osr, uint64_t ns, bool ok)
+    {
+        _hist[op][osr].record(ns, ok);
+    }
+
+    void count_crc_error()
+    {
+        _crc_errors.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void count_range_errors(uint64_t n = 1)
+    {
+        _range_errors.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void count_zero_adc()
+    {
+        _zero_adc.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void snapshot(MS5611Stats &stats) const;
+
+    void reset();
+
+private:
+    unsigned _spi_clk;
+    uint64_t _startup_ns;
+    bool _warm;
+    MS5611HistCounter _hist[MS5611Stats::OPS][MS5611Stats::OSRS];
+    std::atomic<uint64_t> _crc_errors;
+    std::atomic<uint64_t> _range_errors;
+    std::atomic<uint64_t> _zero_adc;
+};
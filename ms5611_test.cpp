@@ -1,8 +1,41 @@
 
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 #include "gtest/gtest.h"
 #include "ms5611.h"
+#include "ms5611_acq.h"
+#include "ms5611_alt.h"
+#include "ms5611_blog.h"
+#include "ms5611_calcache.h"
+#include "ms5611_clock.h"
+#include "ms5611_csv.h"
+#include "ms5611_filter.h"
+#include "ms5611_kalman.h"
+#include "ms5611_osrctl.h"
+#include "ms5611_pool.h"
+#include "ms5611_ring.h"
+#include "ms5611_rollup.h"
+#include "ms5611_sched.h"
+#include "ms5611_server.h"
+#include "ms5611_shm.h"
+#include "ms5611_sim.h"
 #include "ms5611_test.h"
 
 const char *correct_device = "/dev/spidev0.0";
@@ -115,15 +148,15 @@ TEST(ms5611, get_pressure)
                                MS5611::OSR2048, MS5611::OSR4096};
     // temperature and pressure should be "sane" (within reasonable lab
     // values) and close to the same at the different oversampling values
-    int32_t temp_first;
-    int32_t pres_first;
+    int32_t temp_first = 0;
+    int32_t pres_first = 0;
     int temp_diff_max = 0;
     int pres_diff_max = 0;
-    for (int clk = 0; clk < sizeof(spi_clks) / sizeof(spi_clks[0]); clk++) {
+    for (size_t clk = 0; clk < sizeof(spi_clks) / sizeof(spi_clks[0]); clk++) {
         unsigned spi_clk = spi_clks[clk];
         MS5611 m(correct_device, spi_clk);
         // std::cout << "clk=" << spi_clk << std::endl;
-        for (int over = 0; over < sizeof(oversamps) / sizeof(oversamps[0]);
+        for (size_t over = 0; over < sizeof(oversamps) / sizeof(oversamps[0]);
              over++) {
             MS5611::Osr oversamp = oversamps[over];
             // std::cout << "oversamp=" << int(oversamp) << std::endl;
@@ -177,8 +210,1756 @@ TEST(ms5611, get_pressure)
     EXPECT_GT(pres_diff_max, 0);
 }
 
+TEST(ms5611_sim, constructor)
+{
+    MS5611Sim sim;
+    MS5611 m(sim, 0);
+    ASSERT_TRUE(MS5611Test::is_ready(m));
+    ASSERT_EQ(MS5611Test::crc4(m), MS5611Test::c(m, 7) & 0x000f);
+
+    sim.inject_fault(MS5611Sim::FAULT_RESET);
+    MS5611 m_reset(sim, 0);
+    ASSERT_FALSE(MS5611Test::is_ready(m_reset));
+
+    sim.inject_fault(MS5611Sim::FAULT_PROM);
+    MS5611 m_prom(sim, 0);
+    ASSERT_FALSE(MS5611Test::is_ready(m_prom));
+
+    sim.inject_fault(MS5611Sim::FAULT_XFER);
+    MS5611 m_xfer(sim, 0);
+    ASSERT_FALSE(MS5611Test::is_ready(m_xfer));
+
+    // faults are used up
+    MS5611 m_ok(sim, 0);
+    ASSERT_TRUE(MS5611Test::is_ready(m_ok));
+}
+
+TEST(ms5611_sim, read_adc)
+{
+    MS5611Sim sim;
+    MS5611 m(sim, 0);
+    uint32_t data;
+
+    // no conversion
+    ASSERT_TRUE(m.read_adc(data));
+    ASSERT_EQ(data, 0);
+
+    // read before conversion is done
+    ASSERT_TRUE(m.start_convert_pres(MS5611::OSR4096));
+    ASSERT_TRUE(m.read_adc(data));
+    ASSERT_EQ(data, 0);
+    ASSERT_EQ(sim.early_reads(), 1);
+    usleep(10000);
+
+    // read after conversion is done, then again
+    ASSERT_TRUE(m.start_convert_pres(MS5611::OSR256));
+    usleep(1000);
+    ASSERT_TRUE(m.read_adc(data));
+    ASSERT_EQ(data, 9085466);
+    ASSERT_TRUE(m.read_adc(data));
+    ASSERT_EQ(data, 0);
+
+    sim.inject_fault(MS5611Sim::FAULT_XFER);
+    ASSERT_FALSE(m.read_adc(data));
+}
+
+TEST(ms5611_sim, start_convert)
+{
+    MS5611Sim sim;
+    sim.set_realtime(false);
+    MS5611 m(sim, 0);
+    for (int cmd = 0; cmd < 256; cmd++) {
+        uint32_t data = 0;
+        bool result = MS5611Test::do_convert(m, uint8_t(cmd), data);
+        if (cmd == 0x40 || cmd == 0x42 || cmd == 0x44 || cmd == 0x46 ||
+            cmd == 0x48) {
+            ASSERT_TRUE(result);
+            ASSERT_EQ(data, 8569150);
+        } else if (cmd == 0x50 || cmd == 0x52 || cmd == 0x54 ||
+                   cmd == 0x56 || cmd == 0x58) {
+            ASSERT_TRUE(result);
+            ASSERT_EQ(data, 9085466);
+        } else {
+            ASSERT_FALSE(result);
+        }
+    }
+}
+
+TEST(ms5611_sim, convert_template)
+{
+    EXPECT_EQ((MS5611::ConvertCmd<MS5611::TEMP, MS5611::OSR256>::cmd), 0x40);
+    EXPECT_EQ((MS5611::ConvertCmd<MS5611::PRES, MS5611::OSR4096>::cmd), 0x58);
+    EXPECT_EQ((MS5611::ConvertCmd<MS5611::PRES, MS5611::OSR1024>::usec),
+              MS5611::conv_usec(MS5611::OSR1024));
+
+    MS5611Sim sim;
+    MS5611 m(sim, 0);
+    uint32_t data = 0;
+    ASSERT_TRUE((m.convert<MS5611::TEMP, MS5611::OSR4096>(data)));
+    EXPECT_EQ(data, 8569150);
+    ASSERT_TRUE((m.convert<MS5611::PRES, MS5611::OSR256>(data)));
+    EXPECT_EQ(data, 9085466);
+    // the delay is long enough for the simulated (data sheet maximum) time
+    EXPECT_EQ(sim.early_reads(), 0);
+
+    ASSERT_TRUE((m.start_convert<MS5611::PRES, MS5611::OSR512>()));
+    usleep(MS5611::ConvertCmd<MS5611::PRES, MS5611::OSR512>::usec);
+    ASSERT_TRUE(m.read_adc(data));
+    EXPECT_EQ(data, 9085466);
+
+    sim.inject_fault(MS5611Sim::FAULT_XFER);
+    EXPECT_FALSE((m.convert<MS5611::PRES, MS5611::OSR256>(data)));
+}
+
+TEST(ms5611_sim, chains)
+{
+    MS5611Sim sim;
+    MS5611 m(sim, 0);
+    ASSERT_TRUE(MS5611Test::is_ready(m));
+
+    // temperature and pressure in one message
+    unsigned long messages = sim.messages();
+    uint32_t temp = 0, pres = 0;
+    ASSERT_TRUE(m.do_convert_pair(temp, pres, MS5611::OSR512,
+                                  MS5611::OSR4096));
+    EXPECT_EQ(temp, 8569150);
+    EXPECT_EQ(pres, 9085466);
+    EXPECT_EQ(sim.messages() - messages, 1);
+    EXPECT_EQ(sim.early_reads(), 0);
+
+    // burst spanning messages
+    const size_t n = MS5611::BURST_MAX + 10;
+    uint32_t burst[n + 1];
+    burst[n] = 0x12345678;
+    messages = sim.messages();
+    unsigned long conversions = sim.conversions();
+    ASSERT_TRUE(m.do_convert_burst(burst, n, MS5611::OSR256));
+    EXPECT_EQ(sim.messages() - messages, 2);
+    EXPECT_EQ(sim.conversions() - conversions, n);
+    EXPECT_EQ(sim.early_reads(), 0);
+    for (size_t i = 0; i < n; i++)
+        ASSERT_EQ(burst[i], 9085466);
+    EXPECT_EQ(burst[n], 0x12345678);
+
+    EXPECT_FALSE(m.do_convert_pair(temp, pres, MS5611::Osr(3)));
+    EXPECT_FALSE(m.do_convert_burst(burst, 1, MS5611::Osr(10)));
+    sim.inject_fault(MS5611Sim::FAULT_XFER);
+    EXPECT_FALSE(m.do_convert_burst(burst, 1, MS5611::OSR256));
+}
+
+TEST(ms5611_sim, get_pressure)
+{
+    MS5611Sim sim;
+    MS5611 m(sim, 0);
+    uint32_t temp_adc;
+    uint32_t pres_adc;
+    ASSERT_TRUE(m.do_convert_temp(temp_adc, MS5611::OSR4096));
+    ASSERT_TRUE(m.do_convert_pres(pres_adc, MS5611::OSR4096));
+    int32_t temp_x100;
+    int32_t pres_x100;
+    ASSERT_TRUE(m.get_pressure(temp_adc, pres_adc, temp_x100, pres_x100));
+    // data sheet example
+    ASSERT_EQ(temp_x100, 2007);
+    ASSERT_EQ(pres_x100, 100009);
+
+    // calibration only, no device
+    uint16_t prom[8];
+    m.get_prom(prom);
+    MS5611 cal(prom, 0);
+    ASSERT_FALSE(cal.is_ready());
+    ASSERT_TRUE(cal.has_cal());
+    ASSERT_TRUE(cal.get_pressure(temp_adc, pres_adc, temp_x100, pres_x100));
+    ASSERT_EQ(temp_x100, 2007);
+    ASSERT_EQ(pres_x100, 100009);
+    prom[7] ^= 0x0001;
+    MS5611 bad(prom, 0);
+    ASSERT_FALSE(bad.has_cal());
+}
+
+TEST(ms5611_sim, stream)
+{
+    MS5611Sim sim;
+    MS5611 m(sim, 0);
+    uint32_t temp_adc;
+    uint32_t pres_adc;
+
+    ASSERT_FALSE(m.stream_read(temp_adc, pres_adc));
+
+    MS5611::Osr oversamps[] = {MS5611::OSR256, MS5611::OSR512, MS5611::OSR1024,
+                               MS5611::OSR2048, MS5611::OSR4096};
+    for (size_t over = 0; over < sizeof(oversamps) / sizeof(oversamps[0]);
+         over++) {
+        MS5611::Osr oversamp = oversamps[over];
+        const int pairs = 10;
+        auto t1 = std::chrono::steady_clock::now();
+        ASSERT_TRUE(m.stream_start(oversamp, oversamp));
+        for (int i = 0; i < pairs; i++) {
+            ASSERT_TRUE(m.stream_read(temp_adc, pres_adc));
+            ASSERT_EQ(temp_adc, 8569150);
+            ASSERT_EQ(pres_adc, 9085466);
+        }
+        auto t2 = std::chrono::steady_clock::now();
+        m.stream_stop();
+        // never read early, and never wait much more than two conversions
+        ASSERT_EQ(sim.early_reads(), 0);
+        auto usec =
+            std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1)
+                .count();
+        ASSERT_GE(usec, pairs * 2 * MS5611::conv_usec(oversamp));
+        ASSERT_LT(usec, pairs * 2 * (MS5611::conv_usec(oversamp) + 2000));
+    }
+
+    // a new OSR applies from the next conversion started
+    ASSERT_FALSE(m.stream_start(MS5611::OSR4096, MS5611::Osr(3)));
+    ASSERT_TRUE(m.stream_start(MS5611::OSR4096, MS5611::OSR4096));
+    ASSERT_FALSE(m.stream_set_osr(MS5611::Osr(3), MS5611::OSR256));
+    ASSERT_TRUE(m.stream_set_osr(MS5611::OSR256, MS5611::OSR256));
+    ASSERT_TRUE(m.stream_read(temp_adc, pres_adc));
+    ASSERT_EQ(m.stream_osr(), MS5611::OSR256);
+    const MS5611Times &t = m.stream_times();
+    ASSERT_GE(t.temp_read_ns - t.temp_start_ns, 9599000);
+    ASSERT_EQ(t.mid_ns, t.pres_start_ns + 300000);
+    m.stream_stop();
+    ASSERT_EQ(sim.early_reads(), 0);
+}
+
+TEST(ms5611_sim, stream_temp_every)
+{
+    MS5611Sim sim;
+    MS5611 m(sim, 0);
+    uint32_t temp_adc;
+    uint32_t pres_adc;
+    int32_t temp_x100;
+    int32_t pres_x100;
+
+    // temperature before every 8th pressure conversion, and right after
+    // the next one when it moves 0.1 C; conversions latch the sim's values
+    // when they start
+    m.stream_set_temp_every(8, 10);
+    ASSERT_TRUE(m.stream_start(MS5611::OSR256, MS5611::OSR256));
+    auto t1 = std::chrono::steady_clock::now();
+    for (int i = 1; i <= 16; i++) {
+        ASSERT_TRUE(m.stream_read(temp_adc, pres_adc));
+        ASSERT_EQ(temp_adc, 8569150);
+        ASSERT_EQ(m.stream_temps(), i <= 8 ? 1 : 2);
+        ASSERT_TRUE(m.stream_get_pressure(pres_adc, temp_x100, pres_x100));
+        ASSERT_EQ(temp_x100, 2007);
+        ASSERT_EQ(pres_x100, 100009);
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    // 16 pressure and 2 temperature conversions
+    auto usec = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1)
+                    .count();
+    ASSERT_GE(usec, 18 * MS5611::conv_usec(MS5611::OSR256));
+    ASSERT_LT(usec, 18 * (MS5611::conv_usec(MS5611::OSR256) + 2000));
+
+    // about 0.17 C warmer from the temperature conversion after the one
+    // already started: that one (4) drifted, so 5 follows after one
+    // pressure conversion, then 6 after eight again
+    sim.set_adc(8569150 + 5000, 9085466);
+    for (int i = 17; i <= 34; i++) {
+        ASSERT_TRUE(m.stream_read(temp_adc, pres_adc));
+        ASSERT_EQ(temp_adc, i <= 24 ? 8569150 : 8569150 + 5000);
+        ASSERT_EQ(m.stream_temps(), i <= 24 ? 3 : i == 25 ? 4 : i <= 33 ? 5 : 6)
+            << i;
+        int32_t t;
+        int32_t p;
+        ASSERT_TRUE(m.get_pressure(temp_adc, pres_adc, t, p));
+        ASSERT_TRUE(m.stream_get_pressure(pres_adc, temp_x100, pres_x100));
+        ASSERT_EQ(temp_x100, t);
+        ASSERT_EQ(pres_x100, p);
+    }
+    ASSERT_GT(temp_x100, 2020);
+    m.stream_stop();
+    ASSERT_EQ(sim.early_reads(), 0);
+}
+
+TEST(ms5611_sim, async)
+{
+    MS5611Sim sim;
+    MS5611 m(sim, 0);
+    bool done;
+    uint32_t adc;
+
+    ASSERT_FALSE(m.try_complete(done, adc));
+    ASSERT_FALSE(m.busy());
+
+    int fd = m.async_fd();
+    ASSERT_GE(fd, 0);
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    ASSERT_GE(epfd, 0);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ASSERT_EQ(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev), 0);
+
+    // the timerfd wakes the loop at the deadline; nothing before it waits
+    // or reads early
+    MS5611::Convert whats[] = {MS5611::TEMP, MS5611::PRES};
+    uint32_t expect[] = {8569150, 9085466};
+    for (int i = 0; i < 2; i++) {
+        MS5611::Clock::time_point deadline = m.begin(whats[i]);
+        ASSERT_NE(deadline, MS5611::Clock::time_point());
+        ASSERT_TRUE(m.busy());
+        ASSERT_EQ(m.begin(whats[i]), MS5611::Clock::time_point());
+        ASSERT_FALSE(m.poll());
+        ASSERT_TRUE(m.try_complete(done, adc));
+        ASSERT_FALSE(done);
+        ASSERT_EQ(epoll_wait(epfd, &ev, 1, 0), 0);
+
+        ASSERT_EQ(epoll_wait(epfd, &ev, 1, 100), 1);
+        ASSERT_GE(MS5611::Clock::now(), deadline);
+        ASSERT_TRUE(m.poll());
+        ASSERT_TRUE(m.try_complete(done, adc));
+        ASSERT_TRUE(done);
+        ASSERT_EQ(adc, expect[i]);
+        ASSERT_FALSE(m.busy());
+
+        // disarmed by the read
+        ASSERT_EQ(epoll_wait(epfd, &ev, 1, 0), 0);
+    }
+
+    // no conversions while streaming, and no stream while converting
+    ASSERT_NE(m.begin(MS5611::TEMP, MS5611::OSR256),
+              MS5611::Clock::time_point());
+    ASSERT_FALSE(m.stream_start());
+    std::this_thread::sleep_for(
+        std::chrono::microseconds(MS5611::conv_usec(MS5611::OSR256)));
+    ASSERT_TRUE(m.try_complete(done, adc));
+    ASSERT_TRUE(done);
+    ASSERT_TRUE(m.stream_start());
+    ASSERT_EQ(m.begin(MS5611::TEMP), MS5611::Clock::time_point());
+    m.stream_stop();
+
+    ASSERT_EQ(m.begin(MS5611::TEMP, MS5611::Osr(3)),
+              MS5611::Clock::time_point());
+    ASSERT_EQ(sim.early_reads(), 0);
+    close(epfd);
+}
+
+// random raw samples, temperatures from about -45 to 90 C
+static void random_adc(const uint16_t prom[8], uint32_t *temp_adc,
+                       uint32_t *pres_adc, int n)
+{
+    for (int i = 0; i < n; i++) {
+        // dT = temp_adc - c5 * 256; temp = 2000 + dT * c6 / 2^23
+        int32_t temp = rand() % 13600 - 4500;
+        int64_t dT = int64_t(temp - 2000) * (1 << 23) / prom[6];
+        temp_adc[i] = (int64_t(prom[5]) * 256 + dT) & 0x00ffffff;
+        pres_adc[i] = rand() & 0x00ffffff;
+    }
+}
+
+TEST(ms5611_comp, batch)
+{
+    // data sheet example and random proms
+    uint16_t prom[8] = {0x0000, 40127, 36924, 23317, 23282, 33464, 28312, 0};
+    for (int p = 0; p < 10; p++) {
+        MS5611Comp comp(prom);
+        const int n = 1003; // not a multiple of vector length
+        uint32_t temp_adc[n];
+        uint32_t pres_adc[n];
+        random_adc(prom, temp_adc, pres_adc, n);
+        int32_t temp_x100[n];
+        int32_t pres_x100[n];
+        size_t good =
+            comp.compensate(temp_adc, pres_adc, n, temp_x100, pres_x100);
+        size_t good_scalar = 0;
+        for (int i = 0; i < n; i++) {
+            int32_t temp = INT32_MIN;
+            int32_t pres = INT32_MIN;
+            bool ok = comp.compensate(temp_adc[i], pres_adc[i], temp, pres);
+
+            // one temperature's terms for another pressure
+            MS5611Comp::Terms terms;
+            ASSERT_EQ(comp.terms(temp_adc[i], terms), ok);
+            ASSERT_EQ(terms.temp_x100, temp);
+            if (ok) {
+                int32_t t;
+                int32_t p;
+                uint32_t other = pres_adc[(i + 1) % n];
+                ASSERT_TRUE(comp.compensate(temp_adc[i], other, t, p));
+                ASSERT_EQ(MS5611Comp::pressure(terms, other), p);
+            }
+
+            if (ok)
+                good_scalar++;
+            else
+                temp = INT32_MIN;
+            ASSERT_EQ(temp_x100[i], temp) << i;
+            ASSERT_EQ(pres_x100[i], pres) << i;
+        }
+        ASSERT_EQ(good, good_scalar);
+        ASSERT_GT(good, 0);
+        ASSERT_LT(good, n);
+        for (int i = 1; i <= 6; i++)
+            prom[i] = 10000 + rand() % 50000;
+    }
+
+    MS5611Sim sim;
+    MS5611 m(sim, 0);
+    uint32_t temp_adc = 8569150;
+    uint32_t pres_adc = 9085466;
+    int32_t temp_x100;
+    int32_t pres_x100;
+    ASSERT_EQ(m.get_pressure(&temp_adc, &pres_adc, 1, &temp_x100, &pres_x100),
+              1);
+    ASSERT_EQ(temp_x100, 2007);
+    ASSERT_EQ(pres_x100, 100009);
+}
+
+TEST(ms5611_sched, run)
+{
+    const int n = 3;
+    MS5611Sim sims[n];
+    MS5611Sched sched(0);
+    for (int d = 0; d < n; d++) {
+        sims[d].set_adc(8569150 + d, 9085466 + d);
+        ASSERT_EQ(sched.add(sims[d], MS5611::OSR1024), d);
+    }
+
+    // devices convert concurrently, so they are serviced in turn rather
+    // than one running ahead of the others
+    const unsigned long pairs = 20;
+    unsigned long got[n] = {0};
+    ASSERT_TRUE(sched.run(
+        [&](int dev, uint32_t temp_adc, uint32_t pres_adc) {
+            ASSERT_EQ(temp_adc, 8569150 + dev);
+            ASSERT_EQ(pres_adc, 9085466 + dev);
+            got[dev]++;
+            for (int d = 0; d < n; d++)
+                ASSERT_LE(got[dev], got[d] + 1);
+        },
+        n * pairs));
+
+    for (int d = 0; d < n; d++) {
+        ASSERT_EQ(sims[d].early_reads(), 0);
+        ASSERT_EQ(sched.errors(d), 0);
+        ASSERT_EQ(got[d], pairs);
+        ASSERT_EQ(sched.pairs(d), got[d]);
+        ASSERT_GT(sched.rate_hz(d), 0);
+    }
+}
+
+TEST(ms5611_sched, start_fails)
+{
+    // the second device can't start, so the first is stopped again
+    MS5611Sim sims[2];
+    MS5611Sched sched(0);
+    ASSERT_EQ(sched.add(sims[0], MS5611::OSR256), 0);
+    ASSERT_EQ(sched.add(sims[1], MS5611::Osr(3)), 1);
+    ASSERT_FALSE(sched.run([](int, uint32_t, uint32_t) {}));
+    ASSERT_NE(sched.device(0).begin(MS5611::TEMP, MS5611::OSR256),
+              MS5611::Clock::time_point());
+    ASSERT_EQ(sims[0].early_reads(), 0);
+}
+
+TEST(ms5611_ring, push_pop)
+{
+    MS5611Ring<int, 8> ring;
+    int out[16];
+
+    ASSERT_EQ(ring.pop(out, 16), 0);
+
+    // fill, overrun, then drain in pieces, several times around
+    int next_in = 0;
+    int next_out = 0;
+    for (int pass = 0; pass < 5; pass++) {
+        for (int i = 0; i < 8; i++)
+            ASSERT_TRUE(ring.push(next_in++));
+        ASSERT_FALSE(ring.push(-1));
+        ASSERT_EQ(ring.overruns(), pass + 1);
+        ASSERT_EQ(ring.size(), 8);
+        ASSERT_EQ(ring.pop(out, 3), 3);
+        ASSERT_EQ(ring.pop(out + 3, 16), 5);
+        for (int i = 0; i < 8; i++)
+            ASSERT_EQ(out[i], next_out++);
+    }
+}
+
+TEST(ms5611_ring, threads)
+{
+    static MS5611Ring<uint64_t, 64> ring;
+    const uint64_t n = 100000;
+    std::thread producer([&]() {
+        for (uint64_t i = 0; i < n; i++)
+            while (!ring.push(i))
+                std::this_thread::yield();
+    });
+    uint64_t expect = 0;
+    uint64_t buf[16];
+    while (expect < n) {
+        size_t got = ring.pop(buf, 16);
+        for (size_t i = 0; i < got; i++)
+            ASSERT_EQ(buf[i], expect++);
+        if (got == 0)
+            std::this_thread::yield();
+    }
+    producer.join();
+}
+
+// wait (up to 10 seconds) for acq to deliver n samples
+static bool wait_samples(const MS5611Acq &acq, uint64_t n)
+{
+    for (int i = 0; i < 10000 && acq.samples() < n; i++)
+        usleep(1000);
+    return acq.samples() >= n;
+}
+
+TEST(ms5611_acq, run)
+{
+    MS5611Sim sim;
+    MS5611 m(sim, 0);
+    MS5611Acq acq(m, MS5611::OSR512, 0);
+    ASSERT_TRUE(acq.start());
+    ASSERT_TRUE(wait_samples(acq, 20));
+    acq.stop();
+
+    // 2 x 1.2 msec per sample
+    std::vector<MS5611Sample> s(MS5611Acq::RING_SIZE);
+    size_t got = acq.read(s.data(), s.size());
+    int64_t real_offset_ns = MS5611Clock::real_offset_ns();
+    ASSERT_GE(got, 20);
+    ASSERT_EQ(got, acq.samples());
+    ASSERT_EQ(acq.overruns(), 0);
+    ASSERT_EQ(acq.errors(), 0);
+    for (size_t i = 0; i < got; i++) {
+        ASSERT_EQ(s[i].temp_adc, 8569150);
+        ASSERT_EQ(s[i].pres_adc, 9085466);
+        ASSERT_EQ(s[i].temp_x100, 2007);
+        ASSERT_EQ(s[i].pres_x100, 100009);
+        if (i > 0) {
+            ASSERT_GE(s[i].time_ns - s[i - 1].time_ns, 2400000);
+        }
+
+        // conversions back to back, each read after it finished (allowing
+        // for the raw and monotonic clocks running at slightly different
+        // rates); mid is half a conversion after the pressure start
+        const MS5611Times &t = s[i].times;
+        ASSERT_GE(t.temp_read_ns - t.temp_start_ns, 1199000);
+        ASSERT_GE(t.pres_start_ns, t.temp_read_ns);
+        ASSERT_GE(t.pres_read_ns - t.pres_start_ns, 1199000);
+        ASSERT_EQ(t.mid_ns, t.pres_start_ns + 600000);
+        if (i > 0) {
+            ASSERT_GE(t.temp_start_ns, s[i - 1].times.pres_read_ns);
+        }
+        ASSERT_LT(std::abs(s[i].real_offset_ns - real_offset_ns), 10000000);
+    }
+    ASSERT_EQ(acq.read(s.data(), s.size()), 0);
+    ASSERT_EQ(sim.early_reads(), 0);
+}
+
+TEST(ms5611_acq, osr_ctl)
+{
+    // the sim's pressure is steady, so the controller goes to max_osr
+    MS5611Sim sim;
+    MS5611 m(sim, 0);
+    MS5611Acq acq(m, MS5611::OSR256, 0);
+    MS5611OsrCtl::Config cfg;
+    cfg.max_osr = MS5611::OSR1024;
+    cfg.hold = 4;
+    acq.set_osr_ctl(cfg);
+    ASSERT_TRUE(acq.start());
+    for (int i = 0; i < 10000 && acq.osr() != MS5611::OSR1024; i++)
+        usleep(1000);
+    acq.stop();
+
+    ASSERT_EQ(acq.osr(), MS5611::OSR1024);
+    ASSERT_EQ(acq.osr_switches_up(), 1);
+    ASSERT_EQ(acq.osr_switches_down(), 0);
+    ASSERT_FALSE(acq.moving());
+    ASSERT_EQ(acq.errors(), 0);
+    ASSERT_EQ(sim.early_reads(), 0);
+}
+
+TEST(ms5611_acq, realtime)
+{
+    MS5611Sim sim;
+    MS5611 m(sim, 0);
+    MS5611Acq acq(m, MS5611::OSR512, 0);
+
+    // no such cpu
+    MS5611Acq::Realtime rt;
+    rt.cpu = CPU_SETSIZE - 1;
+    acq.set_realtime(rt);
+    ASSERT_FALSE(acq.start());
+    ASSERT_FALSE(acq.running());
+
+    // pinned, spinning the last 300 usec (SCHED_FIFO and mlockall need
+    // privileges, so they are not tested)
+    rt.cpu = 0;
+    rt.spin_usec = 300;
+    acq.set_realtime(rt);
+    ASSERT_TRUE(acq.start());
+    ASSERT_TRUE(wait_samples(acq, 20));
+    acq.stop();
+
+    std::vector<MS5611Sample> s(MS5611Acq::RING_SIZE);
+    size_t got = acq.read(s.data(), s.size());
+    ASSERT_GE(got, 20);
+    ASSERT_EQ(sim.early_reads(), 0);
+
+    // one wakeup per conversion
+    MS5611Stats::Hist late;
+    acq.lateness(late);
+    EXPECT_GE(late.count, 2 * got);
+    EXPECT_LT(late.percentile_ns(50), 1000000u);
+}
+
+// pressure sampled at whatever OSR the controller picks, with the
+// datasheet's noise for that OSR; returns the time at the end
+static int64_t osr_run(MS5611OsrCtl &ctl, std::mt19937 &rng, int64_t t_ns,
+                       double seconds, double pa_s, double *pres)
+{
+    std::normal_distribution<double> noise(0, 1);
+    int64_t end_ns = t_ns + int64_t(seconds * 1e9);
+    MS5611::Osr osr = ctl.osr();
+    while (t_ns < end_ns) {
+        double dt = 1 / MS5611OsrCtl::pair_hz(osr);
+        t_ns += int64_t(dt * 1e9);
+        *pres += pa_s * dt;
+        double p = *pres + noise(rng) * MS5611OsrCtl::resolution_pa(osr);
+        osr = ctl.update(t_ns, int32_t(lround(p)), osr);
+    }
+    return t_ns;
+}
+
+TEST(ms5611_osrctl, adapt)
+{
+    std::mt19937 rng(1);
+    double pres = 100000;
+    int64_t t = 0;
+
+    // steady: max_osr; climbing at 300 Pa/s (about 25 m/s): down at once,
+    // to an OSR whose step per sample is within its noise; steady again:
+    // back up after hold
+    MS5611OsrCtl ctl(MS5611OsrCtl::Config(), MS5611::OSR4096);
+    t = osr_run(ctl, rng, t, 2, 0, &pres);
+    ASSERT_EQ(ctl.osr(), MS5611::OSR4096);
+    ASSERT_EQ(ctl.switches_up() + ctl.switches_down(), 0);
+    ASSERT_FALSE(ctl.moving());
+    ASSERT_LT(ctl.noise_pa(), 2.0);
+
+    t = osr_run(ctl, rng, t, 2, -300, &pres);
+    ASSERT_TRUE(ctl.moving());
+    ASSERT_LT(ctl.osr(), MS5611::OSR4096);
+    ASSERT_GT(ctl.osr(), MS5611::OSR256);
+    ASSERT_NEAR(ctl.slope_pa_s(), -300, 30);
+    ASSERT_LE(300 / MS5611OsrCtl::pair_hz(ctl.osr()),
+              MS5611OsrCtl::resolution_pa(ctl.osr()));
+    uint64_t down = ctl.switches_down();
+    ASSERT_GE(down, 1);
+
+    t = osr_run(ctl, rng, t, 2, 0, &pres);
+    ASSERT_FALSE(ctl.moving());
+    ASSERT_EQ(ctl.osr(), MS5611::OSR4096);
+    ASSERT_EQ(ctl.switches_down(), down);
+
+    // rate target while moving, noise target while steady: 1.2 Pa at 4096
+    // predicts 1.8 at 2048 (within 2.75 less 20%) and 2.7 at 1024 (not)
+    MS5611OsrCtl::Config cfg;
+    ASSERT_TRUE(MS5611OsrCtl::parse("rate:300,noise:2.75,hold:8", cfg));
+    ASSERT_EQ(cfg.rate_hz, 300);
+    ASSERT_EQ(cfg.noise_pa, 2.75);
+    ASSERT_EQ(cfg.hold, 8);
+    ctl = MS5611OsrCtl(cfg, MS5611::OSR4096);
+    t = osr_run(ctl, rng, t, 5, 0, &pres);
+    ASSERT_EQ(ctl.osr(), MS5611::OSR2048);
+    ASSERT_EQ(ctl.switches_down(), 1);
+    t = osr_run(ctl, rng, t, 1, 500, &pres);
+    ASSERT_EQ(ctl.osr(), MS5611::OSR512); // 417 Hz; 1024 is 208
+    t = osr_run(ctl, rng, t, 3, 0, &pres);
+    ASSERT_EQ(ctl.osr(), MS5611::OSR2048);
+
+    // out of range samples are ignored
+    MS5611::Osr osr = ctl.osr();
+    for (int i = 0; i < 100; i++)
+        ASSERT_EQ(ctl.update(t + i, INT32_MIN, osr), osr);
+
+    ASSERT_TRUE(MS5611OsrCtl::parse("auto", cfg));
+    ASSERT_FALSE(MS5611OsrCtl::parse("rate:0", cfg));
+    ASSERT_FALSE(MS5611OsrCtl::parse("rate:1000", cfg));
+    ASSERT_FALSE(MS5611OsrCtl::parse("noise", cfg));
+    ASSERT_FALSE(MS5611OsrCtl::parse("hold:1.5", cfg));
+    ASSERT_FALSE(MS5611OsrCtl::parse("speed:3", cfg));
+    ASSERT_FALSE(MS5611OsrCtl::parse("", cfg));
+}
+
+TEST(ms5611_blog, write_read)
+{
+    const char *path = "/tmp/ms5611_test.blog";
+    const uint16_t prom[8] = {0x0000, 40127, 36924, 23317,
+                              23282,  33464, 28312, 0x0000};
+    const int n = 1000;
+    // sample times, 2.4 msec apart
+    auto t = [](int i) { return 1000000000 + int64_t(i) * 2400000; };
+
+    for (int compress = 0; compress < 2; compress++) {
+        MS5611BlogWriter w(0);
+        ASSERT_TRUE(w.open(path, prom, MS5611::OSR1024, compress, 64));
+        MS5611Sample s;
+        s.osr = -1;
+        for (int i = 0; i < n; i++) {
+            s.time_ns = t(i);
+            s.temp_adc = 8569150 + (i % 7) - 3;
+            s.pres_adc = 9085466 - (i % 11) + 5;
+            ASSERT_TRUE(w.write(s));
+        }
+        ASSERT_TRUE(w.close());
+
+        for (int truncate = 0; truncate < 2; truncate++) {
+            if (truncate) {
+                // lose the index and part of the last block
+                ASSERT_EQ(::truncate(path, 64 + 15 * (32 + 64 * 16) + 100),
+                          0);
+            }
+            MS5611BlogReader r(0);
+            ASSERT_TRUE(r.open(path));
+            ASSERT_EQ(r.header().prom[5], 33464);
+            ASSERT_EQ(r.header().osr, MS5611::OSR1024);
+            int blocks = truncate ? 15 : (n + 63) / 64;
+            ASSERT_EQ(r.blocks(), blocks);
+            MS5611BlogRecord buf[64];
+            int i = 0;
+            for (size_t b = 0; b < r.blocks(); b++) {
+                const MS5611BlogRecord *recs = r.block_records(b, buf);
+                ASSERT_TRUE(recs != NULL);
+                // uncompressed records are used in place
+                ASSERT_EQ(recs == buf, bool(compress));
+                for (size_t j = 0; j < r.block_count(b); j++, i++) {
+                    ASSERT_EQ(recs[j].time_ns, t(i));
+                    ASSERT_EQ(recs[j].temp_adc, 8569150 + (i % 7) - 3);
+                    ASSERT_EQ(recs[j].pres_adc, 9085466 - (i % 11) + 5);
+                }
+            }
+            ASSERT_EQ(i, blocks * 64 < n ? blocks * 64 : n);
+
+            size_t block;
+            size_t record;
+            ASSERT_TRUE(r.seek(0, block, record));
+            ASSERT_EQ(block, 0);
+            ASSERT_EQ(record, 0);
+            // between samples 99 and 100
+            ASSERT_TRUE(r.seek(t(99) + 1, block, record));
+            ASSERT_EQ(block, 1);
+            ASSERT_EQ(record, 100 - 64);
+            ASSERT_FALSE(r.seek(t(n), block, record));
+            ASSERT_EQ(r.block_osr(0), MS5611::OSR1024);
+            if (compress)
+                break; // truncation offsets above are for uncompressed
+        }
+    }
+
+    // a block ends where the OSR changes; -1 is the header's
+    for (int compress = 0; compress < 2; compress++) {
+        MS5611BlogWriter w(0);
+        ASSERT_TRUE(w.open(path, prom, MS5611::OSR4096, compress, 64));
+        MS5611Sample s = MS5611Sample();
+        for (int i = 0; i < 100; i++) {
+            s.time_ns = t(i);
+            s.osr = i < 10 ? MS5611::OSR4096 : i < 80 ? MS5611::OSR256
+                    : i < 90 ? MS5611::OSR4096 : -1;
+            ASSERT_TRUE(w.write(s));
+        }
+        ASSERT_TRUE(w.close());
+
+        MS5611BlogReader r(0);
+        ASSERT_TRUE(r.open(path));
+        ASSERT_EQ(r.blocks(), 4);
+        size_t counts[] = {10, 64, 6, 20};
+        MS5611::Osr osrs[] = {MS5611::OSR4096, MS5611::OSR256, MS5611::OSR256,
+                              MS5611::OSR4096};
+        for (size_t b = 0; b < 4; b++) {
+            EXPECT_EQ(r.block_count(b), counts[b]);
+            EXPECT_EQ(r.block_osr(b), osrs[b]);
+        }
+    }
+    unlink(path);
+}
+
+// csv line as ms5611_log formatted it with iostreams
+static std::string csv_reference(time_t t, const MS5611Sample &s, double alt)
+{
+    struct tm t_tm;
+    localtime_r(&t, &t_tm);
+    char t_str[80];
+    memset(t_str, 0, sizeof(t_str));
+    strftime(t_str, 79, "%F, %T, ", &t_tm);
+
+    std::ostringstream os;
+    os.setf(std::ios::fixed, std::ios::floatfield);
+    os.precision(2);
+    os << t_str << std::dec << std::setw(0) << s.temp_adc << ", " << std::hex
+       << std::setw(8) << std::setfill('0') << s.temp_adc << ", " << std::dec
+       << std::setw(0) << s.pres_adc << ", " << std::hex << std::setw(8)
+       << std::setfill('0') << s.pres_adc << ", " << s.temp_x100 / 100.0
+       << ", " << s.pres_x100 / 100.0 << ", " << alt << std::endl;
+    return os.str();
+}
+
+TEST(ms5611_csv, reference)
+{
+    const char *path = "/tmp/ms5611_test.csv";
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(fd, 0);
+
+    std::string expect;
+    {
+        MS5611Csv csv(fd, 0, 1000); // small buffer, so it flushes when full
+        time_t t = 1476508470;
+        double alts[] = {0.0,    -0.0,   0.004,  -0.004, 0.005,   -0.005,
+                         0.015,  1.125,  127.04, -42.5,  12.345, 1e20,
+                         -1e-9,  NAN,    INFINITY};
+        for (int i = 0; i < 2000; i++) {
+            MS5611Sample s;
+            s.temp_adc = rand() & 0x00ffffff;
+            s.pres_adc = rand() & 0x00ffffff;
+            s.temp_x100 = rand() % 20000 - 10000;
+            s.pres_x100 = rand() % 120000;
+            if (i % 100 == 0)
+                s.temp_x100 = s.pres_x100 = INT32_MIN;
+            double alt;
+            if (size_t(i) < sizeof(alts) / sizeof(alts[0]))
+                alt = alts[i];
+            else
+                alt = (rand() % 2000000 - 500000) / 1000.0 + i * 1e-7;
+            t += rand() % 2;
+            csv.line(t, s, alt);
+            expect += csv_reference(t, s, alt);
+        }
+        ASSERT_TRUE(csv.flush());
+    }
+    close(fd);
+
+    std::ifstream f(path);
+    std::string got((std::istreambuf_iterator<char>(f)),
+                    std::istreambuf_iterator<char>());
+    ASSERT_EQ(got, expect);
+    unlink(path);
+}
+
+TEST(ms5611_csv, reader)
+{
+    const char *path = "/tmp/ms5611_test.csv";
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(fd, 0);
+
+    const int n = 3000;
+    std::vector<MS5611Sample> s(n);
+    std::vector<time_t> t(n);
+    {
+        MS5611Csv csv(fd, 0);
+        csv.header();
+        time_t now = 1476508470;
+        for (int i = 0; i < n; i++) {
+            s[i].temp_adc = rand() & 0x00ffffff;
+            s[i].pres_adc = rand() & 0x00ffffff;
+            s[i].temp_x100 = rand() % 20000 - 10000;
+            s[i].pres_x100 = rand() % 120000;
+            now += rand() % 2;
+            t[i] = now;
+            csv.line(t[i], s[i], 127.04);
+        }
+        ASSERT_TRUE(csv.flush());
+    }
+    // a bad line, then a last line without a newline
+    const char tail[] = "garbage\n2016-10-14, 21:14:30, 8357308, 007f85bc, "
+                        "8413336, 00806098, 25.11, 998.63, 127.04";
+    ASSERT_EQ(write(fd, tail, sizeof(tail) - 1), sizeof(tail) - 1);
+    close(fd);
+
+    // small buffer, so lines straddle refills
+    MS5611CsvReader r(0, 1000);
+    ASSERT_TRUE(r.open(path));
+    MS5611Sample got[n + 1];
+    time_t got_t[n + 1];
+    size_t count = 0;
+    size_t k;
+    while ((k = r.read(got + count, got_t + count, 7)) > 0)
+        count += k;
+    ASSERT_EQ(count, n + 1);
+    ASSERT_EQ(r.skipped(), 2); // header and garbage
+    ASSERT_FALSE(r.error());
+    for (int i = 0; i < n; i++) {
+        ASSERT_EQ(got[i].temp_adc, s[i].temp_adc);
+        ASSERT_EQ(got[i].pres_adc, s[i].pres_adc);
+        ASSERT_EQ(got_t[i], t[i]);
+    }
+    ASSERT_EQ(got[n].temp_adc, 8357308);
+    ASSERT_EQ(got[n].pres_adc, 8413336);
+    r.close();
+    unlink(path);
+
+    ASSERT_FALSE(r.open("/tmp/no_such_dir/ms5611_test.csv"));
+}
+
+TEST(ms5611_alt, exact)
+{
+    // every 0.13 mbar over 10..1200 mbar, at the sensor's temperature
+    // limits and in between, and for a few sea level pressures
+    int32_t qnhs[] = {95000, 101325, 105000};
+    int32_t temps[] = {-4000, 2000, 8500};
+    double max_err = 0;
+    for (int32_t qnh : qnhs) {
+        MS5611Alt alt(qnh);
+        ASSERT_EQ(alt.qnh(), qnh);
+        for (int32_t temp : temps) {
+            for (int32_t pres = 1000; pres <= 120000; pres += 13) {
+                double exact = MS5611Alt::altitude_m(pres / 100.0, temp / 100.0,
+                                                     qnh / 100.0);
+                double err = fabs(alt.altitude_cm(pres, temp) - exact * 100);
+                if (err > max_err)
+                    max_err = err;
+            }
+        }
+    }
+    EXPECT_LT(max_err, 1.0);
+
+    MS5611Alt alt;
+    EXPECT_EQ(alt.altitude_cm(101325, 1500), 0);
+    EXPECT_EQ(alt.altitude_cm(99, 2000), INT32_MIN);
+    EXPECT_EQ(alt.altitude_cm(0, 2000), INT32_MIN);
+    EXPECT_EQ(alt.altitude_cm(INT32_MIN, INT32_MIN), INT32_MIN);
+
+    // batch matches one at a time
+    const size_t n = 1000;
+    int32_t pres[n], temp[n], alt_cm[n];
+    for (size_t i = 0; i < n; i++) {
+        pres[i] = rand() % 130000;
+        temp[i] = rand() % 12500 - 4000;
+    }
+    alt.set_qnh(102000);
+    alt.altitude_cm(pres, temp, n, alt_cm);
+    for (size_t i = 0; i < n; i++)
+        ASSERT_EQ(alt_cm[i], alt.altitude_cm(pres[i], temp[i]));
+}
+
+// outputs of f for in[0..n)
+static std::vector<int32_t> filter_run(MS5611Filter &f, const int32_t *in,
+                                       size_t n)
+{
+    std::vector<int32_t> out;
+    int32_t y;
+    for (size_t i = 0; i < n; i++)
+        if (f.put(in[i], y))
+            out.push_back(y);
+    return out;
+}
+
+TEST(ms5611_filter, constant)
+{
+    // every filter passes a constant through exactly
+    const size_t n = 256;
+    int32_t in[n];
+    for (size_t i = 0; i < n; i++)
+        in[i] = 100009;
+
+    MS5611Cic cic1(16), cic3(8, 3);
+    MS5611Fir fir(MS5611Fir::lowpass(31, 0.1), 4);
+    MS5611Iir iir(0.01);
+    MS5611Median med(5);
+    MS5611Filter *filters[] = {&cic1, &cic3, &fir, &iir, &med};
+    for (MS5611Filter *f : filters) {
+        std::vector<int32_t> out = filter_run(*f, in, n);
+        ASSERT_EQ(out.size(), n / f->decimation());
+        for (size_t i = 0; i < out.size(); i++)
+            ASSERT_EQ(out[i], 100009);
+    }
+
+    std::vector<int32_t> taps = MS5611Fir::lowpass(31, 0.1);
+    int32_t sum = 0;
+    for (int32_t t : taps)
+        sum += t;
+    EXPECT_EQ(sum, 32768);
+}
+
+TEST(ms5611_filter, cic)
+{
+    // order 1 is a block average
+    int32_t in[] = {1, 2, 3, 4, -10, -20, -30, -41, INT32_MAX, INT32_MAX};
+    MS5611Cic cic(2);
+    std::vector<int32_t> out = filter_run(cic, in, 10);
+    std::vector<int32_t> expect = {2, 4, -15, -36, INT32_MAX};
+    EXPECT_EQ(out, expect);
+    EXPECT_EQ(cic.delay(), 0.5);
+}
+
+TEST(ms5611_filter, iir)
+{
+    // step response reaches 1 - (1 - alpha)^k
+    MS5611Iir iir(0.25);
+    int32_t y;
+    iir.put(0, y);
+    for (int k = 1; k <= 8; k++) {
+        iir.put(1000000, y);
+        EXPECT_NEAR(y, 1000000 * (1 - pow(0.75, k)), 1);
+    }
+    EXPECT_EQ(iir.delay(), 3);
+}
+
+TEST(ms5611_filter, median)
+{
+    int32_t in[] = {10, 11, 500, 12, 13, -400, 14, 15, 16, 17};
+
+    // running median
+    MS5611Median med(3);
+    std::vector<int32_t> out = filter_run(med, in, 10);
+    std::vector<int32_t> expect = {10, 11, 11, 12, 13, 12, 13, 14, 15, 16};
+    EXPECT_EQ(out, expect);
+
+    // spike rejection: only the spikes change
+    MS5611Median rej(5, 50);
+    out = filter_run(rej, in, 10);
+    expect = {10, 11, 11, 12, 13, 12, 14, 15, 16, 17};
+    EXPECT_EQ(out, expect);
+    EXPECT_EQ(rej.rejected(), 2u);
+}
+
+TEST(ms5611_filter, chain)
+{
+    MS5611FilterChain chain(0);
+    EXPECT_FALSE(chain.add("cic"));
+    EXPECT_FALSE(chain.add("cic:0"));
+    EXPECT_FALSE(chain.add("fir:4"));
+    EXPECT_FALSE(chain.add("median:4"));
+    EXPECT_FALSE(chain.add("iir:2"));
+    EXPECT_FALSE(chain.add("median:5,bogus:1"));
+    EXPECT_EQ(chain.stages(), 0u);
+
+    ASSERT_TRUE(chain.add("median:5:200,cic:4:2,fir:2:15,iir:0.5"));
+    EXPECT_EQ(chain.stages(), 4u);
+    EXPECT_EQ(chain.decimation(), 8u);
+    // 0 + 2 * 3 / 2 + 4 * 7 + 8 * 1
+    EXPECT_EQ(chain.delay(), 39);
+
+    // noise from the simulator is reduced
+    MS5611Sim sim;
+    sim.set_realtime(false);
+    sim.set_noise(200);
+    MS5611 ms5611(sim, 0);
+    ASSERT_TRUE(MS5611Test::is_ready(ms5611));
+    const size_t n = 800;
+    std::vector<int32_t> raw, filtered;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t adc;
+        ASSERT_TRUE(ms5611.do_convert_pres(adc, MS5611::OSR256));
+        int32_t y;
+        raw.push_back(int32_t(adc));
+        if (chain.put(int32_t(adc), y))
+            filtered.push_back(y);
+    }
+    ASSERT_EQ(filtered.size(), n / 8);
+    auto stddev = [](const std::vector<int32_t> &v, size_t skip) {
+        double sum = 0, sum2 = 0;
+        for (size_t i = skip; i < v.size(); i++) {
+            sum += v[i];
+            sum2 += double(v[i]) * v[i];
+        }
+        double m = sum / (v.size() - skip);
+        return sqrt(sum2 / (v.size() - skip) - m * m);
+    };
+    EXPECT_LT(stddev(filtered, 0), stddev(raw, 0) / 3);
+}
+
+TEST(ms5611_calcache, warm_attach)
+{
+    const char *path = "/tmp/ms5611_test.cal";
+    unlink(path);
+
+    MS5611CalCache cache(path, 0);
+    ASSERT_TRUE(cache.load()); // missing file is empty
+    EXPECT_EQ(cache.size(), 0u);
+
+    // no entry: cold attach adds one
+    MS5611Sim sim;
+    {
+        MS5611 m(sim, 0, &cache, "sim0");
+        ASSERT_TRUE(MS5611Test::is_ready(m));
+        EXPECT_FALSE(m.warm_attached());
+    }
+    uint16_t prom[8], sim_prom[8];
+    sim.get_prom(sim_prom);
+    ASSERT_TRUE(cache.get("sim0", prom));
+    EXPECT_EQ(memcmp(prom, sim_prom, sizeof(prom)), 0);
+    ASSERT_TRUE(cache.save());
+
+    // reloaded, with junk lines ignored
+    {
+        std::ofstream f(path, std::ios::app);
+        f << "junk" << std::endl;
+        f << "bad 0 1 2 3 4 5 6 7" << std::endl; // CRC
+    }
+    MS5611CalCache cache2(path, 0);
+    ASSERT_TRUE(cache2.load());
+    EXPECT_EQ(cache2.size(), 1u);
+
+    // warm: one PROM message, no reset
+    unsigned long messages = sim.messages();
+    {
+        MS5611 m(sim, 0, &cache2, "sim0");
+        ASSERT_TRUE(MS5611Test::is_ready(m));
+        EXPECT_TRUE(m.warm_attached());
+        uint16_t c[8];
+        m.get_prom(c);
+        EXPECT_EQ(memcmp(c, sim_prom, sizeof(c)), 0);
+        uint32_t data;
+        ASSERT_TRUE(m.do_convert_pres(data, MS5611::OSR256));
+        EXPECT_EQ(data, 9085466);
+        MS5611Stats s;
+        if (m.get_stats(s)) {
+            EXPECT_TRUE(s.warm);
+            EXPECT_GT(s.startup_ns, 0u);
+            EXPECT_EQ(s.hist[MS5611Stats::RESET][MS5611Stats::OSR_NONE].count,
+                      0u);
+        }
+    }
+    EXPECT_EQ(sim.messages() - messages, 2u);
+
+    // a different chip: cold attach, entry updated
+    sim_prom[1]++;
+    sim.set_prom(sim_prom);
+    sim.get_prom(sim_prom);
+    {
+        MS5611 m(sim, 0, &cache2, "sim0");
+        ASSERT_TRUE(MS5611Test::is_ready(m));
+        EXPECT_FALSE(m.warm_attached());
+    }
+    ASSERT_TRUE(cache2.get("sim0", prom));
+    EXPECT_EQ(memcmp(prom, sim_prom, sizeof(prom)), 0);
+
+    unlink(path);
+}
+
+TEST(ms5611_calcache, left_idle)
+{
+    const char *path = "/tmp/ms5611_test.cal";
+    unlink(path);
+
+    MS5611Sim sim;
+    sim.set_adc(1111111, 2222222);
+    MS5611CalCache cache(path, 0);
+    ASSERT_TRUE(cache.load());
+    uint32_t t;
+    uint32_t p;
+
+    // killed mid-conversion: the entry was saved busy after attaching (as
+    // ms5611_log does), and the pressure conversion is still running when
+    // the next process attaches
+    {
+        MS5611 m(sim, 0, &cache, "sim0");
+        ASSERT_TRUE(cache.save());
+        ASSERT_TRUE(m.start_convert_pres(MS5611::OSR4096));
+
+        MS5611CalCache next(path, 0);
+        ASSERT_TRUE(next.load());
+        EXPECT_FALSE(next.idle("sim0"));
+        MS5611 m2(sim, 0, &next, "sim0");
+        ASSERT_TRUE(MS5611Test::is_ready(m2));
+        EXPECT_FALSE(m2.warm_attached());
+        ASSERT_TRUE(m2.do_convert_temp(t, MS5611::OSR4096));
+        EXPECT_EQ(t, 1111111u);
+        ASSERT_TRUE(m2.do_convert_temp(t, MS5611::OSR256));
+        EXPECT_EQ(t, 1111111u);
+    }
+
+    // clean exits with a conversion in progress: the destructor waits it
+    // out and reads it, and marks the entry idle
+    {
+        MS5611 m(sim, 0, &cache, "sim0");
+        EXPECT_FALSE(cache.idle("sim0"));
+        ASSERT_TRUE(m.start_convert_pres(MS5611::OSR4096));
+    }
+    EXPECT_TRUE(cache.idle("sim0"));
+    {
+        MS5611 m(sim, 0, &cache, "sim0");
+        EXPECT_TRUE(m.warm_attached());
+        ASSERT_TRUE(m.stream_start(MS5611::OSR4096, MS5611::OSR4096));
+        ASSERT_TRUE(m.stream_read(t, p));
+        EXPECT_EQ(p, 2222222u);
+    }
+    {
+        MS5611 m(sim, 0, &cache, "sim0");
+        EXPECT_TRUE(m.warm_attached());
+        ASSERT_NE(m.begin(MS5611::PRES), MS5611::Clock::time_point());
+    }
+
+    // and the mark survives a reload
+    ASSERT_TRUE(cache.save());
+    MS5611CalCache reloaded(path, 0);
+    ASSERT_TRUE(reloaded.load());
+    EXPECT_TRUE(reloaded.idle("sim0"));
+    {
+        MS5611 m(sim, 0, &reloaded, "sim0");
+        EXPECT_TRUE(m.warm_attached());
+        ASSERT_TRUE(m.do_convert_temp(t, MS5611::OSR4096));
+        EXPECT_EQ(t, 1111111u);
+        ASSERT_TRUE(m.do_convert_temp(t, MS5611::OSR256));
+        EXPECT_EQ(t, 1111111u);
+    }
+    EXPECT_EQ(sim.early_reads(), 0u);
+
+    unlink(path);
+}
+
+TEST(ms5611_stats, counters)
+{
+    MS5611Sim sim;
+    sim.set_realtime(false);
+    MS5611 m(sim, 0);
+    MS5611Stats s;
+    if (!m.get_stats(s))
+        return; // built without MS5611_STATS
+
+    EXPECT_EQ(s.spi_clk, 0u);
+    EXPECT_EQ(s.hist[MS5611Stats::RESET][MS5611Stats::OSR_NONE].count, 1u);
+    EXPECT_EQ(s.hist[MS5611Stats::PROM][MS5611Stats::OSR_NONE].count, 1u);
+
+    uint32_t data;
+    for (int i = 0; i < 3; i++)
+        ASSERT_TRUE(m.do_convert_pres(data, MS5611::OSR4096));
+    ASSERT_TRUE(m.start_convert_temp(MS5611::OSR256));
+    ASSERT_TRUE(m.read_adc(data));
+    sim.inject_fault(MS5611Sim::FAULT_XFER);
+    ASSERT_FALSE(m.read_adc(data));
+    sim.inject_fault(MS5611Sim::FAULT_ADC_ZERO);
+    ASSERT_TRUE(m.do_convert_temp(data, MS5611::OSR1024));
+    ASSERT_EQ(data, 0u);
+
+    int32_t temp, pres;
+    EXPECT_FALSE(m.get_pressure(0, 9085466, temp, pres));
+
+    ASSERT_TRUE(m.stream_start(MS5611::OSR512, MS5611::OSR2048));
+    for (int i = 0; i < 4; i++) {
+        uint32_t t, p;
+        ASSERT_TRUE(m.stream_read(t, p));
+    }
+    m.stream_stop();
+
+    ASSERT_TRUE(m.get_stats(s));
+    const MS5611Stats::Hist &dc = s.hist[MS5611Stats::DO_CONVERT][4];
+    EXPECT_EQ(dc.count, 3u);
+    EXPECT_EQ(dc.errors, 0u);
+    uint64_t sum = 0;
+    for (int b = 0; b < MS5611Stats::BUCKETS; b++)
+        sum += dc.bucket[b];
+    EXPECT_EQ(sum, dc.count);
+    EXPECT_LE(dc.percentile_ns(50), dc.max_ns);
+    EXPECT_EQ(s.hist[MS5611Stats::DO_CONVERT][2].count, 1u);
+    EXPECT_EQ(s.hist[MS5611Stats::START_CONVERT][0].count, 1u);
+    EXPECT_EQ(s.hist[MS5611Stats::START_CONVERT][1].count, 1u); // stream
+    const MS5611Stats::Hist &ra = s.hist[MS5611Stats::READ_ADC][5];
+    EXPECT_EQ(ra.count, 3u); // including stream_stop's
+    EXPECT_EQ(ra.errors, 1u);
+    EXPECT_EQ(s.hist[MS5611Stats::READ_ADC_CONVERT][1].count, 4u);
+    EXPECT_EQ(s.hist[MS5611Stats::READ_ADC_CONVERT][3].count, 4u);
+    EXPECT_EQ(s.hist[MS5611Stats::WAKEUP][1].count, 4u);
+    EXPECT_EQ(s.hist[MS5611Stats::WAKEUP][3].count, 4u);
+    EXPECT_EQ(s.zero_adc, 1u);
+    EXPECT_EQ(s.range_errors, 1u);
+    EXPECT_EQ(s.crc_errors, 0u);
+
+    std::ostringstream os;
+    s.print(os);
+    EXPECT_NE(os.str().find("do_convert       4096            3"),
+              std::string::npos);
+    // the stream's formatting is left as it was
+    os.str("");
+    os << 12345.6;
+    EXPECT_EQ(os.str(), "12345.6");
+
+    m.reset_stats();
+    ASSERT_TRUE(m.get_stats(s));
+    EXPECT_EQ(s.hist[MS5611Stats::DO_CONVERT][4].count, 0u);
+
+    // a bad PROM is counted even though the device is not ready
+    MS5611Sim bad;
+    bad.inject_fault(MS5611Sim::FAULT_PROM);
+    MS5611 mb(bad, 0);
+    ASSERT_FALSE(MS5611Test::is_ready(mb));
+    ASSERT_TRUE(mb.get_stats(s));
+    EXPECT_EQ(s.crc_errors, 1u);
+}
+
+// gaussian, from uniform rand()
+static double gauss(double sigma)
+{
+    double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sigma * sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+TEST(ms5611_kalman, step)
+{
+    // 50 Hz, 10 cm noise; level for 2 s, then climbing at 2 m/s
+    MS5611Kalman kf(5.0, 0.1);
+    const int64_t dt_ns = 20000000;
+    double max_level = 0;
+    for (int i = 0; i <= 200; i++) {
+        double t = i * dt_ns * 1e-9;
+        double h = 100 + (t > 2 ? 2 * (t - 2) : 0);
+        ASSERT_TRUE(kf.update(i * dt_ns, h + gauss(0.1)));
+        if (i >= 50 && i <= 100 && fabs(kf.velocity()) > max_level)
+            max_level = fabs(kf.velocity());
+        if (i >= 120) {
+            // within 20 samples of the step
+            EXPECT_NEAR(kf.velocity(), 2.0, 0.5) << i;
+            EXPECT_NEAR(kf.altitude(), h, 0.2) << i;
+        }
+    }
+    EXPECT_LT(max_level, 0.5);
+    EXPECT_LT(kf.velocity_sigma(), 0.5);
+
+    // time must advance
+    double h = kf.altitude();
+    EXPECT_FALSE(kf.update(200 * dt_ns, 0.0));
+    EXPECT_EQ(kf.altitude(), h);
+
+    kf.reset();
+    EXPECT_FALSE(kf.primed());
+    ASSERT_TRUE(kf.update(0, 5.0));
+    EXPECT_EQ(kf.altitude(), 5.0);
+    EXPECT_EQ(kf.velocity(), 0.0);
+}
+
+TEST(ms5611_kalman, samples)
+{
+    // altitude from samples matches MS5611Alt
+    MS5611Kalman kf;
+    kf.set_qnh(101325);
+    MS5611Sample s = MS5611Sample();
+    s.time_ns = 1000;
+    s.temp_x100 = 2000;
+    s.pres_x100 = 100009;
+    ASSERT_TRUE(kf.update(s));
+    EXPECT_EQ(kf.altitude(),
+              MS5611Alt(101325).altitude_cm(100009, 2000) / 100.0);
+
+    s.time_ns += 1000000;
+    s.pres_x100 = s.temp_x100 = INT32_MIN;
+    EXPECT_FALSE(kf.update(s));
+
+    // the middle of the conversion is used when it is known
+    s.pres_x100 = 100009;
+    s.temp_x100 = 2000;
+    s.times.mid_ns = 500;
+    EXPECT_FALSE(kf.update(s));
+    s.times.mid_ns = 5000;
+    EXPECT_TRUE(kf.update(s));
+    EXPECT_EQ(kf.time_ns(), 5000);
+}
+
+TEST(ms5611_pool, run)
+{
+    const int n = 1000;
+    std::atomic<int> done[n];
+    for (int i = 0; i < n; i++)
+        done[i] = 0;
+
+    MS5611Pool pool(3);
+    ASSERT_EQ(pool.threads(), 3);
+    for (int i = 0; i < n; i++) {
+        pool.submit([&done, i] {
+            // uneven work, so idle workers steal
+            if (i % 3 == 0)
+                usleep(100);
+            done[i]++;
+        });
+    }
+    pool.wait();
+    for (int i = 0; i < n; i++)
+        ASSERT_EQ(done[i], 1);
+
+    // reusable after wait()
+    std::atomic<int> count(0);
+    for (int i = 0; i < 10; i++)
+        pool.submit([&count] { count++; });
+    pool.wait();
+    ASSERT_EQ(count, 10);
+}
+
+static void expect_agg_eq(const MS5611Agg &a, const MS5611Agg &b)
+{
+    EXPECT_EQ(a.count, b.count);
+    EXPECT_EQ(a.range_errors, b.range_errors);
+    EXPECT_EQ(a.temp_min, b.temp_min);
+    EXPECT_EQ(a.temp_max, b.temp_max);
+    EXPECT_EQ(a.pres_min, b.pres_min);
+    EXPECT_EQ(a.pres_max, b.pres_max);
+    EXPECT_EQ(a.temp_sum, b.temp_sum);
+    EXPECT_EQ(a.pres_sum, b.pres_sum);
+    EXPECT_EQ(a.pres_diff2, b.pres_diff2);
+    EXPECT_EQ(a.pres_diffs, b.pres_diffs);
+    EXPECT_EQ(a.temp_drift(), b.temp_drift());
+}
+
+static void expect_osrs_eq(const MS5611Rollup &a, const MS5611Rollup &b)
+{
+    ASSERT_EQ(a.osrs().size(), b.osrs().size());
+    auto o = a.osrs().begin();
+    for (auto &w : b.osrs()) {
+        EXPECT_EQ(o->first, w.first);
+        expect_agg_eq(o->second, w.second);
+        o++;
+    }
+}
+
+TEST(ms5611_rollup, merge)
+{
+    const int n = 10000;
+    std::vector<time_t> t(n);
+    std::vector<int32_t> temp(n), pres(n);
+    time_t now = 1476508470;
+    for (int i = 0; i < n; i++) {
+        now += rand() % 3;
+        t[i] = now;
+        temp[i] = 2000 + rand() % 100;
+        pres[i] = 100000 + rand() % 1000;
+        if (i % 97 == 0)
+            temp[i] = pres[i] = INT32_MIN;
+    }
+
+    // runs at different OSRs, some not known
+    auto osr = [](int i) {
+        return (i / 250) % 3 == 2 ? (i / 750) % 2 * 8 : -1;
+    };
+
+    MS5611Rollup whole(60);
+    for (int i = 0; i < n; i++)
+        whole.add(t[i], temp[i], pres[i], osr(i));
+
+    // chunks at random boundaries, merged left to right and as a tree
+    std::vector<MS5611Rollup> chunks;
+    for (int i = 0; i < n;) {
+        int len = 1 + rand() % 500;
+        chunks.push_back(MS5611Rollup(60));
+        for (int j = i; j < i + len && j < n; j++)
+            chunks.back().add(t[j], temp[j], pres[j], osr(j));
+        i += len;
+    }
+    MS5611Rollup left(60);
+    for (auto &c : chunks)
+        left.merge(c);
+    while (chunks.size() > 1) {
+        std::vector<MS5611Rollup> up;
+        for (size_t i = 0; i < chunks.size(); i += 2) {
+            up.push_back(chunks[i]);
+            if (i + 1 < chunks.size())
+                up.back().merge(chunks[i + 1]);
+        }
+        chunks.swap(up);
+    }
+
+    for (const MS5611Rollup *r : {&left, &chunks[0]}) {
+        expect_agg_eq(r->total(), whole.total());
+        expect_osrs_eq(*r, whole);
+        ASSERT_EQ(r->periods().size(), whole.periods().size());
+        auto p = r->periods().begin();
+        for (auto &w : whole.periods()) {
+            EXPECT_EQ(p->first, w.first);
+            EXPECT_EQ(p->first % 60, 0);
+            expect_agg_eq(p->second, w.second);
+            p++;
+        }
+    }
+    EXPECT_EQ(whole.total().range_errors, (n + 96) / 97);
+    EXPECT_GT(whole.total().pres_noise(), 0);
+    EXPECT_EQ(whole.osrs().size(), 3u);
+}
+
+TEST(ms5611_rollup, osr_runs)
+{
+    // steady at OSR4096 either side of a fast change at OSR256: the change
+    // is in the total's noise but not in OSR4096's
+    auto add = [](MS5611Rollup &r, int from, int to) {
+        for (int i = from; i < to; i++) {
+            bool fast = i >= 10 && i < 20;
+            int32_t pres = i < 10  ? 100000 + i % 2
+                           : fast ? 100000 - 100 * (i - 9)
+                                  : 99000 + i % 2;
+            r.add(1476508470 + i, 2000, pres, fast ? 0 : 8);
+        }
+    };
+    MS5611Rollup whole(60);
+    add(whole, 0, 30);
+    ASSERT_EQ(whole.osrs().size(), 2u);
+    const MS5611Agg &steady = whole.osrs().at(8);
+    const MS5611Agg &fast = whole.osrs().at(0);
+    EXPECT_EQ(steady.count, 20u);
+    EXPECT_EQ(steady.pres_diffs, 18u);
+    EXPECT_DOUBLE_EQ(steady.pres_noise(), sqrt(0.5));
+    EXPECT_EQ(fast.count, 10u);
+    EXPECT_DOUBLE_EQ(fast.pres_noise(), 100 / sqrt(2));
+    EXPECT_GT(whole.total().pres_noise(), 10 * steady.pres_noise());
+
+    // nor are the steps between OSRs in the period's or the total's noise
+    EXPECT_EQ(whole.total().pres_diffs, 18u + 9u);
+    ASSERT_EQ(whole.periods().size(), 1u);
+    expect_agg_eq(whole.periods().begin()->second, whole.total());
+
+    // the same in chunks, split inside and at the ends of runs
+    for (int split : {5, 10, 15, 20, 25}) {
+        MS5611Rollup a(60), b(60);
+        add(a, 0, split);
+        add(b, split, 30);
+        a.merge(b);
+        expect_osrs_eq(a, whole);
+        expect_agg_eq(a.total(), whole.total());
+    }
+}
+
+// sample i of a test sequence; every field derives from i
+static MS5611Sample shm_sample(uint64_t i)
+{
+    MS5611Sample s = MS5611Sample();
+    s.time_ns = i * 1000;
+    s.temp_adc = uint32_t(i) & 0x00ffffff;
+    s.pres_adc = uint32_t(i * 3) & 0x00ffffff;
+    s.temp_x100 = int32_t(i % 10000);
+    s.pres_x100 = int32_t(i % 120000);
+    s.times.mid_ns = i * 7;
+    s.real_offset_ns = i * 11;
+    return s;
+}
+
+static bool shm_sample_ok(const MS5611Sample &s, uint64_t i)
+{
+    MS5611Sample e = shm_sample(i);
+    return memcmp(&s, &e, sizeof(s)) == 0;
+}
+
+TEST(ms5611_shm, publish)
+{
+    std::string name = "/ms5611_test_" + std::to_string(getpid());
+    uint16_t prom[8] = {0, 40127, 36924, 23317, 23282, 33464, 28312, 0};
+
+    MS5611ShmWriter w(0);
+    ASSERT_FALSE(w.open(name, prom, 1000)); // not a power of two
+    ASSERT_TRUE(w.open(name, prom, 256));
+
+    MS5611ShmReader r(0);
+    ASSERT_FALSE(r.open("/ms5611_test_no_such_segment"));
+    ASSERT_TRUE(r.open(name));
+    ASSERT_EQ(r.history(), 256);
+    ASSERT_EQ(memcmp(r.prom(), prom, sizeof(prom)), 0);
+
+    MS5611Sample s;
+    ASSERT_FALSE(r.latest(s));
+    ASSERT_EQ(r.count(), 0);
+
+    uint64_t next = 0;
+    MS5611Sample buf[300];
+    for (uint64_t i = 0; i < 100; i++)
+        w.publish(shm_sample(i));
+    uint64_t n;
+    ASSERT_TRUE(r.latest(s, &n));
+    ASSERT_EQ(n, 99);
+    ASSERT_TRUE(shm_sample_ok(s, 99));
+    ASSERT_EQ(r.read(next, buf, 300), 100);
+    ASSERT_EQ(next, 100);
+    for (uint64_t i = 0; i < 100; i++)
+        ASSERT_TRUE(shm_sample_ok(buf[i], i));
+
+    // fall behind by more than the history
+    for (uint64_t i = 100; i < 1000; i++)
+        w.publish(shm_sample(i));
+    ASSERT_EQ(r.read(next, buf, 300), 256);
+    ASSERT_EQ(r.lost(), 1000 - 256 - 100);
+    for (uint64_t i = 0; i < 256; i++)
+        ASSERT_TRUE(shm_sample_ok(buf[i], 1000 - 256 + i));
+    ASSERT_EQ(r.recent(buf, 10), 10);
+    ASSERT_TRUE(shm_sample_ok(buf[9], 999));
+
+    // concurrent writer: every read is whole
+    std::atomic<bool> stop(false);
+    std::thread writer([&w, &stop] {
+        for (uint64_t i = 1000; !stop; i++)
+            w.publish(shm_sample(i));
+    });
+    uint64_t last = 0;
+    for (int k = 0; k < 20000; k++) {
+        ASSERT_TRUE(r.latest(s, &n));
+        ASSERT_TRUE(shm_sample_ok(s, n));
+        ASSERT_GE(n, last);
+        last = n;
+        size_t got = r.recent(buf, 16);
+        for (size_t i = 0; i < got; i++)
+            ASSERT_TRUE(shm_sample_ok(buf[i], buf[i].time_ns / 1000));
+        if (k % 1000 == 0)
+            std::this_thread::yield();
+    }
+    stop = true;
+    writer.join();
+
+    // segment goes away with the writer; a mapped reader keeps working
+    w.close();
+    ASSERT_TRUE(r.latest(s));
+    MS5611ShmReader r2(0);
+    ASSERT_FALSE(r2.open(name));
+}
+
+TEST(ms5611_shm, dead_writer)
+{
+    std::string name = "/ms5611_test_" + std::to_string(getpid());
+    uint16_t prom[8] = {0, 40127, 36924, 23317, 23282, 33464, 28312, 0};
+
+    MS5611ShmWriter w(0);
+    ASSERT_TRUE(w.open(name, prom, 256));
+    for (uint64_t i = 0; i < 3; i++)
+        w.publish(shm_sample(i));
+
+    // the writer killed halfway through publishing sample 3
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    ASSERT_GE(fd, 0);
+    struct stat st;
+    ASSERT_EQ(fstat(fd, &st), 0);
+    void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, 0);
+    close(fd);
+    ASSERT_NE(map, MAP_FAILED);
+    MS5611ShmHeader *hdr = (MS5611ShmHeader *)map;
+    MS5611ShmSlot *slots = (MS5611ShmSlot *)(hdr + 1);
+    hdr->latest.seq.store(2 * 3 + 1);
+    slots[3].seq.store(2 * 3 + 1);
+
+    // readers give up on it instead of spinning
+    MS5611ShmReader r(0);
+    ASSERT_TRUE(r.open(name));
+    MS5611Sample s;
+    ASSERT_FALSE(r.latest(s));
+    uint64_t next = 0;
+    MS5611Sample buf[4];
+    ASSERT_EQ(r.read(next, buf, 4), 3);
+    ASSERT_TRUE(shm_sample_ok(buf[2], 2));
+    hdr->count.store(4);
+    ASSERT_EQ(r.read(next, buf, 4), 0);
+    ASSERT_EQ(r.lost(), 1);
+
+    // a history that is not a power of two is not trusted
+    r.close();
+    hdr->history = 0;
+    ASSERT_FALSE(r.open(name));
+    hdr->history = 3;
+    ASSERT_FALSE(r.open(name));
+    hdr->history = 256;
+    ASSERT_TRUE(r.open(name));
+
+    munmap(map, st.st_size);
+}
+
+static MS5611Subscribe subscription(unsigned decimation, unsigned batch,
+                                    uint32_t policy)
+{
+    MS5611Subscribe sub = MS5611Subscribe();
+    sub.magic = MS5611Subscribe::MAGIC;
+    sub.decimation = decimation;
+    sub.batch = batch;
+    sub.policy = policy;
+    return sub;
+}
+
+// poll until n clients have subscribed
+static bool server_wait(MS5611Server &server, size_t n)
+{
+    std::vector<MS5611Server::ClientStats> stats;
+    for (int i = 0; i < 1000; i++) {
+        server.poll();
+        server.stats(stats);
+        if (stats.size() == n)
+            return true;
+        usleep(1000);
+    }
+    return false;
+}
+
+TEST(ms5611_server, subscribe)
+{
+    std::string path = "/tmp/ms5611_test_" + std::to_string(getpid());
+    MS5611Server server(0);
+    ASSERT_TRUE(server.listen_unix(path));
+    ASSERT_TRUE(server.listen_udp(0));
+    ASSERT_NE(server.udp_port(), 0);
+
+    MS5611Client unix_client(0);
+    MS5611Client udp_client(0);
+    ASSERT_TRUE(unix_client.open_unix(
+        path, subscription(2, 4, MS5611Subscribe::DROP_NEWEST)));
+    ASSERT_TRUE(udp_client.open_udp(
+        server.udp_port(), subscription(1, 8, MS5611Subscribe::DROP_NEWEST)));
+    ASSERT_TRUE(server_wait(server, 2));
+
+    for (uint64_t i = 0; i < 64; i++)
+        server.publish(shm_sample(i));
+
+    MS5611FrameHeader hdr;
+    std::vector<MS5611FrameRecord> recs;
+    for (int f = 0; f < 8; f++) {
+        ASSERT_TRUE(unix_client.read(hdr, recs));
+        ASSERT_EQ(hdr.count, 4);
+        ASSERT_EQ(hdr.first, f * 4);
+        ASSERT_EQ(hdr.dropped, 0);
+        for (int i = 0; i < 4; i++) {
+            // every other sample
+            uint64_t n = (f * 4 + i) * 2;
+            ASSERT_EQ(recs[i].temp_adc, n);
+            ASSERT_EQ(recs[i].pres_adc, n * 3);
+            // no realtime offset (n == 0) gets the time it was sent
+            if (n > 0) {
+                ASSERT_EQ(recs[i].time_ns, int64_t(n * 7 + n * 11));
+            }
+        }
+        ASSERT_TRUE(udp_client.read(hdr, recs));
+        ASSERT_EQ(hdr.count, 8);
+        ASSERT_EQ(hdr.first, f * 8);
+        ASSERT_EQ(recs[7].temp_adc, f * 8 + 7);
+    }
+
+    // unsubscribing drops the UDP client
+    ASSERT_TRUE(udp_client.subscribe(subscription(0, 1, 0)));
+    ASSERT_TRUE(server_wait(server, 1));
+    udp_client.close();
+
+    // a client that doesn't read loses frames, and publish never blocks;
+    // frame headers account for every gap
+    auto t1 = std::chrono::steady_clock::now();
+    for (uint64_t i = 64; i < 200000; i++)
+        server.publish(shm_sample(i));
+    auto t2 = std::chrono::steady_clock::now();
+    EXPECT_LT(std::chrono::duration<double>(t2 - t1).count(), 2.0);
+    std::vector<MS5611Server::ClientStats> stats;
+    server.stats(stats);
+    ASSERT_EQ(stats.size(), 1);
+    ASSERT_GT(stats[0].dropped, 0);
+    uint64_t records = stats[0].records;
+    ASSERT_GT(records, 0);
+
+    uint64_t next = 32;
+    uint64_t dropped = 0;
+    uint64_t got = 0;
+    while (got < records) {
+        server.poll();
+        ASSERT_TRUE(unix_client.read(hdr, recs));
+        ASSERT_EQ(hdr.first - next, hdr.dropped - dropped);
+        next = hdr.first + hdr.count;
+        dropped = hdr.dropped;
+        got += hdr.count;
+    }
+
+    // DISCONNECT: the client is closed when it falls behind
+    ASSERT_TRUE(
+        unix_client.subscribe(subscription(1, 1, MS5611Subscribe::DISCONNECT)));
+    server_wait(server, 1);
+    for (uint64_t i = 0; i < 200000 && server.clients() > 0; i++)
+        server.publish(shm_sample(i));
+    ASSERT_EQ(server.clients(), 0);
+}
+
 int main(int argc, char *argv[])
 {
+    // hardware tests use MS5611_DEV if set
+    const char *dev = getenv("MS5611_DEV");
+    if (dev != NULL)
+        correct_device = dev;
+
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
 }
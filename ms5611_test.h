@@ -7,7 +7,7 @@ class MS5611Test
 public:
     static bool is_ready(const MS5611 &m)
     {
-        return m._fd > 0;
+        return m._xport != NULL;
     }
     static bool reset(MS5611 &m)
     {